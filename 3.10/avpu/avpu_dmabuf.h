@@ -10,4 +10,5 @@ int avpu_create_dmabuf_fd(struct device *dev, unsigned long size,
 			 struct avpu_dma_buffer *buffer);
 int avpu_allocate_dmabuf(struct device *dev, int size, u32 *fd);
 int avpu_dmabuf_get_address(struct device *dev, u32 fd, u32 *bus_address);
+int avpu_dmabuf_check_range(u32 fd, u32 offset, u32 len);
 
@@ -2,13 +2,24 @@
 #define _AL_ALLOC_H_
 
 #include <linux/device.h>
+#include <linux/list.h>
+
+struct dentry;
 
 struct avpu_dma_buffer {
 	u32 size;
 	dma_addr_t dma_handle;
 	void *cpu_handle;
+	struct list_head pool;		/* only while parked in the pool */
 };
 
+/*
+ * With a pool attached to the device, avpu_free_dma() parks buffers for
+ * reuse by a later request of the same page count instead of handing
+ * them back to CMA. Without one both calls go straight to the allocator.
+ */
+int avpu_dma_pool_init(struct device *dev, struct dentry *debugfs);
+
 struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size);
 void avpu_free_dma(struct device *dev, struct avpu_dma_buffer *buf);
 
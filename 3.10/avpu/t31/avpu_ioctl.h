@@ -9,6 +9,19 @@
 #define GET_DMA_FD        _IOWR('q', 13, struct avpu_dma_info)
 #define GET_DMA_PHY       _IOWR('q', 18, struct avpu_dma_info)
 #define JZ_CMD_FLUSH_CACHE			_IOWR('q', 14, int)
+#define AL_CMD_IP_WAIT_IRQS       _IOWR('q', 15, struct avpu_irq_batch)
+#define AL_CMD_IP_REG_BATCH       _IOWR('q', 16, struct avpu_reg_batch)
+
+/*
+ * AL_CMD_IP_ACQUIRE waits until the channel owns the encoder, taking a
+ * priority (higher first, arrival order within a priority). The channel
+ * keeps it, and receives its interrupts, until AL_CMD_IP_RELEASE or
+ * close. Register and interrupt commands fail with EBUSY on a channel
+ * that does not own the encoder.
+ */
+#define AL_CMD_IP_ACQUIRE       _IOW('q', 19, int)
+#define AL_CMD_IP_RELEASE       _IO('q', 20)
+#define AL_CMD_IP_SYNC_CACHE    _IOWR('q', 21, struct avpu_cache_batch)
 
 struct avpu_reg {
 	unsigned int id;
@@ -20,3 +33,72 @@ struct avpu_dma_info {
 	__u32 size;
 	__u32 phy_addr;
 };
+
+#define AVPU_IRQ_BATCH_MAX 32
+
+/*
+ * AL_CMD_IP_WAIT_IRQS: wait up to timeout_ms (< 0 forever, 0 not at all)
+ * for at least one interrupt, then return every pending one, oldest
+ * first. count is 0 if the timeout expired.
+ */
+struct avpu_irq_batch {
+	__s32 timeout_ms;
+	__u32 count;
+	__u32 irqs[AVPU_IRQ_BATCH_MAX];
+};
+
+#define AVPU_REG_BATCH_MAX 32
+/* Upper bound of avpu_reg_batch.poll_us */
+#define AVPU_REG_POLL_MAX_US 1000
+
+#define AVPU_REG_OP_WRITE	0
+#define AVPU_REG_OP_READ	1
+#define AVPU_REG_OP_WRITE_POLL	2	/* write, then wait for the mask bits to clear */
+
+struct avpu_reg_op {
+	__u32 op;
+	__u32 id;
+	__u32 value;	/* read and poll ops return the last value read */
+	__u32 mask;
+};
+
+/*
+ * AL_CMD_IP_REG_BATCH: run count register ops in order. The whole batch is
+ * checked before any of it reaches the hardware. Each poll gives up after
+ * poll_us microseconds with -ETIMEDOUT; done is the number of ops that
+ * completed either way.
+ */
+struct avpu_reg_batch {
+	__u32 count;
+	__u32 done;
+	__u32 poll_us;
+	struct avpu_reg_op ops[AVPU_REG_BATCH_MAX];
+};
+
+#define AVPU_CACHE_BATCH_MAX 16
+
+#define AVPU_CACHE_VADDR	0	/* handle is a user virtual address */
+#define AVPU_CACHE_BUF_ID	1	/* handle is the GET_DMA_MMAP offset */
+#define AVPU_CACHE_DMABUF	2	/* handle is a GET_DMA_FD dma-buf */
+
+struct avpu_cache_range {
+	__u32 type;
+	__u32 handle;
+	__u32 offset;
+	__u32 len;
+	__u32 dir;	/* enum dma_data_direction, as for JZ_CMD_FLUSH_CACHE */
+};
+
+/*
+ * AL_CMD_IP_SYNC_CACHE: cache maintenance on count ranges in one call.
+ * Ranges the CPU only reaches through uncached mappings, which includes
+ * every buffer this driver allocates, need none and are skipped. A
+ * virtual address range outside any single mapping of the caller fails
+ * the call with -EFAULT. flushed and skipped return the bytes in each group.
+ */
+struct avpu_cache_batch {
+	__u32 count;
+	__u32 flushed;
+	__u32 skipped;
+	struct avpu_cache_range ranges[AVPU_CACHE_BATCH_MAX];
+};
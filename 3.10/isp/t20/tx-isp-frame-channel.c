@@ -15,6 +15,7 @@
 #include <linux/delay.h>
 #include <linux/syscalls.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 
 #include "tx-isp-frame-channel.h"
 #include "tx-isp-videobuf.h"
@@ -22,11 +23,69 @@
 //#include "tx-isp-csi.h"
 //#include "tx-isp-vic.h"
 
+/*
+ * Buffers handed to the isp are found by DMA address through
+ * vdev->addr_map, so the irq path does not walk active_list. The map is
+ * only changed under vdev->slock.
+ */
+static inline unsigned int addr_map_slot(unsigned int addr)
+{
+	return hash_32(addr, FRAME_CHAN_ADDR_MAP_BITS);
+}
+
+static struct frame_channel_video_buffer *addr_map_find(frame_chan_vdev_t *vdev, unsigned int addr)
+{
+	unsigned int i = addr_map_slot(addr);
+	struct frame_channel_video_buffer *buf = NULL;
+
+	while((buf = vdev->addr_map[i]) != NULL){
+		if(buf->buf.addr == addr)
+			return buf;
+		i = (i + 1) & (FRAME_CHAN_ADDR_MAP_SIZE - 1);
+	}
+	return NULL;
+}
+
+static void addr_map_insert(frame_chan_vdev_t *vdev, struct frame_channel_video_buffer *buf)
+{
+	unsigned int i = addr_map_slot(buf->buf.addr);
+
+	while(vdev->addr_map[i] && vdev->addr_map[i]->buf.addr != buf->buf.addr)
+		i = (i + 1) & (FRAME_CHAN_ADDR_MAP_SIZE - 1);
+	vdev->addr_map[i] = buf;
+}
+
+static void addr_map_remove(frame_chan_vdev_t *vdev, struct frame_channel_video_buffer *buf)
+{
+	unsigned int mask = FRAME_CHAN_ADDR_MAP_SIZE - 1;
+	unsigned int i = addr_map_slot(buf->buf.addr);
+	unsigned int j, k;
+
+	while(vdev->addr_map[i] != buf){
+		if(vdev->addr_map[i] == NULL)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	/* move later members of the cluster up so lookups never stop early */
+	j = i;
+	for(;;){
+		vdev->addr_map[i] = NULL;
+		do {
+			j = (j + 1) & mask;
+			if(vdev->addr_map[j] == NULL)
+				return;
+			k = addr_map_slot(vdev->addr_map[j]->buf.addr);
+		} while(i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		vdev->addr_map[i] = vdev->addr_map[j];
+		i = j;
+	}
+}
+
 static int frame_channel_video_irq_notify(frame_chan_vdev_t  *vdev, u32 phyaddr, bool *handled)
 {
 	unsigned long flags;
 	struct frame_channel_video_buffer *buf = NULL;
-	struct frame_channel_video_buffer *pos = NULL;
 
 /*	if(atomic_read(&vdev->state) != TX_ISP_STATE_RUN){
 		printk("vdev->state is stop \n");
@@ -34,12 +93,10 @@ static int frame_channel_video_irq_notify(frame_chan_vdev_t  *vdev, u32 phyaddr,
 	}
 */
 	spin_lock_irqsave(&vdev->slock, flags);
-	list_for_each_entry(pos, &vdev->active_list, entry){
-		if(pos->buf.addr == phyaddr){
-			buf = pos;
-			list_del(&buf->entry);
-			break;
-		}
+	buf = addr_map_find(vdev, phyaddr);
+	if(buf){
+		addr_map_remove(vdev, buf);
+		list_del(&buf->entry);
 	}
 #if 0
 	if (!list_empty(&vdev->active_list)){
@@ -91,6 +148,7 @@ static int frame_channel_vb2_queue_setup(struct vb2_queue *vq, const struct v4l2
 
 //	printk("~~~~~~~~ %s[%d] size = %d ~~~~~~~~~~\n",__func__,__LINE__,size);
 	INIT_LIST_HEAD(&vdev->active_list);
+	memset(vdev->addr_map, 0, sizeof(vdev->addr_map));
 	return ret;
 }
 
@@ -127,6 +185,7 @@ static int frame_channel_vb2_buffer_prepare(struct vb2_buffer *vb)
 	struct v4l2_format *output = &attr->output;
 	unsigned long size = output->fmt.pix.sizeimage;
 	void * addr = NULL;
+	unsigned long flags;
 	int ret = ISP_SUCCESS;
 
 	/* 目前是单plane操作 */
@@ -157,7 +216,11 @@ static int frame_channel_vb2_buffer_prepare(struct vb2_buffer *vb)
 		}
 	}
 //	printk("~~~~ %s[%d] index = %d addr = 0x%08x ~~~~\n",__func__,__LINE__, v4l2_buf->index, (unsigned int)addr);
+	/* the address may change while a stale entry is still in the map */
+	spin_lock_irqsave(&vdev->slock, flags);
+	addr_map_remove(vdev, buf);
 	buf->buf.addr = (unsigned int)addr;
+	spin_unlock_irqrestore(&vdev->slock, flags);
 	return ret;
 }
 
@@ -188,6 +251,7 @@ static void frame_channel_vb2_buffer_queue(struct vb2_buffer *vb)
 //	ISP_PRINT(ISP_INFO_LEVEL,"%s==========%d\n", __func__, __LINE__);
 	spin_lock_irqsave(&vdev->slock, flags);
 	list_add_tail(&buf->entry, &vdev->active_list);
+	addr_map_insert(vdev, buf);
 	spin_unlock_irqrestore(&vdev->slock, flags);
 
 //	ISP_PRINT(ISP_INFO_LEVEL,"%s[%d] %p\n", __func__, __LINE__, &buf->buf);
@@ -52,6 +52,10 @@ struct frame_channel_video_buffer{
 	struct list_head entry;
 };
 
+/* DMA address to active buffer map, at most half full */
+#define FRAME_CHAN_ADDR_MAP_BITS	7
+#define FRAME_CHAN_ADDR_MAP_SIZE	(1 << FRAME_CHAN_ADDR_MAP_BITS)
+
 struct frame_channel_fh {
 	enum v4l2_priority prio;
 };
@@ -67,6 +71,8 @@ struct tx_isp_frame_channel_video_device {
 	struct video_device *video;
 	struct vb2_queue vbq;
 	struct list_head active_list;
+	/* open addressed, linear probing; protected by slock */
+	struct frame_channel_video_buffer *addr_map[FRAME_CHAN_ADDR_MAP_SIZE];
 	spinlock_t slock;
 	struct mutex mlock;
 	atomic_t state;
@@ -397,6 +397,32 @@ enum tx_isp_module_link_id {
 #define VIDIOC_GET_FRAME_FORMAT		_IOR('V', BASE_VIDIOC_PRIVATE + 4, struct frame_image_format)
 #define VIDIOC_DEFAULT_CMD_SET_BANKS	_IOW('V', BASE_VIDIOC_PRIVATE + 5, int)
 #define VIDIOC_DEFAULT_CMD_ISP_TUNING	_IOWR('V', BASE_VIDIOC_PRIVATE + 6, struct isp_image_tuning_default_ctrl)
+#define VIDIOC_DEFAULT_CMD_FRAME_RING	_IOW('V', BASE_VIDIOC_PRIVATE + 7, int)
+
+/*
+ * Frame ring, mapped with mmap() on a frame channel after
+ * VIDIOC_DEFAULT_CMD_FRAME_RING(1) and before streamon. The driver fills
+ * desc[head % FRAME_RING_SIZE] for every finished buffer and then advances
+ * head; the application reads descriptors up to head and advances tail,
+ * which also gives those buffers back to the driver. poll() reports POLLIN
+ * while head != tail. Both indices run freely and wrap at 2^32, and are
+ * reset to 0 by streamoff.
+ */
+#define FRAME_RING_SIZE		64
+
+struct frame_ring_desc {
+	unsigned int index;		/* v4l2 buffer index */
+	unsigned int sequence;
+	unsigned int ts_sec;
+	unsigned int ts_usec;
+};
+
+struct frame_ring {
+	volatile unsigned int head;	/* written by the driver */
+	volatile unsigned int tail;	/* written by the application */
+	unsigned int reserved[6];
+	struct frame_ring_desc desc[FRAME_RING_SIZE];
+};
 
 #define VIDIOC_CREATE_SUBDEV_LINKS	_IOW('V', BASE_VIDIOC_PRIVATE + 16, int)
 #define VIDIOC_DESTROY_SUBDEV_LINKS	_IOW('V', BASE_VIDIOC_PRIVATE + 17, int)
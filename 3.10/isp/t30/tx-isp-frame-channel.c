@@ -23,6 +23,9 @@
 #include <linux/delay.h>
 #include <linux/syscalls.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
 
 #include <tx-isp-list.h>
 #include "tx-isp-frame-channel.h"
@@ -34,24 +37,131 @@
 				 V4L2_BUF_FLAG_PREPARED | \
 				 V4L2_BUF_FLAG_TIMESTAMP_MASK)
 
+/*
+ * The done path runs in irq context for every frame, so buffers are found
+ * by DMA address through chan->addr_map instead of walking queued_list.
+ * The map is only changed under chan->slock.
+ */
+static inline unsigned int addr_map_slot(unsigned int addr)
+{
+	return hash_32(addr, FRAME_CHAN_ADDR_MAP_BITS);
+}
+
+static inline unsigned int addr_map_key(struct fs_vb2_buffer *vb)
+{
+	return vb_to_video_buffer(vb)->buf.addr;
+}
+
+static struct fs_vb2_buffer *addr_map_find(struct tx_isp_frame_channel *chan, unsigned int addr)
+{
+	unsigned int i = addr_map_slot(addr);
+	struct fs_vb2_buffer *vb = NULL;
+
+	while((vb = chan->addr_map[i]) != NULL){
+		if(addr_map_key(vb) == addr)
+			return vb;
+		i = (i + 1) & (FRAME_CHAN_ADDR_MAP_SIZE - 1);
+	}
+	return NULL;
+}
+
+static void addr_map_insert(struct tx_isp_frame_channel *chan, struct fs_vb2_buffer *vb)
+{
+	unsigned int addr = addr_map_key(vb);
+	unsigned int i = addr_map_slot(addr);
+
+	while(chan->addr_map[i] && addr_map_key(chan->addr_map[i]) != addr)
+		i = (i + 1) & (FRAME_CHAN_ADDR_MAP_SIZE - 1);
+	chan->addr_map[i] = vb;
+}
+
+static void addr_map_remove(struct tx_isp_frame_channel *chan, struct fs_vb2_buffer *vb)
+{
+	unsigned int mask = FRAME_CHAN_ADDR_MAP_SIZE - 1;
+	unsigned int i = addr_map_slot(addr_map_key(vb));
+	unsigned int j, k;
+
+	while(chan->addr_map[i] != vb){
+		if(chan->addr_map[i] == NULL)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	/* move later members of the cluster up so lookups never stop early */
+	j = i;
+	for(;;){
+		chan->addr_map[i] = NULL;
+		do {
+			j = (j + 1) & mask;
+			if(chan->addr_map[j] == NULL)
+				return;
+			k = addr_map_slot(addr_map_key(chan->addr_map[j]));
+		} while(i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		chan->addr_map[i] = chan->addr_map[j];
+		i = j;
+	}
+}
+
+static void frame_channel_done_account(struct tx_isp_frame_channel *chan, unsigned long long start)
+{
+	unsigned int ns = (unsigned int)(private_sched_clock() - start);
+	unsigned int us = ns / 1000;
+	int n = us ? fls(us) : 0;
+
+	if(n >= FRAME_CHAN_DONE_HIST_SIZE)
+		n = FRAME_CHAN_DONE_HIST_SIZE - 1;
+	chan->done_hist[n]++;
+	if(ns > chan->done_max_ns)
+		chan->done_max_ns = ns;
+}
+
+/* Hand a finished buffer to the application through the frame ring, irq context */
+static void frame_ring_publish(struct tx_isp_frame_channel *chan, struct fs_vb2_buffer *vb)
+{
+	struct fs_vb2_queue *q = &chan->vbq;
+	struct frame_ring *ring = chan->ring;
+	unsigned int slot = chan->ring_head % FRAME_RING_SIZE;
+	struct frame_ring_desc *desc = &ring->desc[slot];
+	unsigned long flags = 0;
+	int empty = chan->ring_head == ring->tail;
+
+	private_spin_lock_irqsave(&q->done_lock, flags);
+	vb->state = FS_VB2_BUF_STATE_DONE;
+	tx_list_del(&vb->queued_entry);
+	q->queued_count--;
+	private_spin_unlock_irqrestore(&q->done_lock, flags);
+
+	desc->index = vb->v4l2_buf.index;
+	desc->sequence = vb->v4l2_buf.sequence;
+	desc->ts_sec = vb->v4l2_buf.timestamp.tv_sec;
+	desc->ts_usec = vb->v4l2_buf.timestamp.tv_usec;
+	chan->ring_index[slot] = vb->v4l2_buf.index;
+
+	/* the descriptor must be visible before the head that covers it */
+	smp_wmb();
+	ring->head = ++chan->ring_head;
+
+	/* a reader only sleeps when it has seen the ring empty */
+	if(empty)
+		wake_up(&q->done_wq);
+	if(ring->tail != chan->ring_reclaim)
+		schedule_work(&chan->ring_work);
+}
+
 static int frame_channel_buffer_done(struct tx_isp_frame_channel *chan, void *arg)
 {
 	unsigned long flags = 0;
 	struct frame_channel_buffer *buf = arg;
 	struct fs_vb2_queue *q = &chan->vbq;
 	struct fs_vb2_buffer *vb = NULL;
-	struct fs_vb2_buffer *pos = NULL;
+	unsigned long long start = 0;
 
 	if(buf == NULL)
 		return 0;
 
+	start = private_sched_clock();
 	private_spin_lock_irqsave(&chan->slock, flags);
-	tx_list_for_each_entry(pos, &q->queued_list, queued_entry){
-		if(pos->v4l2_buf.m.userptr == buf->addr){
-			vb = pos;
-			break;
-		}
-	}
+	vb = addr_map_find(chan, buf->addr);
 	private_spin_unlock_irqrestore(&chan->slock, flags);
 
 	if(vb && vb->state == FS_VB2_BUF_STATE_ACTIVE){
@@ -62,18 +172,22 @@ static int frame_channel_buffer_done(struct tx_isp_frame_channel *chan, void *ar
 		vb->v4l2_buf.timestamp.tv_usec = ts.tv_nsec / 1000;
 
 		vb->v4l2_buf.sequence = buf->priv;
-		/* Add the buffer to the done buffers list */
-		private_spin_lock_irqsave(&q->done_lock, flags);
-		vb->state = FS_VB2_BUF_STATE_DONE;
-		tx_list_add_tail(&vb->done_entry, &q->done_list);
-		q->done_count++;
-		/* Remove from videobuf queue */
-		tx_list_del(&vb->queued_entry);
-		q->queued_count--;
-		private_spin_unlock_irqrestore(&q->done_lock, flags);
-
-		/* Inform any processes that may be waiting for buffers */
-		wake_up(&q->done_wq);
+		if(chan->ring_enable){
+			frame_ring_publish(chan, vb);
+		}else{
+			/* Add the buffer to the done buffers list */
+			private_spin_lock_irqsave(&q->done_lock, flags);
+			vb->state = FS_VB2_BUF_STATE_DONE;
+			tx_list_add_tail(&vb->done_entry, &q->done_list);
+			q->done_count++;
+			/* Remove from videobuf queue */
+			tx_list_del(&vb->queued_entry);
+			q->queued_count--;
+			private_spin_unlock_irqrestore(&q->done_lock, flags);
+
+			/* Inform any processes that may be waiting for buffers */
+			wake_up(&q->done_wq);
+		}
 		private_complete(&chan->comp);
 		if(chan->out_frames && (chan->out_frames + 1 != buf->priv)){
 			ISP_INFO("chan%d: source frames %d, output frames %d\n", chan->index, buf->priv, chan->out_frames + 1);
@@ -83,6 +197,7 @@ static int frame_channel_buffer_done(struct tx_isp_frame_channel *chan, void *ar
 	}else{
 		chan->losed_frames++;
 	}
+	frame_channel_done_account(chan, start);
 
 	return 0;
 }
@@ -303,11 +418,16 @@ static int __vb2_queue_alloc(struct fs_vb2_queue *q, unsigned int num_buffers)
  */
 static void __vb2_queue_free(struct fs_vb2_queue *q, unsigned int buffers)
 {
+	struct tx_isp_frame_channel *chan = vbq_to_frame_chan(q);
+	unsigned long flags = 0;
 	unsigned int buffer;
 
 	/* Free videobuf buffers */
 	for (buffer = q->num_buffers - buffers; buffer < q->num_buffers;
 	     ++buffer) {
+		private_spin_lock_irqsave(&chan->slock, flags);
+		addr_map_remove(chan, q->bufs[buffer]);
+		private_spin_unlock_irqrestore(&chan->slock, flags);
 		kfree(q->bufs[buffer]);
 		q->bufs[buffer] = NULL;
 	}
@@ -433,7 +553,8 @@ static int frame_channel_reqbufs(struct tx_isp_frame_channel *chan, unsigned lon
 static int __buf_prepare(struct fs_vb2_buffer *vb, const struct v4l2_buffer *b)
 {
 	struct frame_channel_video_buffer *buf = vb_to_video_buffer(vb);
-	/*struct fs_vb2_queue *q = vb->vb2_queue;*/
+	struct tx_isp_frame_channel *chan = vbq_to_frame_chan(vb->vb2_queue);
+	unsigned long flags = 0;
 	dma_addr_t addr = 0;
 
 	__fill_vb2_buffer(vb, b);
@@ -442,7 +563,12 @@ static int __buf_prepare(struct fs_vb2_buffer *vb, const struct v4l2_buffer *b)
 
 	dma_sync_single_for_device(NULL, addr, vb->v4l2_buf.length, DMA_FROM_DEVICE);
 
+	/* userptr may differ from the last time this buffer was queued */
+	private_spin_lock_irqsave(&chan->slock, flags);
+	addr_map_remove(chan, vb);
 	buf->buf.addr = (unsigned int)addr;
+	addr_map_insert(chan, vb);
+	private_spin_unlock_irqrestore(&chan->slock, flags);
 	INIT_LIST_HEAD(&buf->buf.entry);
 
 	vb->state = FS_VB2_BUF_STATE_PREPARED;
@@ -737,6 +863,11 @@ static int frame_channel_vb2_dqbuf(struct tx_isp_frame_channel *chan, unsigned l
 		return -EINVAL;
 	}
 
+	if (chan->ring_enable) {
+		ISP_ERROR("dqbuf: buffers are returned through the frame ring\n");
+		return -EBUSY;
+	}
+
 	ret = __vb2_get_done_vb(q, &vb);
 	if (ret < 0)
 		return ret;
@@ -835,8 +966,21 @@ static void __vb2_queue_cancel(struct fs_vb2_queue *q)
 		tx_isp_send_event_to_remote(chan->pad, TX_ISP_EVENT_FRAME_CHAN_STREAM_OFF, NULL);
 	/*tx_vb2_wait_for_all_buffers(q);*/
 
+	/*
+	 * frame_ring_reclaim() requeues under chan->mlock and gives up once
+	 * streaming is off, so tearing the lists down under it cannot race
+	 * with a reclaim from poll() or ring_work.
+	 */
+	private_mutex_lock(&chan->mlock);
 	q->streaming = 0;
 
+	if (chan->ring) {
+		chan->ring_head = 0;
+		chan->ring_reclaim = 0;
+		chan->ring->head = 0;
+		chan->ring->tail = 0;
+	}
+
 	/*
 	 * Remove all buffers from videobuf's list...
 	 */
@@ -857,6 +1001,11 @@ static void __vb2_queue_cancel(struct fs_vb2_queue *q)
 	 */
 	for (i = 0; i < q->num_buffers; ++i)
 		q->bufs[i]->state = FS_VB2_BUF_STATE_DEQUEUED;
+	private_mutex_unlock(&chan->mlock);
+
+	/* ring_work takes chan->mlock, so it is flushed only once that is dropped */
+	if (chan->ring)
+		cancel_work_sync(&chan->ring_work);
 }
 
 
@@ -1062,6 +1211,93 @@ static int frame_channel_set_channel_banks(struct tx_isp_frame_channel *chan, un
 	return ISP_SUCCESS;
 }
 
+/*
+ * Give the buffers behind the application's tail back to the driver.
+ * Runs from poll() and from ring_work, which the done path schedules when
+ * it sees the tail has moved.
+ */
+static void frame_ring_reclaim(struct tx_isp_frame_channel *chan)
+{
+	struct fs_vb2_queue *q = &chan->vbq;
+	struct fs_vb2_buffer *vb = NULL;
+	struct v4l2_buffer b;
+	unsigned long flags = 0;
+	unsigned int tail = 0;
+
+	private_mutex_lock(&chan->mlock);
+	if(!chan->ring_enable || !q->streaming)
+		goto unlock;
+
+	tail = chan->ring->tail;
+	if(tail - chan->ring_reclaim > chan->ring_head - chan->ring_reclaim){
+		ISP_WRANING("chan%d: frame ring tail %u is outside [%u, %u]\n",
+				chan->index, tail, chan->ring_reclaim, chan->ring_head);
+		goto unlock;
+	}
+
+	while(chan->ring_reclaim != tail){
+		vb = q->bufs[chan->ring_index[chan->ring_reclaim % FRAME_RING_SIZE]];
+		chan->ring_reclaim++;
+		if(vb == NULL || vb->state != FS_VB2_BUF_STATE_DONE)
+			continue;
+
+		b = vb->v4l2_buf;
+		__buf_prepare(vb, &b);
+		private_spin_lock_irqsave(&chan->slock, flags);
+		tx_list_add_tail(&vb->queued_entry, &q->queued_list);
+		vb->state = FS_VB2_BUF_STATE_QUEUED;
+		q->queued_count++;
+		private_spin_unlock_irqrestore(&chan->slock, flags);
+		__enqueue_in_driver(vb);
+	}
+unlock:
+	private_mutex_unlock(&chan->mlock);
+}
+
+static void frame_ring_work(struct work_struct *work)
+{
+	struct tx_isp_frame_channel *chan = container_of(work, struct tx_isp_frame_channel, ring_work);
+
+	frame_ring_reclaim(chan);
+}
+
+static int frame_channel_set_ring(struct tx_isp_frame_channel *chan, unsigned long arg)
+{
+	int enable = 0;
+	int ret = 0;
+
+	if(IS_ERR_OR_NULL(chan)){
+		return -EINVAL;
+	}
+
+	ret = copy_from_user(&enable, (void __user *)arg, sizeof(enable));
+	if(ret){
+		ISP_ERROR("Failed to copy from user\n");
+		return -ENOMEM;
+	}
+
+	if(chan->vbq.streaming){
+		ISP_ERROR("ring: streaming active\n");
+		return -EBUSY;
+	}
+
+	/* kept until the channel is deinited, it may still be mapped */
+	if(enable && !chan->ring){
+		chan->ring = vmalloc_user(PAGE_ALIGN(sizeof(struct frame_ring)));
+		if(!chan->ring)
+			return -ENOMEM;
+	}
+	chan->ring_head = 0;
+	chan->ring_reclaim = 0;
+	if(chan->ring){
+		chan->ring->head = 0;
+		chan->ring->tail = 0;
+	}
+	chan->ring_enable = enable ? 1 : 0;
+
+	return ISP_SUCCESS;
+}
+
 static int frame_channel_listen_buffer(struct tx_isp_frame_channel *chan, unsigned long arg)
 {
 	int ret = ISP_SUCCESS;
@@ -1128,6 +1364,9 @@ static long frame_channel_unlocked_ioctl(struct file *file, unsigned int cmd, un
 		case VIDIOC_DEFAULT_CMD_LISTEN_BUF:
 			ret = frame_channel_listen_buffer(chan, arg);
 			break;
+		case VIDIOC_DEFAULT_CMD_FRAME_RING:
+			ret = frame_channel_set_ring(chan, arg);
+			break;
 		default:
 			ret = -ENOIOCTLCMD;
 			break;
@@ -1156,6 +1395,8 @@ static int frame_channel_open(struct inode *inode, struct file *file)
 	memset(&chan->fmt, 0, sizeof(chan->fmt));
 	chan->out_frames = 0;
 	chan->losed_frames = 0;
+	memset(chan->done_hist, 0, sizeof(chan->done_hist));
+	chan->done_max_ns = 0;
 	private_init_completion(&chan->comp);
 	__vb2_queue_free(&chan->vbq, chan->vbq.num_buffers);
 	chan->state = TX_ISP_MODULE_INIT;
@@ -1177,14 +1418,55 @@ static int frame_channel_release(struct inode *inode, struct file *file)
 		__vb2_queue_free(&chan->vbq, chan->vbq.num_buffers);
 		chan->state = TX_ISP_MODULE_ACTIVATE;
 	}
+	chan->ring_enable = 0;
 
 	return ISP_SUCCESS;
 }
 
+static unsigned int frame_channel_poll(struct file *file, poll_table *wait)
+{
+	struct miscdevice *mdev = file->private_data;
+	struct tx_isp_frame_channel *chan = IS_ERR_OR_NULL(mdev) ? NULL : miscdev_to_frame_chan(mdev);
+	struct fs_vb2_queue *q = NULL;
+	unsigned int mask = 0;
+
+	if(IS_ERR_OR_NULL(chan)){
+		return POLLERR;
+	}
+
+	q = &chan->vbq;
+	poll_wait(file, &q->done_wq, wait);
+	if(!q->streaming)
+		return POLLERR;
+
+	if(chan->ring_enable){
+		frame_ring_reclaim(chan);
+		if(chan->ring->head != chan->ring->tail)
+			mask |= POLLIN | POLLRDNORM;
+	}else if(!tx_list_empty(&q->done_list)){
+		mask |= POLLIN | POLLRDNORM;
+	}
+	return mask;
+}
+
+static int frame_channel_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct miscdevice *mdev = file->private_data;
+	struct tx_isp_frame_channel *chan = IS_ERR_OR_NULL(mdev) ? NULL : miscdev_to_frame_chan(mdev);
+
+	if(IS_ERR_OR_NULL(chan) || chan->ring == NULL){
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, chan->ring, vma->vm_pgoff);
+}
+
 static struct file_operations fs_channel_ops ={
 	.open 		= frame_channel_open,
 	.release 	= frame_channel_release,
 	.unlocked_ioctl	= frame_channel_unlocked_ioctl,
+	.poll		= frame_channel_poll,
+	.mmap		= frame_channel_mmap,
 };
 
 static int fs_activate_module(struct tx_isp_subdev *sd)
@@ -1275,6 +1557,7 @@ static int tx_isp_frame_chan_init(struct tx_isp_frame_channel *chan, struct tx_i
 	private_spin_lock_init(&chan->slock);
 	private_mutex_init(&chan->mlock);
 	private_init_completion(&chan->comp);
+	INIT_WORK(&chan->ring_work, frame_ring_work);
 	pad->event = frame_chan_event;
 	chan->state = TX_ISP_MODULE_SLAKE;
 
@@ -1293,6 +1576,10 @@ static void tx_isp_frame_chan_deinit(struct tx_isp_frame_channel *chan)
 
 	private_misc_deregister(&chan->misc);
 	tx_vb2_queue_release(&chan->vbq);
+	if(chan->ring){
+		vfree(chan->ring);
+		chan->ring = NULL;
+	}
 	chan->state = TX_ISP_MODULE_SLAKE;
 }
 
@@ -1309,6 +1596,7 @@ static int isp_framesource_show(struct seq_file *m, void *v)
 	unsigned long flags = 0;
 	char *fmt = NULL;
 	int index = 0;
+	int i = 0;
 
 	if(IS_ERR_OR_NULL(fs)){
 		ISP_ERROR("The parameter is invalid!\n");
@@ -1350,6 +1638,11 @@ static int isp_framesource_show(struct seq_file *m, void *v)
 		private_spin_unlock_irqrestore(&chan->slock, flags);
 		len += seq_printf(m ,"the output buffers is: %d\n", chan->out_frames);
 		len += seq_printf(m ,"the losted buffers is: %d\n", chan->losed_frames);
+		len += seq_printf(m ,"buffer done time(us):");
+		for(i = 0; i < FRAME_CHAN_DONE_HIST_SIZE - 1; i++)
+			len += seq_printf(m ," <%d: %u", 1 << i, chan->done_hist[i]);
+		len += seq_printf(m ," >=%d: %u\n", 1 << (i - 1), chan->done_hist[i]);
+		len += seq_printf(m ,"buffer done max: %u ns\n", chan->done_max_ns);
 	}
 	return len;
 }
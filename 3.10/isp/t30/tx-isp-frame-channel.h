@@ -6,6 +6,7 @@
 #include <media/v4l2-ioctl.h>
 #include <media/videobuf2-core.h>
 #include <linux/proc_fs.h>
+#include <linux/workqueue.h>
 
 #include <tx-isp-common.h>
 
@@ -132,6 +133,13 @@ struct frame_channel_video_buffer{
 	struct frame_channel_buffer buf;
 };
 
+/* DMA address to buffer map of a frame channel, at most half full */
+#define FRAME_CHAN_ADDR_MAP_BITS	7
+#define FRAME_CHAN_ADDR_MAP_SIZE	(1 << FRAME_CHAN_ADDR_MAP_BITS)
+
+/* Time spent in the buffer done path, bucket n counts < 2^n us */
+#define FRAME_CHAN_DONE_HIST_SIZE	8
+
 struct tx_isp_frame_channel {
 	struct miscdevice	misc;
 	struct fs_vb2_queue vbq;
@@ -148,6 +156,19 @@ struct tx_isp_frame_channel {
 	unsigned int out_frames;
 	unsigned int losed_frames;
 	void *priv;
+
+	/* open addressed, linear probing; protected by slock */
+	struct fs_vb2_buffer *addr_map[FRAME_CHAN_ADDR_MAP_SIZE];
+	unsigned int done_hist[FRAME_CHAN_DONE_HIST_SIZE];
+	unsigned int done_max_ns;
+
+	/* mmap'd frame ring, replaces done_list when ring_enable is set */
+	struct frame_ring *ring;
+	int ring_enable;
+	unsigned int ring_head;		/* driver copy, the mapped one is not trusted */
+	unsigned int ring_reclaim;	/* descriptors given back to the driver */
+	unsigned char ring_index[FRAME_RING_SIZE];
+	struct work_struct ring_work;
 };
 
 struct tx_isp_frame_sources {
@@ -19,6 +19,12 @@
 #define IOCTL_SOC_NNA_RDCH_START    _IOWR(SOC_NNA_MAGIC, 4, int)
 #define IOCTL_SOC_NNA_WRCH_START    _IOWR(SOC_NNA_MAGIC, 5, int)
 #define IOCTL_SOC_NNA_VERSION    	_IOWR(SOC_NNA_MAGIC, 6, int)
+#define IOCTL_SOC_NNA_FLUSHCACHE_BATCH _IOWR(SOC_NNA_MAGIC, 7, int)
+#define IOCTL_SOC_NNA_DES_CACHE_FLUSH  _IOWR(SOC_NNA_MAGIC, 8, int)
+#define IOCTL_SOC_NNA_JOB_SUBMIT       _IOWR(SOC_NNA_MAGIC, 9, int)
+#define IOCTL_SOC_NNA_ORAM_ALLOC       _IOWR(SOC_NNA_MAGIC, 10, int)
+#define IOCTL_SOC_NNA_ORAM_FREE        _IOWR(SOC_NNA_MAGIC, 11, int)
+#define IOCTL_SOC_NNA_MALLOC_BATCH     _IOWR(SOC_NNA_MAGIC, 12, int)
 
 /*
  * dir value defined in  enum dma_data_direction in linux/dma-direction.h
@@ -30,12 +36,45 @@ struct flush_cache_info {
 	unsigned int	dir;
 };
 
+/*
+ * Several flush_cache_info ranges in one call. Ranges inside uncached
+ * mappings (ORAM, descriptor RAM) need no maintenance and are skipped;
+ * flushed and skipped return the bytes in each group. A range outside any
+ * single mapping of the caller fails the call with -EFAULT. Buffers from
+ * IOCTL_SOC_NNA_MALLOC are coherent and never need an entry here.
+ */
+#define SOC_NNA_CACHE_BATCH_MAX     16
+
+struct soc_nna_cache_batch {
+	unsigned int            count;
+	unsigned int            flushed;
+	unsigned int            skipped;
+	struct flush_cache_info info[SOC_NNA_CACHE_BATCH_MAX];
+};
+
 struct soc_nna_buf {
     void        *vaddr;
     void        *paddr;
     int         size;
 };
 
+/*
+ * MALLOC_BATCH reserves count tensors in one contiguous region. sizes and
+ * offsets point to count entries each; every tensor starts at its offset
+ * into buf, aligned to align (never less than 64 bytes). Free the region
+ * with IOCTL_SOC_NNA_FREE on buf. Buffers from MALLOC and MALLOC_BATCH are
+ * freed when the fd that allocated them is closed.
+ */
+#define SOC_NNA_MALLOC_BATCH_MAX    1024
+
+struct soc_nna_malloc_batch {
+    unsigned int        count;
+    unsigned int        align;
+    unsigned int        *sizes;
+    unsigned int        *offsets;       /* out */
+    struct soc_nna_buf  buf;            /* out */
+};
+
 typedef struct nna_dma_cmd {
     unsigned int    d_va_st_addr;
     unsigned int    o_va_st_addr;
@@ -52,6 +91,14 @@ typedef struct des_gen_result {
     unsigned int    finish;
 } des_gen_result_t;
 
+/*
+ * SETUP_DES remembers the programs it builds, keyed by the command array,
+ * and replays one without rebuilding when the same commands come back
+ * through the same open from the same process. Before a replay the
+ * addresses every command points at are translated again, and the program
+ * is rebuilt if any of them now maps elsewhere. DES_CACHE_FLUSH only frees
+ * the caller's programs.
+ */
 typedef struct nna_dma_cmd_set {
     unsigned int        rd_cmd_cnt;
     unsigned int        rd_cmd_st_idx;
@@ -62,4 +109,48 @@ typedef struct nna_dma_cmd_set {
     des_gen_result_t    des_rslt;
 } nna_dma_cmd_set_t;
 
+/*
+ * JOB_SUBMIT queues the read and/or write chain starting at the given
+ * descriptor indices (as passed to RDCH_START/WRCH_START) and returns its
+ * seq. Jobs run one after another in submission order. With nothing
+ * queued, it fails with -EBUSY while a chain started through
+ * RDCH_START/WRCH_START still runs on a channel the job needs, and those
+ * two fail with -EBUSY while a job is queued. Each finished job
+ * is reported once through read() as a soc_nna_job_done; poll() signals
+ * POLLIN when one is ready and POLLOUT while the queue has room. A job
+ * still running after job_timeout_ms is stopped and reports -ETIMEDOUT;
+ * if its channels do not stop, the jobs queued behind it report -EIO.
+ * Jobs stopped because the device is closed report -ECANCELED.
+ */
+#define SOC_NNA_JOB_RD              (1 << 0)
+#define SOC_NNA_JOB_WR              (1 << 1)
+
+struct soc_nna_job {
+    unsigned int    rd_des_addr;
+    unsigned int    wr_des_addr;
+    unsigned int    flags;
+    unsigned int    seq;            /* out */
+};
+
+struct soc_nna_job_done {
+    unsigned int    seq;
+    int             status;         /* 0, -ETIMEDOUT, -EIO or -ECANCELED */
+    unsigned int    queue_us;       /* submitted to started */
+    unsigned int    run_us;         /* started to finished */
+};
+
+/*
+ * ORAM_ALLOC reserves size bytes of the NNA on-chip RAM, aligned to align
+ * (never less than 64 bytes), and returns the rounded size, the offset
+ * into the ORAM and its physical address. ORAM_FREE takes the offset.
+ * Blocks belong to the fd that allocated them and go away when it closes;
+ * /proc/soc-nna/oram shows free space and usage per process.
+ */
+struct soc_nna_oram_buf {
+    unsigned int    size;
+    unsigned int    align;
+    unsigned int    offset;         /* out */
+    unsigned int    paddr;          /* out */
+};
+
 #endif
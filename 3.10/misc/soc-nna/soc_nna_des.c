@@ -0,0 +1,122 @@
+#include <linux/string.h>
+
+#include "soc_nna_des.h"
+
+void soc_nna_analysis_des(unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info)
+{
+    int i = 0, j = 0;
+    int c64kcnt = 0;
+    unsigned int remain_bytes = 0, trans_bytes = 0, last_des = 0, cur_trans_bytes = 0, total_bytes = 0;
+    unsigned int d_pa_st_addr = 0, o_pa_st_addr = 0, o_pa_mlc_addr = 0, o_pa_mlc_end_addr = 0;
+    nna_dma_cmd_t *pcmd = NULL;
+    unsigned int widx = 0, des_num = 0, chain_st_idx = st_idx;
+
+    memset(des_info, 0, sizeof(nna_dma_des_info_t));
+
+    for (i = st_idx; i < cmd_cnt; i++) {
+        pcmd = d_va_cmd + i;
+        c64kcnt = ((pcmd->data_bytes - 1) >> 16) + 1;
+        remain_bytes = pcmd->data_bytes;
+        NNADMA_VA_2_PA(pcmd->d_va_st_addr, d_pa_st_addr);
+        NNADMA_VA_2_PA(pcmd->o_va_st_addr, o_pa_st_addr);
+        NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, o_pa_mlc_addr);
+        o_pa_mlc_end_addr = o_pa_mlc_addr + pcmd->o_mlc_bytes;
+
+        for (j = 0; j < c64kcnt; j++) {
+            last_des = (j == (c64kcnt - 1)) ? 1 : 0;
+            trans_bytes = last_des ? remain_bytes : 65536;
+
+            if ((o_pa_st_addr + trans_bytes) <= o_pa_mlc_end_addr) {
+                des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+                    | (((((unsigned long long int)trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+                    | ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+                    | ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+                d_pa_st_addr += trans_bytes;
+                o_pa_st_addr += trans_bytes;
+                des_num++;
+            } else {
+                cur_trans_bytes = o_pa_mlc_end_addr - o_pa_st_addr;
+                des_info->des_data[widx++] = ((DES_CFG_LINK << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+                    | (((((unsigned long long int)cur_trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+                    | ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+                    | ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+
+                des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+                    | (((((unsigned long long int)(trans_bytes - cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+                    | ((((unsigned long long int)o_pa_mlc_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+                    | ((((unsigned long long int)(d_pa_st_addr + cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+                d_pa_st_addr += trans_bytes;
+                o_pa_st_addr = o_pa_mlc_addr + (trans_bytes - cur_trans_bytes);
+                des_num += 2;
+            }
+            remain_bytes -= trans_bytes;
+        }
+
+        total_bytes += pcmd->data_bytes;
+        if (!pcmd->des_link) {
+            des_info->des_num[des_info->chain_num] = des_num;
+            des_info->total_bytes[des_info->chain_num] = total_bytes;
+            des_info->chain_st_idx[des_info->chain_num] = chain_st_idx;
+            des_info->chain_num++;
+            des_num = 0;
+            total_bytes = 0;
+            chain_st_idx = i + 1;
+        }
+    }
+}
+
+int soc_nna_update_des(nna_dma_des_info_t *des_info, unsigned long long int *vdma, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
+{
+    int des_remain = 2048; //(16 * 1024) / sizeof(unsigned long long int);
+    int chnidx = 0, desidx = 0, destotal_chain = 0, rdidx = 0, wridx = 0;
+    int maxchnnum = des_info[0].chain_num > des_info[1].chain_num ? des_info[0].chain_num : des_info[1].chain_num;
+    memset(des_rslt, 0, sizeof(des_gen_result_t));
+
+    for (chnidx = 0; chnidx < maxchnnum; chnidx++) {
+        destotal_chain = des_info[0].des_num[chnidx] + des_info[1].des_num[chnidx] + 2;
+        if (destotal_chain > des_remain) {
+            des_rslt->rcmd_st_idx = des_info[0].chain_st_idx[chnidx];
+            des_rslt->wcmd_st_idx = des_info[1].chain_st_idx[chnidx];
+            des_rslt->dma_chn_num = chnidx;
+            des_rslt->finish = 0;
+            return desidx;
+        }
+
+        /* rd chain */
+        *d_va_chn++ = desidx;
+        *(vdma + desidx++) = ((DES_CFG_CNT << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+            | ((des_info[0].total_bytes[chnidx] << DES_TOTAL_BYTES) & DES_TOTAL_BYTES_MASK);
+        memcpy(vdma + desidx, &(des_info[0].des_data[rdidx]), 8 * des_info[0].des_num[chnidx]);
+        desidx += des_info[0].des_num[chnidx];
+        rdidx += des_info[0].des_num[chnidx];
+
+        /* wr chain */
+        *d_va_chn++ = desidx;
+        *(vdma + desidx++) = ((DES_CFG_CNT << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+            | ((des_info[1].total_bytes[chnidx] << DES_TOTAL_BYTES) & DES_TOTAL_BYTES_MASK);
+        memcpy(vdma + desidx, &(des_info[1].des_data[wridx]), 8 * des_info[1].des_num[chnidx]);
+        desidx += des_info[1].des_num[chnidx];
+        wridx += des_info[1].des_num[chnidx];
+
+        des_remain -= destotal_chain;
+    }
+
+    des_rslt->dma_chn_num = maxchnnum;
+    des_rslt->finish = 1;
+
+    return desidx;
+}
+
+/* The addresses soc_nna_analysis_des() translates, SOC_NNA_DES_CMD_PAS per command */
+void soc_nna_translate_des(unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, unsigned int *pa)
+{
+    nna_dma_cmd_t *pcmd = NULL;
+    unsigned int i = 0;
+
+    for (i = st_idx; i < cmd_cnt; i++) {
+        pcmd = d_va_cmd + i;
+        NNADMA_VA_2_PA(pcmd->d_va_st_addr, pa[i * SOC_NNA_DES_CMD_PAS]);
+        NNADMA_VA_2_PA(pcmd->o_va_st_addr, pa[i * SOC_NNA_DES_CMD_PAS + 1]);
+        NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, pa[i * SOC_NNA_DES_CMD_PAS + 2]);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __SOC_NNA_DES_H__
+#define __SOC_NNA_DES_H__
+
+/*
+ * Descriptor program builder. It only needs the command array and the
+ * address translation, so it builds on the host too: define
+ * NNADMA_VA_2_PA() before including this header to supply one.
+ */
+
+#include "soc_nna.h"
+#include "soc_nna_hw.h"
+
+#define SOC_NNA_MAX_DES_CHN_CNT     2048        //16384 / 8 = 2048
+#define SOC_NNA_ADDR_ALIGN_BIT      6LL
+
+typedef struct nna_dma_des_info {
+    unsigned long long int      des_data[SOC_NNA_MAX_DES_CHN_CNT];
+    unsigned int                des_num[SOC_NNA_MAX_DES_CHN_CNT];
+    unsigned int                total_bytes[SOC_NNA_MAX_DES_CHN_CNT];
+    unsigned int                chain_st_idx[SOC_NNA_MAX_DES_CHN_CNT];
+    unsigned int                chain_num;
+} nna_dma_des_info_t;
+
+#ifndef NNADMA_VA_2_PA
+#define NNADMA_VA_2_PA(vaddr, paddr) \
+do {                                \
+    __asm__ __volatile__ (          \
+        ".set push\n"               \
+        ".set noreorder\n"          \
+        ".set mips32r2\n"           \
+        " ll %0, 0(%1)\n"           \
+        " rdhwr %0,$4\n"            \
+        ".set reorder\n"            \
+        ".set pop\n"                \
+        :"=r"(paddr)                \
+        :"r"(vaddr)                 \
+        :                           \
+    );                              \
+} while(0)
+#endif
+
+/* d_va_st_addr, o_va_st_addr and o_va_mlc_addr */
+#define SOC_NNA_DES_CMD_PAS         3
+
+void soc_nna_analysis_des(unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info);
+int soc_nna_update_des(nna_dma_des_info_t *des_info, unsigned long long int *vdma, unsigned int *d_va_chn, des_gen_result_t *des_rslt);
+void soc_nna_translate_des(unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, unsigned int *pa);
+
+#endif //__SOC_NNA_DES_H__
@@ -1,5 +1,7 @@
 #include <linux/proc_fs.h>
+#include <linux/math64.h>
 #include <sensor-info.h>
+#include <sensor-regs.h>
 
 static struct sensor_info *sensor_info_ptr;
 
@@ -12,6 +14,7 @@ static ssize_t sensor_fps_max_read(struct file *file, char __user *buf, size_t c
 static ssize_t sensor_i2c_addr_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
 static ssize_t sensor_width_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
 static ssize_t sensor_height_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
+static ssize_t sensor_ae_i2c_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
 
 // File operations for the proc entries
 static const struct file_operations name_fops = {
@@ -54,6 +57,11 @@ static const struct file_operations height_fops = {
 	.owner = THIS_MODULE,
 };
 
+static const struct file_operations ae_i2c_fops = {
+	.read = sensor_ae_i2c_read,
+	.owner = THIS_MODULE,
+};
+
 void sensor_common_init(struct sensor_info *info) {
 	sensor_info_ptr = info;
 
@@ -69,6 +77,8 @@ void sensor_common_init(struct sensor_info *info) {
 	proc_create("jz/sensor/i2c_addr", 0444, NULL, &i2c_addr_fops);
 	proc_create("jz/sensor/height", 0444, NULL, &height_fops);
 	proc_create("jz/sensor/width", 0444, NULL, &width_fops);
+	if (info->expo)
+		proc_create("jz/sensor/ae_i2c", 0444, NULL, &ae_i2c_fops);
 }
 
 void sensor_common_exit(void) {
@@ -81,6 +91,8 @@ void sensor_common_exit(void) {
 	remove_proc_entry("jz/sensor/i2c_addr", NULL);
 	remove_proc_entry("jz/sensor/height", NULL);
 	remove_proc_entry("jz/sensor/width", NULL);
+	if (sensor_info_ptr->expo)
+		remove_proc_entry("jz/sensor/ae_i2c", NULL);
 	remove_proc_entry("jz/sensor", NULL);
 }
 
@@ -131,3 +143,13 @@ static ssize_t sensor_height_read(struct file *file, char __user *buf, size_t co
 	int len = snprintf(buffer, sizeof(buffer), "%d\n", sensor_info_ptr->height);
 	return simple_read_from_buffer(buf, count, ppos, buffer, len);
 }
+
+static ssize_t sensor_ae_i2c_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
+	struct sensor_expo_stats *stats = &sensor_info_ptr->expo->stats;
+	unsigned int avg = stats->commits ? (unsigned int) div_u64(stats->total_us, stats->commits) : 0;
+	char buffer[160];
+	int len = snprintf(buffer, sizeof(buffer),
+			   "commits: %u\nskipped: %u\nmsgs: %u\nlast_us: %u\navg_us: %u\nmax_us: %u\n",
+			   stats->commits, stats->skipped, stats->msgs, stats->last_us, avg, stats->max_us);
+	return simple_read_from_buffer(buf, count, ppos, buffer, len);
+}
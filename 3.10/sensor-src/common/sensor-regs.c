@@ -0,0 +1,354 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <sensor-regs.h>
+
+#if defined(CONFIG_SOC_T10) || defined(CONFIG_SOC_T20)
+#define private_i2c_transfer i2c_transfer
+#define private_msleep msleep
+#else
+#include <txx-funcs.h>
+#endif
+
+struct regs_batch {
+	struct i2c_msg msgs[SENSOR_REGS_BATCH_MSGS];
+	unsigned char buf[SENSOR_REGS_BATCH_MSGS][2 + SENSOR_REGS_BURST_MAX];
+	int nmsgs;
+};
+
+static unsigned int table_field(const unsigned char *p, unsigned char size) {
+	switch (size) {
+		case 1:
+			return *p;
+		case 2:
+			return *(const uint16_t *) p;
+		default:
+			return *(const uint32_t *) p;
+	}
+}
+
+static int cache_volatile(const struct sensor_regs_cache *cache, unsigned int reg) {
+	int i;
+
+	for (i = 0; i < cache->n_volatile; i++)
+		if (reg >= cache->volatile_ranges[i].first && reg <= cache->volatile_ranges[i].last)
+			return 1;
+
+	return 0;
+}
+
+static unsigned int cache_key(const struct sensor_regs_config *cfg, unsigned int reg) {
+	if (cfg->page_reg == SENSOR_REGS_NO_PAGE || cfg->addr_bytes != 1 || reg == (unsigned int) cfg->page_reg)
+		return reg;
+
+	return (cfg->cache->page << 8) | reg;
+}
+
+/* Index of key, or of the slot it would be inserted at */
+static int cache_find(const struct sensor_regs_cache *cache, unsigned int key, int *found) {
+	int lo = 0;
+	int hi = cache->count;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cache->keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*found = lo < cache->count && cache->keys[lo] == key;
+
+	return lo;
+}
+
+int sensor_regs_cache_read(const struct sensor_regs_config *cfg, unsigned int reg, unsigned char *val) {
+	struct sensor_regs_cache *cache = cfg->cache;
+	int found;
+	int i;
+
+	if (!cache)
+		return -ENOENT;
+
+	if (!cache_volatile(cache, reg)) {
+		i = cache_find(cache, cache_key(cfg, reg), &found);
+		if (found) {
+			*val = cache->vals[i];
+			cache->hits++;
+			return 0;
+		}
+	}
+	cache->misses++;
+
+	return -ENOENT;
+}
+
+void sensor_regs_cache_write(const struct sensor_regs_config *cfg, unsigned int reg, unsigned char val) {
+	struct sensor_regs_cache *cache = cfg->cache;
+	unsigned int key;
+	int found;
+	int i;
+
+	if (!cache)
+		return;
+
+	key = cache_key(cfg, reg);
+	if (cfg->page_reg != SENSOR_REGS_NO_PAGE && reg == (unsigned int) cfg->page_reg)
+		cache->page = val;
+
+	if (cache_volatile(cache, reg))
+		return;
+
+	i = cache_find(cache, key, &found);
+	if (!found) {
+		if (cache->count == SENSOR_REGS_CACHE_SIZE) {
+			cache->overflows++;
+			return;
+		}
+		memmove(&cache->keys[i + 1], &cache->keys[i], (cache->count - i) * sizeof(cache->keys[0]));
+		memmove(&cache->vals[i + 1], &cache->vals[i], (cache->count - i) * sizeof(cache->vals[0]));
+		cache->keys[i] = key;
+		cache->count++;
+	}
+	cache->vals[i] = val;
+}
+
+void sensor_regs_cache_drop(const struct sensor_regs_config *cfg, unsigned int reg) {
+	struct sensor_regs_cache *cache = cfg->cache;
+	int found;
+	int i;
+
+	if (!cache)
+		return;
+
+	i = cache_find(cache, cache_key(cfg, reg), &found);
+	if (!found)
+		return;
+
+	cache->count--;
+	memmove(&cache->keys[i], &cache->keys[i + 1], (cache->count - i) * sizeof(cache->keys[0]));
+	memmove(&cache->vals[i], &cache->vals[i + 1], (cache->count - i) * sizeof(cache->vals[0]));
+}
+
+/* The sensor was reset or powered down, nothing in the cache holds */
+void sensor_regs_cache_reset(const struct sensor_regs_config *cfg) {
+	if (!cfg->cache)
+		return;
+
+	cfg->cache->count = 0;
+	cfg->cache->page = 0;
+}
+
+int sensor_regs_cache_dump(const struct sensor_regs_config *cfg) {
+	struct sensor_regs_cache *cache = cfg->cache;
+	int i;
+
+	if (!cache)
+		return 0;
+
+	pr_info("sensor regs cache: %d entries, %u hits, %u misses, %u overflows\n",
+		cache->count, cache->hits, cache->misses, cache->overflows);
+	for (i = 0; i < cache->count; i++)
+		pr_info("  0x%04x = 0x%02x\n", cache->keys[i], cache->vals[i]);
+
+	return cache->count;
+}
+
+static void msg_start(struct i2c_msg *msg, unsigned char *buf, struct i2c_client *client,
+		      const struct sensor_regs_config *cfg, unsigned int reg, unsigned char val) {
+	msg->addr = client->addr;
+	msg->flags = 0;
+	msg->buf = buf;
+	msg->len = 0;
+	if (cfg->addr_bytes == 2)
+		buf[msg->len++] = (reg >> 8) & 0xff;
+	buf[msg->len++] = reg & 0xff;
+	buf[msg->len++] = val;
+}
+
+static int batch_flush(struct i2c_client *client, struct regs_batch *batch, struct sensor_regs_stats *stats) {
+	int num = batch->nmsgs;
+	int ret;
+
+	if (!num)
+		return 0;
+
+	batch->nmsgs = 0;
+	stats->xfers++;
+	ret = private_i2c_transfer(client->adapter, batch->msgs, num);
+	if (ret < 0)
+		return ret;
+
+	return ret == num ? 0 : -EIO;
+}
+
+/*
+ * Write a SENSOR_REG_END terminated register table. Runs of consecutive
+ * register addresses are sent as one auto-increment write and up to
+ * SENSOR_REGS_BATCH_MSGS writes go out per i2c_transfer(). A
+ * SENSOR_REG_DELAY entry flushes everything queued before sleeping, so
+ * table timing is the same as writing one register at a time.
+ */
+int sensor_write_table(struct i2c_client *client, const struct sensor_regs_config *cfg,
+		       const void *vals, struct sensor_regs_stats *stats) {
+	const struct sensor_regs_layout *layout = &cfg->layout;
+	const unsigned char *p = vals;
+	struct sensor_regs_stats local = {0};
+	struct regs_batch batch;
+	struct i2c_msg *msg = NULL;
+	unsigned int burst = cfg->burst_max;
+	unsigned int next = 0;
+	unsigned int reg;
+	int is_page;
+	int ret = 0;
+
+	if (layout->val_size != 1 || (cfg->addr_bytes != 1 && cfg->addr_bytes != 2))
+		return -EINVAL;
+
+	if (!burst || burst > SENSOR_REGS_BURST_MAX)
+		burst = SENSOR_REGS_BURST_MAX;
+
+	batch.nmsgs = 0;
+	for (; (reg = table_field(p, layout->reg_size)) != cfg->reg_end; p += layout->stride) {
+		if (reg == cfg->reg_delay) {
+			msg = NULL;
+			ret = batch_flush(client, &batch, &local);
+			if (ret < 0)
+				goto out;
+			private_msleep(p[layout->val_offset]);
+			continue;
+		}
+
+		local.regs++;
+		is_page = cfg->page_reg != SENSOR_REGS_NO_PAGE && reg == (unsigned int) cfg->page_reg;
+		sensor_regs_cache_write(cfg, reg, p[layout->val_offset]);
+		if (msg && !is_page && reg == next && msg->len < cfg->addr_bytes + burst) {
+			msg->buf[msg->len++] = p[layout->val_offset];
+			next++;
+			continue;
+		}
+
+		if (batch.nmsgs == SENSOR_REGS_BATCH_MSGS) {
+			ret = batch_flush(client, &batch, &local);
+			if (ret < 0)
+				goto out;
+		}
+
+		msg = &batch.msgs[batch.nmsgs];
+		msg_start(msg, batch.buf[batch.nmsgs], client, cfg, reg, p[layout->val_offset]);
+		batch.nmsgs++;
+		local.msgs++;
+		next = reg + 1;
+
+		/* a page switch changes what the following addresses mean */
+		if (is_page)
+			msg = NULL;
+	}
+
+	ret = batch_flush(client, &batch, &local);
+
+out:
+	if (ret < 0)
+		sensor_regs_cache_reset(cfg);
+	pr_debug("%s: %u regs in %u msgs, %u transfers\n", __func__, local.regs, local.msgs, local.xfers);
+	if (stats) {
+		stats->regs += local.regs;
+		stats->msgs += local.msgs;
+		stats->xfers += local.xfers;
+	}
+
+	return ret;
+}
+
+int sensor_expo_commit(struct i2c_client *client, struct sensor_expo_packet *pkt) {
+	const struct sensor_regs_config *cfg = pkt->cfg;
+	struct sensor_expo_stats *stats = &pkt->stats;
+	struct i2c_msg *msg = NULL;
+	unsigned int dirty = 0;
+	unsigned int next = 0;
+	unsigned int reg;
+	unsigned int us;
+	ktime_t start;
+	int nmsgs = 0;
+	int ret;
+	int i;
+
+	if (pkt->nregs > SENSOR_EXPO_MAX_REGS || pkt->n_hold_on > SENSOR_EXPO_MAX_HOLD ||
+	    pkt->n_hold_off > SENSOR_EXPO_MAX_HOLD)
+		return -EINVAL;
+
+	for (i = 0; i < pkt->nregs; i++) {
+		if (!(pkt->pending & (1U << i)))
+			continue;
+		if ((pkt->valid & (1U << i)) && pkt->shadow[i] == pkt->vals[i])
+			continue;
+		dirty |= 1U << i;
+	}
+	pkt->pending = 0;
+
+	if (!dirty) {
+		stats->skipped++;
+		return 0;
+	}
+
+	for (i = 0; i < pkt->n_hold_on; i++, nmsgs++)
+		msg_start(&pkt->msgs[nmsgs], pkt->buf[nmsgs], client, cfg,
+			  pkt->hold_on[i].reg, pkt->hold_on[i].val);
+
+	for (i = 0; i < pkt->nregs; i++) {
+		if (!(dirty & (1U << i)))
+			continue;
+
+		reg = pkt->regs[i];
+		if (msg && reg == next) {
+			msg->buf[msg->len++] = pkt->vals[i];
+			next++;
+			continue;
+		}
+
+		msg = &pkt->msgs[nmsgs];
+		msg_start(msg, pkt->buf[nmsgs], client, cfg, reg, pkt->vals[i]);
+		nmsgs++;
+		next = reg + 1;
+	}
+
+	for (i = 0; i < pkt->n_hold_off; i++, nmsgs++)
+		msg_start(&pkt->msgs[nmsgs], pkt->buf[nmsgs], client, cfg,
+			  pkt->hold_off[i].reg, pkt->hold_off[i].val);
+
+	start = ktime_get();
+	ret = private_i2c_transfer(client->adapter, pkt->msgs, nmsgs);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	stats->commits++;
+	stats->msgs = nmsgs;
+	stats->last_us = us;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+
+	if (ret != nmsgs) {
+		/* the sensor may hold any mix of old and new values now */
+		pkt->valid &= ~dirty;
+		for (i = 0; i < pkt->nregs; i++)
+			if (dirty & (1U << i))
+				sensor_regs_cache_drop(cfg, pkt->regs[i]);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	for (i = 0; i < pkt->n_hold_on; i++)
+		sensor_regs_cache_write(cfg, pkt->hold_on[i].reg, pkt->hold_on[i].val);
+	for (i = 0; i < pkt->nregs; i++) {
+		if (!(dirty & (1U << i)))
+			continue;
+		pkt->shadow[i] = pkt->vals[i];
+		sensor_regs_cache_write(cfg, pkt->regs[i], pkt->vals[i]);
+	}
+	for (i = 0; i < pkt->n_hold_off; i++)
+		sensor_regs_cache_write(cfg, pkt->hold_off[i].reg, pkt->hold_off[i].val);
+	pkt->valid |= dirty;
+
+	return 0;
+}
@@ -0,0 +1 @@
+/* Host build: sensor-regs.c sleeps through private_msleep() */
@@ -0,0 +1,16 @@
+/* Host build: struct i2c_msg from uapi, plus the client the writers take */
+#ifndef TEST_LINUX_I2C_H
+#define TEST_LINUX_I2C_H
+
+#include_next <linux/i2c.h>
+
+struct i2c_adapter {
+	int nr;
+};
+
+struct i2c_client {
+	unsigned short addr;
+	struct i2c_adapter *adapter;
+};
+
+#endif
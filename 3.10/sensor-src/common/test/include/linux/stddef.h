@@ -0,0 +1,3 @@
+/* Host build: the uapi header plus offsetof() */
+#include_next <linux/stddef.h>
+#include <stddef.h>
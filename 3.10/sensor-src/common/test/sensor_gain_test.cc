@@ -0,0 +1,131 @@
+/*
+ * Host test for the binary search analog gain allocator.
+ *
+ * sensor_gain_alloc() replaced the linear again_lut scan in the drivers
+ * that use it, gc2053 (t31) and sc2336 (t41). This runs that scan and the
+ * helper over every isp_gain up to twice the driver's max_again and
+ * checks that both pick the same row, then times one against the other.
+ * The tables are extracted from the driver sources by the Makefile.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <sensor-gain.h>
+}
+
+#include "gc2053_lut.h"
+#include "sc2336_lut.h"
+
+/*
+ * The sensor_alloc_again() body the drivers had before, with the row
+ * index bounds checked: the tables here must never make it step outside.
+ */
+template <typename Lut, typename Value>
+static unsigned int linear_alloc(const Lut *table, int count, Value Lut::*value_field,
+				 unsigned int max_again, unsigned int isp_gain, unsigned int *value)
+{
+	const Lut *lut = table;
+
+	while (lut->gain <= max_again) {
+		if (isp_gain == 0) {
+			*value = lut[0].*value_field;
+			return lut[0].gain;
+		} else if (isp_gain < lut->gain) {
+			EXPECT_GT(lut, table) << "isp_gain " << isp_gain;
+			*value = (lut - 1)->*value_field;
+			return (lut - 1)->gain;
+		} else {
+			if ((lut->gain == max_again) && (isp_gain >= lut->gain)) {
+				*value = lut->*value_field;
+				return lut->gain;
+			}
+		}
+		lut++;
+		if (lut == table + count) {
+			ADD_FAILURE() << "isp_gain " << isp_gain << " runs off the table";
+			return isp_gain;
+		}
+	}
+
+	return isp_gain;
+}
+
+template <typename Lut, typename Value>
+static void compare_all(const Lut *table, int count, Value Lut::*value_field,
+			const struct sensor_gain_lut *desc, unsigned int max_again)
+{
+	unsigned int isp_gain, gain_old, gain_new;
+	unsigned int value_old, value_new;
+	unsigned int extra[] = { 0x7fffffff, 0x80000000, 0xffffffff };
+	std::vector<unsigned int> gains;
+
+	for (isp_gain = 0; isp_gain <= 2 * max_again; isp_gain++)
+		gains.push_back(isp_gain);
+	gains.insert(gains.end(), extra, extra + sizeof(extra) / sizeof(extra[0]));
+
+	for (unsigned int g : gains) {
+		value_old = value_new = 0xdeadbeef;
+		gain_old = linear_alloc(table, count, value_field, max_again, g, &value_old);
+		gain_new = sensor_gain_alloc(desc, max_again, g, &value_new);
+		ASSERT_EQ(gain_new, gain_old) << "isp_gain " << g;
+		ASSERT_EQ(value_new, value_old) << "isp_gain " << g;
+	}
+}
+
+static const struct sensor_gain_lut gc2053_lut = SENSOR_GAIN_LUT(sensor_gc2053_again_lut, index);
+static const struct sensor_gain_lut sc2336_lut = SENSOR_GAIN_LUT(sensor_sc2336_again_lut, value);
+
+TEST(SensorGain, Gc2053MatchesLinearScan)
+{
+	compare_all(sensor_gc2053_again_lut, ARRAY_SIZE(sensor_gc2053_again_lut),
+		    &gc2053_again_lut::index, &gc2053_lut, gc2053_max_again);
+}
+
+TEST(SensorGain, Sc2336MatchesLinearScan)
+{
+	compare_all(sensor_sc2336_again_lut, ARRAY_SIZE(sensor_sc2336_again_lut),
+		    &sc2336_again_lut::value, &sc2336_lut, sc2336_max_again);
+}
+
+template <typename Lut, typename Value>
+static void bench(const char *name, const Lut *table, int count, Value Lut::*value_field,
+		  const struct sensor_gain_lut *desc, unsigned int max_again)
+{
+	const int rounds = 1000000;
+	std::mt19937 rng(1);
+	std::vector<unsigned int> gains(rounds);
+	std::chrono::steady_clock::time_point t0, t1, t2;
+	unsigned int value, sum_old = 0, sum_new = 0;
+	int i;
+
+	/* the AE loop mostly asks for gains inside the table */
+	for (i = 0; i < rounds; i++)
+		gains[i] = rng() % (max_again + 1);
+
+	t0 = std::chrono::steady_clock::now();
+	for (i = 0; i < rounds; i++)
+		sum_old += linear_alloc(table, count, value_field, max_again, gains[i], &value) + value;
+	t1 = std::chrono::steady_clock::now();
+	for (i = 0; i < rounds; i++)
+		sum_new += sensor_gain_alloc(desc, max_again, gains[i], &value) + value;
+	t2 = std::chrono::steady_clock::now();
+
+	EXPECT_EQ(sum_new, sum_old);
+	printf("%s, %d rows: linear %.1f ns, binary %.1f ns per call\n", name, count,
+	       std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds,
+	       std::chrono::duration<double, std::nano>(t2 - t1).count() / rounds);
+}
+
+TEST(SensorGain, Benchmark)
+{
+	bench("gc2053", sensor_gc2053_again_lut, ARRAY_SIZE(sensor_gc2053_again_lut),
+	      &gc2053_again_lut::index, &gc2053_lut, gc2053_max_again);
+	bench("sc2336", sensor_sc2336_again_lut, ARRAY_SIZE(sensor_sc2336_again_lut),
+	      &sc2336_again_lut::value, &sc2336_lut, sc2336_max_again);
+}
@@ -0,0 +1,150 @@
+#ifndef SENSOR_REGS_H
+#define SENSOR_REGS_H
+
+#include <linux/types.h>
+#include <linux/stddef.h>
+#include <linux/i2c.h>
+
+/* Longest auto-increment run merged into a single i2c message */
+#define SENSOR_REGS_BURST_MAX  32
+/* Messages submitted per i2c_transfer() call */
+#define SENSOR_REGS_BATCH_MSGS 8
+
+#define SENSOR_REGS_NO_PAGE    (-1)
+
+/* Shadow cache capacity, in registers */
+#define SENSOR_REGS_CACHE_SIZE 512
+
+/* Flags in tx_isp_dbg_register.reg above the 16 bit register address */
+#define SENSOR_REGS_DBG_NOCACHE (1U << 31)	/* access the sensor, not the cache */
+#define SENSOR_REGS_DBG_DUMP    (1U << 30)	/* g_register: dump the cache to the log */
+
+/*
+ * Every driver declares its own struct regval_list, and the field widths
+ * differ between drivers, so the table writer is told where to find the
+ * register and value columns instead of assuming one layout.
+ */
+struct sensor_regs_layout {
+	unsigned short stride;
+	unsigned char reg_size;
+	unsigned char val_offset;
+	unsigned char val_size;
+};
+
+#define SENSOR_REGS_LAYOUT(type) {					\
+	.stride = sizeof(type),						\
+	.reg_size = sizeof(((type *)0)->reg_num),			\
+	.val_offset = offsetof(type, value),				\
+	.val_size = sizeof(((type *)0)->value),				\
+}
+
+struct sensor_regs_range {
+	uint16_t first;
+	uint16_t last;
+};
+
+/*
+ * Optional shadow of everything written to the sensor, kept sorted by key
+ * so a lookup is a binary search. On sensors with a page register the key
+ * is (page << 8 | reg), so the same address on different pages does not
+ * alias. Registers inside a volatile range are never served from memory.
+ */
+struct sensor_regs_cache {
+	const struct sensor_regs_range *volatile_ranges;
+	int n_volatile;
+
+	/* runtime state, zero initialised */
+	int count;
+	unsigned char page;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int overflows;
+	uint16_t keys[SENSOR_REGS_CACHE_SIZE];
+	unsigned char vals[SENSOR_REGS_CACHE_SIZE];
+};
+
+struct sensor_regs_config {
+	unsigned char addr_bytes;	/* 1 or 2 byte register address */
+	unsigned int reg_end;		/* SENSOR_REG_END */
+	unsigned int reg_delay;		/* SENSOR_REG_DELAY, value is in ms */
+	int page_reg;			/* never merged into a burst, or SENSOR_REGS_NO_PAGE */
+	unsigned short burst_max;	/* 0 selects SENSOR_REGS_BURST_MAX, 1 disables merging */
+	struct sensor_regs_layout layout;
+	struct sensor_regs_cache *cache;	/* optional */
+};
+
+struct sensor_regs_stats {
+	unsigned int regs;		/* register writes in the table */
+	unsigned int msgs;		/* i2c messages after merging */
+	unsigned int xfers;		/* i2c_transfer() calls */
+};
+
+int sensor_write_table(struct i2c_client *client, const struct sensor_regs_config *cfg,
+		       const void *vals, struct sensor_regs_stats *stats);
+
+/* All of these are no-ops when cfg->cache is NULL */
+int sensor_regs_cache_read(const struct sensor_regs_config *cfg, unsigned int reg, unsigned char *val);
+void sensor_regs_cache_write(const struct sensor_regs_config *cfg, unsigned int reg, unsigned char val);
+void sensor_regs_cache_drop(const struct sensor_regs_config *cfg, unsigned int reg);
+void sensor_regs_cache_reset(const struct sensor_regs_config *cfg);
+int sensor_regs_cache_dump(const struct sensor_regs_config *cfg);
+
+/* Registers one AE update may touch, and the wrapper writes around them */
+#define SENSOR_EXPO_MAX_REGS   16
+#define SENSOR_EXPO_MAX_HOLD   2
+
+struct sensor_reg {
+	uint16_t reg;
+	unsigned char val;
+};
+
+struct sensor_expo_stats {
+	unsigned int commits;		/* updates that reached the bus */
+	unsigned int skipped;		/* updates with nothing changed */
+	unsigned int msgs;		/* i2c messages of the last commit */
+	unsigned int last_us;
+	unsigned int max_us;
+	u64 total_us;
+};
+
+/*
+ * Exposure packet: a driver lists the registers its sensor_set_expo()
+ * writes, in the order the sensor needs them (ascending neighbours merge
+ * into one message), and the group-hold or page-select writes that must
+ * bracket them. Each AE update
+ * stages values with sensor_expo_set() and sends them with
+ * sensor_expo_commit(), which drops values equal to what was last written
+ * and puts everything else, wrapper included, into a single i2c_transfer().
+ */
+struct sensor_expo_packet {
+	const struct sensor_regs_config *cfg;
+	const uint16_t *regs;
+	int nregs;
+	const struct sensor_reg *hold_on;
+	int n_hold_on;
+	const struct sensor_reg *hold_off;
+	int n_hold_off;
+
+	/* runtime state, zero initialised */
+	unsigned char vals[SENSOR_EXPO_MAX_REGS];
+	unsigned char shadow[SENSOR_EXPO_MAX_REGS];
+	unsigned int pending;
+	unsigned int valid;
+	struct sensor_expo_stats stats;
+	struct i2c_msg msgs[SENSOR_EXPO_MAX_REGS + 2 * SENSOR_EXPO_MAX_HOLD];
+	unsigned char buf[SENSOR_EXPO_MAX_REGS + 2 * SENSOR_EXPO_MAX_HOLD][2 + SENSOR_EXPO_MAX_REGS];
+};
+
+static inline void sensor_expo_set(struct sensor_expo_packet *pkt, int idx, unsigned char val) {
+	pkt->vals[idx] = val;
+	pkt->pending |= 1U << idx;
+}
+
+/* Forget the shadow values, e.g. after an init table or a direct write */
+static inline void sensor_expo_invalidate(struct sensor_expo_packet *pkt) {
+	pkt->valid = 0;
+}
+
+int sensor_expo_commit(struct i2c_client *client, struct sensor_expo_packet *pkt);
+
+#endif // SENSOR_REGS_H
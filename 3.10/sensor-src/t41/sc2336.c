@@ -19,8 +19,14 @@
 #include <tx-isp-common.h>
 #include <sensor-common.h>
 #include <sensor-info.h>
+#include <sensor-regs.h>
+#include <sensor-gain.h>
 
 #define SENSOR_NAME "sc2336"
+#define SENSOR_CHIP_ID 0xcb3a
+#define SENSOR_I2C_ADDRESS 0x30
+#define SENSOR_MAX_WIDTH 1920
+#define SENSOR_MAX_HEIGHT 1080
 #define SENSOR_CHIP_ID_H (0xcb)
 #define SENSOR_CHIP_ID_L (0x3a)
 #define SENSOR_REG_END 0xffff
@@ -45,6 +51,17 @@ static int shvflip = 1;
 module_param(shvflip, int, S_IRUGO);
 MODULE_PARM_DESC(shvflip, "Sensor HV Flip Enable interface");
 
+static struct sensor_info sensor_info = {
+	.name = SENSOR_NAME,
+	.chip_id = SENSOR_CHIP_ID,
+	.version = SENSOR_VERSION,
+	.min_fps = SENSOR_OUTPUT_MIN_FPS,
+	.max_fps = SENSOR_OUTPUT_MAX_FPS,
+	.chip_i2c_addr = SENSOR_I2C_ADDRESS,
+	.width = SENSOR_MAX_WIDTH,
+	.height = SENSOR_MAX_HEIGHT,
+};
+
 //static unsigned int expo_val = 0x031f0320;
 
 struct regval_list {
@@ -223,26 +240,10 @@ struct again_lut sensor_again_lut[] = {
 
 struct tx_isp_sensor_attribute sensor_attr;
 
-unsigned int sensor_alloc_again(unsigned int isp_gain, unsigned char shift, unsigned int *sensor_again) {
-	struct again_lut *lut = sensor_again_lut;
-	while (lut->gain <= sensor_attr.max_again) {
-		if (isp_gain == 0) {
-			*sensor_again = lut[0].value;
-			return lut[0].gain;
-		} else if (isp_gain < lut->gain) {
-			*sensor_again = (lut - 1)->value;
-			return (lut - 1)->gain;
-		} else {
-			if ((lut->gain == sensor_attr.max_again) && (isp_gain >= lut->gain)) {
-				*sensor_again = lut->value;
-				return lut->gain;
-			}
-		}
-
-		lut++;
-	}
+static const struct sensor_gain_lut sensor_gain_lut = SENSOR_GAIN_LUT(sensor_again_lut, value);
 
-	return isp_gain;
+unsigned int sensor_alloc_again(unsigned int isp_gain, unsigned char shift, unsigned int *sensor_again) {
+	return sensor_gain_alloc(&sensor_gain_lut, sensor_attr.max_again, isp_gain, sensor_again);
 }
 
 unsigned int sensor_alloc_dgain(unsigned int isp_gain, unsigned char shift, unsigned int *sensor_dgain) {
@@ -481,8 +482,56 @@ static struct regval_list sensor_stream_off_mipi[] = {
 	{SENSOR_REG_END, 0x00},
 };
 
-int sensor_read(struct tx_isp_subdev *sd, uint16_t reg,
-		unsigned char *value) {
+static const struct sensor_regs_range sensor_regs_volatile[] = {
+	{0x3107, 0x3108},	/* chip id, always read from the sensor */
+};
+
+static struct sensor_regs_cache sensor_regs_cache = {
+	.volatile_ranges = sensor_regs_volatile,
+	.n_volatile = ARRAY_SIZE(sensor_regs_volatile),
+};
+
+static const struct sensor_regs_config sensor_regs_cfg = {
+	.addr_bytes = 2,
+	.reg_end = SENSOR_REG_END,
+	.reg_delay = SENSOR_REG_DELAY,
+	.page_reg = SENSOR_REGS_NO_PAGE,
+	.layout = SENSOR_REGS_LAYOUT(struct regval_list),
+	.cache = &sensor_regs_cache,
+};
+
+/* AE registers in address order, so neighbours share one i2c message */
+enum {
+	SENSOR_EXPO_IT_H,
+	SENSOR_EXPO_IT_M,
+	SENSOR_EXPO_IT_L,
+	SENSOR_EXPO_AGAIN_FINE,
+	SENSOR_EXPO_AGAIN_COARSE,
+};
+
+static const uint16_t sensor_expo_regs[] = {0x3e00, 0x3e01, 0x3e02, 0x3e07, 0x3e09};
+
+/* group hold, so integration time and gain land on the same frame */
+static const struct sensor_reg sensor_expo_hold_on[] = {
+	{0x3812, 0x00},
+};
+
+static const struct sensor_reg sensor_expo_hold_off[] = {
+	{0x3812, 0x30},
+};
+
+static struct sensor_expo_packet sensor_expo = {
+	.cfg = &sensor_regs_cfg,
+	.regs = sensor_expo_regs,
+	.nregs = ARRAY_SIZE(sensor_expo_regs),
+	.hold_on = sensor_expo_hold_on,
+	.n_hold_on = ARRAY_SIZE(sensor_expo_hold_on),
+	.hold_off = sensor_expo_hold_off,
+	.n_hold_off = ARRAY_SIZE(sensor_expo_hold_off),
+};
+
+static int sensor_read_bus(struct tx_isp_subdev *sd, uint16_t reg,
+			   unsigned char *value) {
 	struct i2c_client *client = tx_isp_get_subdevdata(sd);
 	uint8_t buf[2] = {(reg >> 8) & 0xff, reg & 0xff};
 	struct i2c_msg msg[2] = {
@@ -501,12 +550,22 @@ int sensor_read(struct tx_isp_subdev *sd, uint16_t reg,
 	};
 	int ret;
 	ret = private_i2c_transfer(client->adapter, msg, 2);
-	if (ret > 0)
+	if (ret > 0) {
 		ret = 0;
+		sensor_regs_cache_write(&sensor_regs_cfg, reg, *value);
+	}
 
 	return ret;
 }
 
+int sensor_read(struct tx_isp_subdev *sd, uint16_t reg,
+		unsigned char *value) {
+	if (!sensor_regs_cache_read(&sensor_regs_cfg, reg, value))
+		return 0;
+
+	return sensor_read_bus(sd, reg, value);
+}
+
 int sensor_write(struct tx_isp_subdev *sd, uint16_t reg,
 		 unsigned char value) {
 	struct i2c_client *client = tx_isp_get_subdevdata(sd);
@@ -518,9 +577,14 @@ int sensor_write(struct tx_isp_subdev *sd, uint16_t reg,
 		.buf = buf,
 	};
 	int ret;
+	sensor_expo_invalidate(&sensor_expo);
 	ret = private_i2c_transfer(client->adapter, &msg, 1);
-	if (ret > 0)
+	if (ret > 0) {
 		ret = 0;
+		sensor_regs_cache_write(&sensor_regs_cfg, reg, value);
+	} else {
+		sensor_regs_cache_drop(&sensor_regs_cfg, reg);
+	}
 
 	return ret;
 }
@@ -546,19 +610,8 @@ static int sensor_read_array(struct tx_isp_subdev *sd, struct regval_list *vals)
 #endif
 
 static int sensor_write_array(struct tx_isp_subdev *sd, struct regval_list *vals) {
-	int ret;
-	while (vals->reg_num != SENSOR_REG_END) {
-		if (vals->reg_num == SENSOR_REG_DELAY) {
-			msleep(vals->value);
-		} else {
-			ret = sensor_write(sd, vals->reg_num, vals->value);
-			if (ret < 0)
-				return ret;
-		}
-		vals++;
-	}
-
-	return 0;
+	sensor_expo_invalidate(&sensor_expo);
+	return sensor_write_table(tx_isp_get_subdevdata(sd), &sensor_regs_cfg, vals, NULL);
 }
 
 static int sensor_reset(struct tx_isp_subdev *sd, struct tx_isp_initarg *init) {
@@ -589,15 +642,21 @@ static int sensor_detect(struct tx_isp_subdev *sd, unsigned int *ident) {
 }
 
 static int sensor_set_expo(struct tx_isp_subdev *sd, int value) {
-	int ret = -1;
+	int ret = 0;
 	int it = (value & 0xffff) * 2;
 	int again = (value & 0xffff0000) >> 16;
 
-	ret += sensor_write(sd, 0x3e00, (unsigned char) ((it >> 12) & 0xf));
-	ret += sensor_write(sd, 0x3e01, (unsigned char) ((it >> 4) & 0xff));
-	ret += sensor_write(sd, 0x3e02, (unsigned char) ((it & 0x0f) << 4));
-	ret = sensor_write(sd, 0x3e07, (unsigned char) (again & 0xff));
-	ret += sensor_write(sd, 0x3e09, (unsigned char) (((again >> 8) & 0xff)));
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_IT_H, (unsigned char) ((it >> 12) & 0xf));
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_IT_M, (unsigned char) ((it >> 4) & 0xff));
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_IT_L, (unsigned char) ((it & 0x0f) << 4));
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_AGAIN_FINE, (unsigned char) (again & 0xff));
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_AGAIN_COARSE, (unsigned char) (((again >> 8) & 0xff)));
+
+	ret = sensor_expo_commit(tx_isp_get_subdevdata(sd), &sensor_expo);
+	if (ret < 0) {
+		ISP_ERROR("sensor_write error  %d\n", __LINE__);
+		return ret;
+	}
 
 	//expo_val = value;
 
@@ -676,6 +735,7 @@ static int sensor_s_stream(struct tx_isp_subdev *sd, struct tx_isp_initarg *init
 
 	if (init->enable) {
 		if (sensor->video.state == TX_ISP_MODULE_INIT) {
+			sensor_regs_cache_reset(&sensor_regs_cfg);
 			ret = sensor_write_array(sd, wsize->regs);
 			if (ret)
 				return ret;
@@ -869,6 +929,7 @@ static int sensor_g_chip_ident(struct tx_isp_subdev *sd,
 			ISP_ERROR("gpio request fail %d\n", pwdn_gpio);
 		}
 	}
+	sensor_regs_cache_reset(&sensor_regs_cfg);
 	ret = sensor_detect(sd, &ident);
 	if (ret) {
 		ISP_ERROR("chip found @ 0x%x (%s) is not an %s chip.\n",
@@ -952,7 +1013,15 @@ static int sensor_g_register(struct tx_isp_subdev *sd, struct tx_isp_dbg_registe
 	}
 	if (!private_capable(CAP_SYS_ADMIN))
 		return -EPERM;
-	ret = sensor_read(sd, reg->reg & 0xffff, &val);
+	if (reg->reg & SENSOR_REGS_DBG_DUMP) {
+		reg->val = sensor_regs_cache_dump(&sensor_regs_cfg);
+		reg->size = 2;
+		return 0;
+	}
+	if (reg->reg & SENSOR_REGS_DBG_NOCACHE)
+		ret = sensor_read_bus(sd, reg->reg & 0xffff, &val);
+	else
+		ret = sensor_read(sd, reg->reg & 0xffff, &val);
 	reg->val = val;
 	reg->size = 2;
 
@@ -969,6 +1038,9 @@ static int sensor_s_register(struct tx_isp_subdev *sd, const struct tx_isp_dbg_r
 	if (!private_capable(CAP_SYS_ADMIN))
 		return -EPERM;
 	sensor_write(sd, reg->reg & 0xffff, reg->val & 0xff);
+	/* leave it to the next read to fetch what the sensor really holds */
+	if (reg->reg & SENSOR_REGS_DBG_NOCACHE)
+		sensor_regs_cache_drop(&sensor_regs_cfg, reg->reg & 0xffff);
 
 	return 0;
 }
@@ -1071,11 +1143,19 @@ static struct i2c_driver sensor_driver = {
 };
 
 static __init int init_sensor(void) {
-	return private_i2c_add_driver(&sensor_driver);
+	int ret;
+
+	sensor_info.expo = &sensor_expo;
+	sensor_common_init(&sensor_info);
+	ret = private_i2c_add_driver(&sensor_driver);
+	if (ret)
+		sensor_common_exit();
+	return ret;
 }
 
 static __exit void exit_sensor(void) {
 	private_i2c_del_driver(&sensor_driver);
+	sensor_common_exit();
 }
 
 module_init(init_sensor);
@@ -19,6 +19,9 @@
 #include <linux/platform_device.h>
 #include <dt-bindings/interrupt-controller/a1-irq.h>
 #include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/timer.h>
 #include <asm/uaccess.h>
 #include <asm/irq.h>
 #include <asm/io.h>
@@ -38,6 +41,12 @@
 #define REG_AIP_IRQ_START       (0x04)
 
 #define JZ_AIP_NUM      	3
+#define AIP_CHAIN_BUF_SIZE	8192
+#define AIP_JOB_QUEUE_MAX	16
+#define AIP_JOB_TIMEOUT_MS	(10 * 1000)
+
+#define CPM_SRBC		0xb00000f0
+#define CPM_SRBC_AIP		(1 << 28)
 static uint64_t jz_aip_dma_mask = ~((uint64_t)0);
 static struct resource jz_aip_t_resources[] = {
 	[0] = {
@@ -111,10 +120,24 @@ struct platform_device jz_aip_device[3] = {
 	},
 };
 
+struct jz_aip_job_entry {
+	struct list_head		list;
+	struct file			*file;		/* NULL once the submitter has gone */
+	struct jz_aip_job		job;
+	unsigned int			status;
+	int				result;
+	ktime_t				queued;
+	ktime_t				started;
+	ktime_t				finished;
+};
+
 struct jz_aip {
 	char				name[16];
 	int				idx;
 	void __iomem			*iomem;
+	unsigned long			iobase;
+	void __iomem			*share_ctrl;
+	struct device			*dev;
 	struct clk			*clk_gate;
 
 	int				irq;
@@ -126,8 +149,21 @@ struct jz_aip {
 	struct mutex			mlock;
 	int				opencnt;
 	struct jz_aip_chainbuf 		*chainbuf;
+
+	struct list_head		job_free;
+	struct list_head		job_queue;	/* first entry is on the engine */
+	struct list_head		job_done;
+	wait_queue_head_t		job_wait;
+	struct timer_list		job_timer;
+	unsigned int			job_seq;
+	struct jz_aip_job_entry		jobs[AIP_JOB_QUEUE_MAX];
+	int				reset_err;	/* for the next IOCTL_AIP_IRQ_WAIT_CMP */
 };
 
+/* CPM_SRBC is shared by the three engines, and so is its AIP reset bit */
+static DEFINE_SPINLOCK(jz_aip_cpm_lock);
+static struct jz_aip *jz_aip_engines[JZ_AIP_NUM];	/* under jz_aip_cpm_lock */
+
 #define jz_aip_readl(aip, offset)		__raw_readl((aip)->iomem + offset)
 #define jz_aip_writel(aip, offset, value)	__raw_writel((value), (aip)->iomem + offset)
 
@@ -138,9 +174,156 @@ struct jz_aip {
 		jz_aip_writel(aip,offset,stat & ~(bm));		\
 	} while(0)
 
+/* Called with slock held */
+static void jz_aip_job_start(struct jz_aip *aip, struct jz_aip_job_entry *entry)
+{
+	unsigned int i;
+
+	entry->started = ktime_get();
+	for (i = 0; i < entry->job.nregs; i++)
+		jz_aip_writel(aip, entry->job.regs[i].offset, entry->job.regs[i].value);
+	mod_timer(&aip->job_timer, jiffies + msecs_to_jiffies(AIP_JOB_TIMEOUT_MS));
+}
+
+/* Called with slock held */
+static void jz_aip_job_retire(struct jz_aip *aip, struct jz_aip_job_entry *entry, unsigned int status, int result)
+{
+	entry->status = status;
+	entry->result = result;
+	entry->finished = ktime_get();
+	if (entry->file)
+		list_move_tail(&entry->list, &aip->job_done);
+	else
+		list_move(&entry->list, &aip->job_free);
+}
+
+/* Called with slock held: retire the job on the engine and start the next one */
+static void jz_aip_job_finish(struct jz_aip *aip, unsigned int status, int result)
+{
+	jz_aip_job_retire(aip, list_first_entry(&aip->job_queue, struct jz_aip_job_entry, list), status, result);
+
+	if (!list_empty(&aip->job_queue))
+		jz_aip_job_start(aip, list_first_entry(&aip->job_queue, struct jz_aip_job_entry, list));
+	else
+		del_timer(&aip->job_timer);
+
+	wake_up(&aip->job_wait);
+}
+
+/* Called with slock held: retire every queued job with result, starting none */
+static void jz_aip_job_fail_queue(struct jz_aip *aip, int result)
+{
+	struct jz_aip_job_entry *entry;
+
+	while (!list_empty(&aip->job_queue)) {
+		entry = list_first_entry(&aip->job_queue, struct jz_aip_job_entry, list);
+		if (!ktime_to_ns(entry->started))
+			entry->started = ktime_get();
+		jz_aip_job_retire(aip, entry, 0, result);
+	}
+	del_timer(&aip->job_timer);
+
+	wake_up(&aip->job_wait);
+}
+
+/*
+ * Take jz_aip_cpm_lock, then every engine's slock in index order, so the
+ * shared reset can be pulsed and all three queues failed in one go.
+ */
+static void jz_aip_lock_engines(unsigned long *flags)
+{
+	int i;
+
+	spin_lock_irqsave(&jz_aip_cpm_lock, *flags);
+	for (i = 0; i < JZ_AIP_NUM; i++)
+		if (jz_aip_engines[i])
+			spin_lock_nested(&jz_aip_engines[i]->slock, i);
+}
+
+static void jz_aip_unlock_engines(unsigned long flags)
+{
+	int i;
+
+	for (i = JZ_AIP_NUM - 1; i >= 0; i--)
+		if (jz_aip_engines[i])
+			spin_unlock(&jz_aip_engines[i]->slock);
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
+}
+
+/*
+ * Called with jz_aip_lock_engines() held. Pulse the AIP soft reset in CPM,
+ * as probe does. The reset line is shared by the T, F and P engines and
+ * loses the registers every owner set up, so no job on any of them can
+ * simply be replayed: each queue is cancelled, and a legacy
+ * IOCTL_AIP_IRQ_WAIT_CMP caller gets -EIO instead of waiting for an
+ * interrupt that will not come.
+ */
+static void jz_aip_engines_reset(void)
+{
+	struct jz_aip *aip;
+	int i;
+
+	*(volatile unsigned int *)(CPM_SRBC) |= CPM_SRBC_AIP;
+	udelay(10);
+	*(volatile unsigned int *)(CPM_SRBC) &= ~CPM_SRBC_AIP;
+
+	for (i = 0; i < JZ_AIP_NUM; i++) {
+		aip = jz_aip_engines[i];
+		if (!aip)
+			continue;
+		if (!list_empty(&aip->job_queue))
+			jz_aip_job_fail_queue(aip, -ECANCELED);
+		else if (aip->opencnt && !aip->reset_err) {
+			aip->reset_err = -EIO;
+			complete(&aip->done);
+		}
+	}
+}
+
+/*
+ * A job that never raised its interrupt leaves the engine in an unknown
+ * state. Report it as timed out and reset the engines; the timer may have
+ * raced with the job finishing, so only a job that has really run for
+ * AIP_JOB_TIMEOUT_MS counts.
+ */
+static void jz_aip_job_timeout(unsigned long data)
+{
+	struct jz_aip *aip = (struct jz_aip *)data;
+	struct jz_aip_job_entry *entry;
+	unsigned long flags;
+	s64 left;
+
+	jz_aip_lock_engines(&flags);
+	if (!list_empty(&aip->job_queue)) {
+		entry = list_first_entry(&aip->job_queue, struct jz_aip_job_entry, list);
+		left = AIP_JOB_TIMEOUT_MS * USEC_PER_MSEC - ktime_us_delta(ktime_get(), entry->started);
+		if (left > 0) {
+			mod_timer(&aip->job_timer, jiffies + usecs_to_jiffies(left) + 1);
+		} else {
+			dev_err(aip->mdev.this_device, "aip index=%d job timeout!\n", aip->idx);
+			jz_aip_job_retire(aip, entry, jz_aip_readl(aip, REG_AIP_IRQ_START), -ETIMEDOUT);
+			jz_aip_engines_reset();
+		}
+	}
+	jz_aip_unlock_engines(flags);
+}
+
+static bool jz_aip_job_idle(struct jz_aip *aip)
+{
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&aip->slock, flags);
+	ret = list_empty(&aip->job_queue);
+	spin_unlock_irqrestore(&aip->slock, flags);
+
+	return ret;
+}
+
 static irqreturn_t jz_aip_interrupt_t(int irq, void *data)
 {
 	struct jz_aip *aip = (struct jz_aip *)data;
+	int done = 0;
 
 	/* disable_irq_nosync(irq); */
 
@@ -152,7 +335,7 @@ static irqreturn_t jz_aip_interrupt_t(int irq, void *data)
 	if(aip->idx == 0) {
 		if(aip->status & 0x1<<3) {
 			dev_dbg(aip->mdev.this_device, "%s : irq = %d, status = 0x%08x\n",__func__, irq, aip->status);
-			complete(&aip->done);
+			done++;
 		}
 
 		if(aip->status & 0x1<<2) {
@@ -161,7 +344,7 @@ static irqreturn_t jz_aip_interrupt_t(int irq, void *data)
 
 		if(aip->status & 0x1<<1) {
 			dev_dbg(aip->mdev.this_device, "%s : irq = %d, status = 0x%08x\n",__func__, irq, aip->status);
-			complete(&aip->done);
+			done++;
 		}
 
 		if(aip->status & 0x1) {
@@ -174,15 +357,25 @@ static irqreturn_t jz_aip_interrupt_t(int irq, void *data)
 
 		if(aip->status & 0x1<<1) {
 			dev_dbg(aip->mdev.this_device, "%s : irq = %d, status = 0x%08x\n",__func__, irq, aip->status);
-			complete(&aip->done);
+			done++;
 		}
 
 		if(aip->status & 0x1) {
 			dev_dbg(aip->mdev.this_device, "%s : irq = %d, status = 0x%08x\n",__func__, irq, aip->status);
-			complete(&aip->done);
+			done++;
 		}
 	}
 
+	if (done) {
+		spin_lock(&aip->slock);
+		if (!list_empty(&aip->job_queue))
+			jz_aip_job_finish(aip, aip->status, 0);
+		else
+			while (done--)
+				complete(&aip->done);
+		spin_unlock(&aip->slock);
+	}
+
 	/* enable_irq(irq); */
 
 	return IRQ_HANDLED;
@@ -200,7 +393,7 @@ static int jz_aip_open(struct inode *inode, struct file *file)
 			"sync			\n\t"
 			"lw $0,0(%0)	\n\t"
 			::"r" (0xa0000000));
-	*((volatile unsigned int *)(0xb2200000)) = 0x0;
+	__raw_writel(0x0, aip->share_ctrl);
 	__asm__ volatile(
 			".set push		\n\t"
 			".set mips32r2	\n\t"
@@ -222,9 +415,37 @@ static int jz_aip_release(struct inode *inode, struct file *file)
 {
 	struct miscdevice *mdev = file->private_data;
 	struct jz_aip *aip = list_entry(mdev, struct jz_aip, mdev);
+	struct jz_aip_job_entry *entry, *n;
+	unsigned long flags;
+	bool first = true;
+
+	/* a job already on the engine runs on, its result is dropped */
+	spin_lock_irqsave(&aip->slock, flags);
+	list_for_each_entry_safe(entry, n, &aip->job_queue, list) {
+		if (entry->file == file) {
+			if (first)
+				entry->file = NULL;
+			else
+				list_move(&entry->list, &aip->job_free);
+		}
+		first = false;
+	}
+	list_for_each_entry_safe(entry, n, &aip->job_done, list) {
+		if (entry->file == file)
+			list_move(&entry->list, &aip->job_free);
+	}
+	spin_unlock_irqrestore(&aip->slock, flags);
 
 	mutex_lock(&aip->mlock);
 	if (aip->opencnt == 1) {
+		/* the job left on the engine still needs its interrupt to finish */
+		wait_event_timeout(aip->job_wait, jz_aip_job_idle(aip), msecs_to_jiffies(AIP_JOB_TIMEOUT_MS));
+		del_timer_sync(&aip->job_timer);
+		jz_aip_lock_engines(&flags);
+		if (!list_empty(&aip->job_queue))
+			jz_aip_engines_reset();
+		aip->reset_err = 0;
+		jz_aip_unlock_engines(flags);
 		disable_irq(aip->irq);
 		aip->done.done = 0;
 		aip->opencnt--;
@@ -235,9 +456,77 @@ static int jz_aip_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/* Called with slock held */
+static struct jz_aip_job_entry *jz_aip_job_done_for(struct jz_aip *aip, struct file *file)
+{
+	struct jz_aip_job_entry *entry;
+
+	list_for_each_entry(entry, &aip->job_done, list) {
+		if (entry->file == file)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static bool jz_aip_job_has_done(struct jz_aip *aip, struct file *file)
+{
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&aip->slock, flags);
+	ret = jz_aip_job_done_for(aip, file) != NULL;
+	spin_unlock_irqrestore(&aip->slock, flags);
+
+	return ret;
+}
+
+/* One struct jz_aip_job_done per finished job, oldest first */
 static ssize_t jz_aip_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
 {
-	return 0;
+	struct miscdevice *mdev = file->private_data;
+	struct jz_aip *aip = list_entry(mdev, struct jz_aip, mdev);
+	struct jz_aip_job_entry *entry;
+	struct jz_aip_job_done done;
+	unsigned long flags;
+	size_t copied = 0;
+	int ret;
+
+	if (count < sizeof(done))
+		return -EINVAL;
+
+	while (copied + sizeof(done) <= count) {
+		spin_lock_irqsave(&aip->slock, flags);
+		entry = jz_aip_job_done_for(aip, file);
+		if (entry) {
+			done.seq = entry->job.seq;
+			done.chain = entry->job.chain;
+			done.status = entry->status;
+			done.result = entry->result;
+			done.queue_us = ktime_us_delta(entry->started, entry->queued);
+			done.run_us = ktime_us_delta(entry->finished, entry->started);
+			list_move(&entry->list, &aip->job_free);
+		}
+		spin_unlock_irqrestore(&aip->slock, flags);
+
+		if (!entry) {
+			if (copied)
+				break;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(aip->job_wait, jz_aip_job_has_done(aip, file));
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		wake_up_interruptible(&aip->job_wait);
+		if (copy_to_user(buffer + copied, &done, sizeof(done)))
+			return copied ? copied : -EFAULT;
+		copied += sizeof(done);
+	}
+
+	return copied;
 }
 
 static ssize_t jz_aip_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
@@ -245,8 +534,28 @@ static ssize_t jz_aip_write(struct file *file, const char __user * buffer, size_
 	return 0;
 }
 
+static unsigned int jz_aip_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct miscdevice *mdev = file->private_data;
+	struct jz_aip *aip = list_entry(mdev, struct jz_aip, mdev);
+	unsigned int mask = 0;
+	unsigned long flags;
+
+	poll_wait(file, &aip->job_wait, wait);
+
+	spin_lock_irqsave(&aip->slock, flags);
+	if (jz_aip_job_done_for(aip, file))
+		mask |= POLLIN | POLLRDNORM;
+	if (!list_empty(&aip->job_free))
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&aip->slock, flags);
+
+	return mask;
+}
+
 static long jz_aip_wait_irq(struct jz_aip *aip, unsigned long arg)
 {
+	unsigned long flags;
 	long ret = 0;
 	my_printk("aip index=%d wait done....\n", aip->idx);
 
@@ -256,6 +565,13 @@ static long jz_aip_wait_irq(struct jz_aip *aip, unsigned long arg)
 		return -EFAULT;
 	}
 
+	spin_lock_irqsave(&aip->slock, flags);
+	ret = aip->reset_err;
+	aip->reset_err = 0;
+	spin_unlock_irqrestore(&aip->slock, flags);
+	if (ret)
+		return ret;
+
 	if (copy_to_user((void *)arg, &aip->status, sizeof(unsigned int))) {
 		dev_err(aip->mdev.this_device, "copy_to_user aip index=%d, stat=0x%x failed!\n", aip->idx, aip->status);
 		return -EFAULT;
@@ -315,6 +631,71 @@ static long jz_aip_free_chainbuf(struct jz_aip *aip, unsigned long arg)
 	return ret;
 }
 
+static long jz_aip_submit(struct jz_aip *aip, struct file *file, unsigned long arg)
+{
+	struct jz_aip_job_entry *entry;
+	struct jz_aip_job job;
+	unsigned long flags;
+	unsigned int i;
+
+	if (copy_from_user(&job, (void *)arg, sizeof(job))) {
+		dev_err(aip->mdev.this_device, "copy_from_user failed!!! %s:%d\n",__func__,__LINE__);
+		return -EFAULT;
+	}
+
+	if (!job.nregs || job.nregs > AIP_JOB_MAX_REGS || job.chain < -1 || job.chain >= AIP_CHAIN_RING_SIZE)
+		return -EINVAL;
+	for (i = 0; i < job.nregs; i++) {
+		if (job.regs[i].offset >= JZ_AIP_IOSIZE || (job.regs[i].offset & 0x3))
+			return -EINVAL;
+	}
+
+	if (job.chain >= 0)
+		dma_sync_single_for_device(aip->dev, aip->chainbuf->paddr + job.chain * aip->chainbuf->size,
+				aip->chainbuf->size, DMA_TO_DEVICE);
+
+	spin_lock_irqsave(&aip->slock, flags);
+	if (list_empty(&aip->job_free)) {
+		spin_unlock_irqrestore(&aip->slock, flags);
+		return -EAGAIN;
+	}
+	entry = list_first_entry(&aip->job_free, struct jz_aip_job_entry, list);
+	job.seq = ++aip->job_seq;
+	entry->job = job;
+	entry->file = file;
+	entry->status = 0;
+	entry->result = 0;
+	entry->queued = ktime_get();
+	entry->started = ktime_set(0, 0);
+	list_move_tail(&entry->list, &aip->job_queue);
+	if (list_is_singular(&aip->job_queue))
+		jz_aip_job_start(aip, entry);
+	spin_unlock_irqrestore(&aip->slock, flags);
+
+	if (copy_to_user((void *)arg, &job, sizeof(job))) {
+		dev_err(aip->mdev.this_device, "copy_to_user failed!!! %s:%d\n",__func__,__LINE__);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static long jz_aip_chain_ring(struct jz_aip *aip, unsigned long arg)
+{
+	struct jz_aip_chain_ring ring;
+
+	ring.paddr = aip->chainbuf->paddr;
+	ring.size = aip->chainbuf->size;
+	ring.count = AIP_CHAIN_RING_SIZE;
+	ring.mmap_offset = AIP_CHAIN_CACHED_MMAP;
+	if (copy_to_user((void *)arg, &ring, sizeof(ring))) {
+		dev_err(aip->mdev.this_device, "copy_to_user failed!!! %s:%d\n",__func__,__LINE__);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static long jz_aip_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct miscdevice *mdev = file->private_data;
@@ -327,6 +708,10 @@ static long jz_aip_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return jz_aip_alloc_chainbuf(aip, arg);
 	case IOCTL_AIP_FREE:
 		return jz_aip_free_chainbuf(aip, arg);
+	case IOCTL_AIP_SUBMIT:
+		return jz_aip_submit(aip, file, arg);
+	case IOCTL_AIP_CHAIN_RING:
+		return jz_aip_chain_ring(aip, arg);
 	default:
 		dev_err(mdev->this_device, "%s:invalid cmd %u\n", __func__, cmd);
 		return -1;
@@ -335,14 +720,40 @@ static long jz_aip_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return 0;
 }
 
+/*
+ * Only the register page (shared by the three engines) and the chain ring
+ * can be mapped. Registers and the legacy view of the ring are uncached;
+ * the AIP_CHAIN_CACHED_MMAP view is cached and relies on IOCTL_AIP_SUBMIT
+ * to write the chain back.
+ */
 static int jz_aip_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct miscdevice *mdev = file->private_data;
+	struct jz_aip *aip = list_entry(mdev, struct jz_aip, mdev);
+	struct jz_aip_chainbuf *buf = aip->chainbuf;
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long ring_size = buf->size * AIP_CHAIN_RING_SIZE;
+	unsigned long pfn = 0;
+
 	vma->vm_flags |= VM_IO;
-	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	if (offset == (aip->iobase & PAGE_MASK) && size <= PAGE_SIZE) {
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		pfn = vma->vm_pgoff;
+	} else if (offset >= buf->paddr && size <= ring_size && offset - buf->paddr <= ring_size - size) {
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		pfn = vma->vm_pgoff;
+	} else if (offset >= AIP_CHAIN_CACHED_MMAP && size <= ring_size && offset - AIP_CHAIN_CACHED_MMAP <= ring_size - size) {
+		pfn = (buf->paddr + offset - AIP_CHAIN_CACHED_MMAP) >> PAGE_SHIFT;
+	} else {
+		dev_err(aip->mdev.this_device, "%s: offset 0x%08lx size 0x%lx is not the registers or the chain ring\n", __func__, offset, size);
+		return -EINVAL;
+	}
 
 	if (io_remap_pfn_range(vma,vma->vm_start,
-				vma->vm_pgoff,
-				vma->vm_end - vma->vm_start,
+				pfn,
+				size,
 				vma->vm_page_prot))
 		return -EAGAIN;
 
@@ -355,10 +766,50 @@ const struct file_operations jz_aip_fops = {
 	.release = jz_aip_release,
 	.read = jz_aip_read,
 	.write = jz_aip_write,
+	.poll = jz_aip_poll,
 	.unlocked_ioctl = jz_aip_ioctl,
 	.mmap = jz_aip_mmap,
 };
 
+/*
+ * The chain ring lives in ordinary cacheable pages so userspace can fill it
+ * through a cached mapping. It is written back and invalidated here, so the
+ * legacy uncached mapping starts out consistent too.
+ */
+static void *jz_aip_ring_alloc(struct device *dev, unsigned int size, unsigned int *paddr)
+{
+	void *vaddr, *page;
+	dma_addr_t dma;
+
+	vaddr = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, get_order(size));
+	if (!vaddr)
+		return NULL;
+
+	for (page = vaddr; page < vaddr + size; page += PAGE_SIZE)
+		SetPageReserved(virt_to_page(page));
+
+	dma = dma_map_single(dev, vaddr, size, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(dev, dma)) {
+		for (page = vaddr; page < vaddr + size; page += PAGE_SIZE)
+			ClearPageReserved(virt_to_page(page));
+		free_pages((unsigned long)vaddr, get_order(size));
+		return NULL;
+	}
+	*paddr = dma;
+
+	return vaddr;
+}
+
+static void jz_aip_ring_free(struct device *dev, unsigned int size, void *vaddr, unsigned int paddr)
+{
+	void *page;
+
+	dma_unmap_single(dev, paddr, size, DMA_BIDIRECTIONAL);
+	for (page = vaddr; page < vaddr + size; page += PAGE_SIZE)
+		ClearPageReserved(virt_to_page(page));
+	free_pages((unsigned long)vaddr, get_order(size));
+}
+
 static int jz_aip_probe(struct platform_device *pdev)
 {
 	int ret = 0;
@@ -367,6 +818,7 @@ static int jz_aip_probe(struct platform_device *pdev)
 	unsigned int value = 0;
 	unsigned long flags;
 	struct jz_aip_chainbuf *buf = NULL;
+	int i;
 
 	aip = kzalloc(sizeof(struct jz_aip), GFP_KERNEL);
 	if (!aip) {
@@ -396,6 +848,15 @@ static int jz_aip_probe(struct platform_device *pdev)
 		ret = -ENXIO;
 		goto err_get_aip_iomem;
 	}
+	aip->iobase = regs->start;
+	aip->dev = &pdev->dev;
+
+	aip->share_ctrl = ioremap(JZ_AIP_SHARE_CTRL, sizeof(unsigned int));
+	if (!aip->share_ctrl) {
+		dev_err(&pdev->dev, "ioremap share ctrl failed\n");
+		ret = -ENXIO;
+		goto err_get_share_ctrl;
+	}
 
 #ifndef CONFIG_FPGA_TEST
 	aip->clk_gate = clk_get(&pdev->dev, "gate_aip");
@@ -424,21 +885,29 @@ static int jz_aip_probe(struct platform_device *pdev)
 	mutex_init(&aip->mlock);
 	aip->opencnt = 0;
 
+	INIT_LIST_HEAD(&aip->job_free);
+	INIT_LIST_HEAD(&aip->job_queue);
+	INIT_LIST_HEAD(&aip->job_done);
+	for (i = 0; i < AIP_JOB_QUEUE_MAX; i++)
+		list_add_tail(&aip->jobs[i].list, &aip->job_free);
+	init_waitqueue_head(&aip->job_wait);
+	setup_timer(&aip->job_timer, jz_aip_job_timeout, (unsigned long)aip);
 
-	spin_lock_irqsave(&aip->slock, flags);
+
+	spin_lock_irqsave(&jz_aip_cpm_lock, flags);
 	value = *(volatile unsigned int *)(0xb00000f0);
 	value |= (1<<28);
 	*(volatile unsigned int *)(0xb00000f0) = value;
-	spin_unlock_irqrestore(&aip->slock, flags);
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
 
 	printk("cpm volatile value = 0x%x\n", value);
 	msleep(10);
 
-	spin_lock_irqsave(&aip->slock, flags);
+	spin_lock_irqsave(&jz_aip_cpm_lock, flags);
 	value = *(volatile unsigned int *)(0xb00000f0);
 	value &= ~(1<<28);
 	*(volatile unsigned int *)(0xb00000f0) = value;
-	spin_unlock_irqrestore(&aip->slock, flags);
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
 
 	aip->mdev.minor = MISC_DYNAMIC_MINOR;
 	aip->mdev.fops = &jz_aip_fops;
@@ -450,16 +919,20 @@ static int jz_aip_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}else{
 		buf = aip->chainbuf;
-		buf->size = 8192;
-		buf->vaddr = dma_alloc_coherent(aip->mdev.this_device, buf->size, (dma_addr_t *)&buf->paddr, GFP_KERNEL);
+		buf->size = AIP_CHAIN_BUF_SIZE;
+		buf->vaddr = jz_aip_ring_alloc(aip->dev, buf->size * AIP_CHAIN_RING_SIZE, &buf->paddr);
 		if(buf->vaddr == NULL) {
-			dev_err(aip->mdev.this_device, "[%s:%d]:dma_alloc_coherent failed!!!\n",__func__,__LINE__);
+			dev_err(&pdev->dev, "[%s:%d]:chain ring alloc failed!!!\n",__func__,__LINE__);
 			ret = -ENOMEM;
 			goto err_dma_alloc_coherent;
 		}
 	}
 	printk("dma_malloc is ok!\n");
 
+	spin_lock_irqsave(&jz_aip_cpm_lock, flags);
+	jz_aip_engines[aip->idx] = aip;
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
+
 	ret = misc_register(&aip->mdev);
 	if(ret < 0) {
 		dev_err(&pdev->dev,"request aip misc device failed!\n");
@@ -471,7 +944,10 @@ static int jz_aip_probe(struct platform_device *pdev)
 	return 0;
 
 err_aip_register:
-	dma_free_coherent(aip->mdev.this_device, buf->size, buf->vaddr, (dma_addr_t)buf->paddr);
+	spin_lock_irqsave(&jz_aip_cpm_lock, flags);
+	jz_aip_engines[aip->idx] = NULL;
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
+	jz_aip_ring_free(aip->dev, buf->size * AIP_CHAIN_RING_SIZE, buf->vaddr, buf->paddr);
 	kfree(aip->chainbuf);
 err_dma_alloc_coherent:
 	free_irq(aip->irq, aip);
@@ -482,6 +958,8 @@ err_get_aip_irq:
 	clk_put(aip->clk_gate);
 err_get_aip_clk_gate:
 #endif
+	iounmap(aip->share_ctrl);
+err_get_share_ctrl:
 	iounmap(aip->iomem);
 err_get_aip_iomem:
 err_get_aip_resource:
@@ -495,10 +973,15 @@ static int jz_aip_remove(struct platform_device *dev)
 {
 	struct jz_aip *aip = platform_get_drvdata(dev);
 	struct jz_aip_chainbuf *buf = NULL;
+	unsigned long flags;
 	buf = aip->chainbuf;
 
+	spin_lock_irqsave(&jz_aip_cpm_lock, flags);
+	jz_aip_engines[aip->idx] = NULL;
+	spin_unlock_irqrestore(&jz_aip_cpm_lock, flags);
+	del_timer_sync(&aip->job_timer);
 	if(buf->vaddr)
-		dma_free_coherent(aip->mdev.this_device, buf->size, buf->vaddr, (dma_addr_t)buf->paddr);
+		jz_aip_ring_free(aip->dev, buf->size * AIP_CHAIN_RING_SIZE, buf->vaddr, buf->paddr);
 	misc_deregister(&aip->mdev);
 	kfree(aip->chainbuf);
 
@@ -508,6 +991,7 @@ static int jz_aip_remove(struct platform_device *dev)
 	clk_disable_unprepare(aip->clk_gate);
 	clk_put(aip->clk_gate);
 #endif
+	iounmap(aip->share_ctrl);
 	iounmap(aip->iomem);
 	kfree(aip);
 	aip = NULL;
@@ -6,10 +6,18 @@
 #define JZ_AIP_P_IOBASE		0x13090300
 #define JZ_AIP_IOSIZE		0x100
 
+/* Written once on open, as the NNA/AIP shared configuration expects */
+#define JZ_AIP_SHARE_CTRL	0x12200000
+
+/* mmap offset of the cached view of the chain ring */
+#define AIP_CHAIN_CACHED_MMAP	0xf0000000
+
 
 #define IOCTL_AIP_IRQ_WAIT_CMP		_IOWR('P', 0, int)
 #define IOCTL_AIP_MALLOC		_IOWR('P', 1, int)
 #define IOCTL_AIP_FREE			_IOWR('P', 2, int)
+#define IOCTL_AIP_SUBMIT		_IOWR('P', 3, int)
+#define IOCTL_AIP_CHAIN_RING		_IOWR('P', 4, int)
 
 
 struct jz_aip_chainbuf {
@@ -18,5 +26,52 @@ struct jz_aip_chainbuf {
 	unsigned int size;
 };
 
+/*
+ * Job queue. IOCTL_AIP_CHAIN_RING describes a ring of chain buffers.
+ * Mapped at paddr it is uncached, as the buffer IOCTL_AIP_MALLOC returns
+ * (that one is entry 0); mapped at mmap_offset it is cached, and filling
+ * chains there costs ordinary stores. IOCTL_AIP_SUBMIT writes the job's
+ * chain entry back to memory once, then queues the job: regs[] are the
+ * register writes that start it, usually just the doorbell, replayed in
+ * order once the engine has finished the jobs before it. A job that
+ * times out pulses the AIP reset, which the T, F and P engines share and
+ * which loses the registers every job was set up against: the jobs
+ * queued on all three engines are cancelled, and a pending
+ * IOCTL_AIP_IRQ_WAIT_CMP returns -EIO. Each
+ * finished job is reported once through read() as a struct
+ * jz_aip_job_done; poll() gives POLLIN when one is ready and POLLOUT
+ * while the queue has room.
+ */
+#define AIP_CHAIN_RING_SIZE	4
+#define AIP_JOB_MAX_REGS	16
+
+struct jz_aip_chain_ring {
+	unsigned int paddr;
+	unsigned int size;		/* of each chain buffer */
+	unsigned int count;
+	unsigned int mmap_offset;	/* cached view */
+};
+
+struct jz_aip_reg {
+	unsigned int offset;
+	unsigned int value;
+};
+
+struct jz_aip_job {
+	int chain;			/* ring entry the job uses, or -1 */
+	unsigned int nregs;
+	struct jz_aip_reg regs[AIP_JOB_MAX_REGS];
+	unsigned int seq;		/* out */
+};
+
+struct jz_aip_job_done {
+	unsigned int seq;
+	int chain;			/* free to refill from now on */
+	unsigned int status;		/* REG_AIP_IRQ_START bits */
+	int result;			/* 0, -ETIMEDOUT, or -ECANCELED when an AIP reset dropped it */
+	unsigned int queue_us;
+	unsigned int run_us;
+};
+
 #endif
 
@@ -16,6 +16,9 @@
 #include <linux/list.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
 
 #include "include/audio_dsp.h"
 #include "include/audio_debug.h"
@@ -32,12 +35,34 @@ static int aic_enable = 1; // disable aic
 module_param(aic_enable, int, S_IRUGO);
 MODULE_PARM_DESC(aic_enable, "Enable or disable aic");
 
+static int dma_period_irq = 1;
+module_param(dma_period_irq, int, S_IRUGO);
+MODULE_PARM_DESC(dma_period_irq, "Track dma pointers from period callbacks, 0 polls with the timer only");
+
 #define AUDIO_IO_LEADING_DMA (2)
 
 #define AUDIO_DRIVER_VERSION "H20200813a"
 static struct audio_dsp_device* globe_dspdev = NULL;
 
 
+/*
+ * When the first sample of fragment index was captured, from a hw_pos and
+ * snap_tstamp pair read together under dsp->slock; 0 until the route's
+ * pointer has been sampled once.
+ */
+static s64 dsp_fragment_tstamp(struct audio_route *route, unsigned int index, s64 snap_tstamp, unsigned int snap_pos)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	unsigned int bytes = 0;
+
+	if(snap_tstamp == 0 || manage->buffersize == 0)
+		return 0;
+	bytes = (snap_pos + manage->buffersize - index * manage->fragment_size) % manage->buffersize;
+	if(route->rate == 0 || manage->sample_size == 0)
+		return snap_tstamp;
+	return snap_tstamp - (s64)div_u64((u64)(bytes / manage->sample_size) * NSEC_PER_SEC, route->rate);
+}
+
 static void dsp_workqueue_handle(struct work_struct *work)
 {
 	struct audio_dsp_device *dsp = container_of(work,
@@ -48,6 +73,10 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	struct audio_route *ao_route = NULL;
 	unsigned int amic_new_tracer = 0;
 	unsigned int dmic_new_tracer = 0;
+	unsigned int amic_snap_pos = 0;
+	unsigned int dmic_snap_pos = 0;
+	s64 amic_snap_tstamp = 0;
+	s64 dmic_snap_tstamp = 0;
 	unsigned int aec_new_tracer = 0;
 	unsigned int ao_new_tracer = 0;
 	unsigned int dma_tracer = 0;
@@ -58,17 +87,21 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	unsigned int cnt = 0;
 	unsigned int index = 0;
 
-	/* first: save new dma tracer */
+	/* first: save new dma tracer, and the pointer sample the timestamps hang off */
 	spin_lock_irqsave(&dsp->slock, lock_flags);
 	/* amic */
 	amic_route = &(dsp->routes[AUDIO_ROUTE_AMIC_ID]);
 	if(amic_route && amic_route->state == AUDIO_BUSY_STATE){
 		amic_new_tracer = amic_route->manage.new_dma_tracer;
+		amic_snap_pos = amic_route->hw_pos;
+		amic_snap_tstamp = amic_route->snap_tstamp;
 	}
 	/* dmic */
 	dmic_route = &(dsp->routes[AUDIO_ROUTE_DMIC_ID]);
 	if(dmic_route && dmic_route->state == AUDIO_BUSY_STATE){
 		dmic_new_tracer = dmic_route->manage.new_dma_tracer;
+		dmic_snap_pos = dmic_route->hw_pos;
+		dmic_snap_tstamp = dmic_route->snap_tstamp;
 	}
 	/* aec */
 	aec_route = &(dsp->routes[AUDIO_ROUTE_AEC_ID]);
@@ -93,6 +126,8 @@ static void dsp_workqueue_handle(struct work_struct *work)
 			while(dma_tracer != amic_new_tracer && aec_tracer != aec_new_tracer){
 				amic_route->manage.fragments[dma_tracer].priv = &(aec_route->manage.fragments[aec_tracer]);
 				amic_route->manage.fragments[dma_tracer].state = true;
+				amic_route->manage.fragments[dma_tracer].tstamp = dsp_fragment_tstamp(amic_route, dma_tracer,
+						amic_snap_tstamp, amic_snap_pos);
 				if(dma_tracer == amic_route->manage.io_tracer)
 					io_late = 1;
 				dma_tracer = (dma_tracer + 1) % amic_route->manage.fragment_cnt;
@@ -112,6 +147,8 @@ static void dsp_workqueue_handle(struct work_struct *work)
 			}
 			if(io_late){
 				amic_route->manage.io_tracer = (index + 1) % amic_route->manage.fragment_cnt;
+				if(!atomic_read(&amic_route->mmap_cnt))
+					amic_route->xruns++;
 			}
 		}
 		/* wait second copy data */
@@ -143,6 +180,8 @@ static void dsp_workqueue_handle(struct work_struct *work)
 				while(dma_tracer != dmic_new_tracer && aec_tracer != aec_new_tracer){
 					dmic_route->manage.fragments[dma_tracer].priv = &(aec_route->manage.fragments[aec_tracer]);
 					dmic_route->manage.fragments[dma_tracer].state = true;
+					dmic_route->manage.fragments[dma_tracer].tstamp = dsp_fragment_tstamp(dmic_route, dma_tracer,
+							dmic_snap_tstamp, dmic_snap_pos);
 					if(dma_tracer == dmic_route->manage.io_tracer)
 						io_late = 1;
 					dma_tracer = (dma_tracer + 1) % dmic_route->manage.fragment_cnt;
@@ -157,6 +196,8 @@ static void dsp_workqueue_handle(struct work_struct *work)
 				while(dma_tracer != dmic_new_tracer){
 					dmic_route->manage.fragments[dma_tracer].priv = NULL;
 					dmic_route->manage.fragments[dma_tracer].state = true;
+					dmic_route->manage.fragments[dma_tracer].tstamp = dsp_fragment_tstamp(dmic_route, dma_tracer,
+							dmic_snap_tstamp, dmic_snap_pos);
 					if(dma_tracer == dmic_route->manage.io_tracer)
 						io_late = 1;
 					dma_tracer = (dma_tracer + 1) % dmic_route->manage.fragment_cnt;
@@ -175,6 +216,8 @@ static void dsp_workqueue_handle(struct work_struct *work)
 			}
 			if(io_late){
 				dmic_route->manage.io_tracer = (index + 1) % dmic_route->manage.fragment_cnt;
+				if(!atomic_read(&dmic_route->mmap_cnt))
+					dmic_route->xruns++;
 			}
 		}
 		/* wait second copy data */
@@ -202,6 +245,11 @@ static void dsp_workqueue_handle(struct work_struct *work)
 
 			if(ao_new_tracer < ao_route->manage.fragment_cnt && ao_new_tracer >= 0){
 				while(dma_tracer != ao_new_tracer){
+					/* mapped rings belong to the application, underruns are counted by the timer */
+					if(atomic_read(&ao_route->mmap_cnt)){
+						dma_tracer = (dma_tracer + 1) % ao_route->manage.fragment_cnt;
+						continue;
+					}
 					if(dma_tracer == ao_route->manage.io_tracer){
 						printk("%d: audio spk io late!\n", __LINE__);
 						io_late = 1;
@@ -224,8 +272,10 @@ static void dsp_workqueue_handle(struct work_struct *work)
 				}
 				if(io_late){
 					ao_route->manage.io_tracer = (index + 1) % ao_route->manage.fragment_cnt;
+					if(!atomic_read(&ao_route->mmap_cnt))
+						ao_route->xruns++;
 				}
-			}else{
+			}else if(!atomic_read(&ao_route->mmap_cnt)){
 				printk("%d: audio spk dma transfer error!\n", __LINE__);
 				memset(ao_route->manage.fragments[dma_tracer].vaddr, 0, ao_route->manage.fragment_size);
 				dma_sync_single_for_device(NULL, ao_route->manage.fragments[dma_tracer].paddr,
@@ -263,44 +313,315 @@ static void dsp_workqueue_handle(struct work_struct *work)
 		mutex_unlock(&aec_route->mlock);
 	}
 
+	wake_up_interruptible(&dsp->poll_wait);
 	return;
 }
 
+/*
+ * Called with dsp->slock held. pos is the DMA offset in the ring; hw_ptr
+ * only moves forward, which holds as long as the pointer is sampled more
+ * than once per ring (every fragment or every 2, rings are much longer).
+ */
+static void dsp_mmap_update(struct audio_dsp_device *dsp, struct audio_route *route, unsigned int pos)
+{
+	struct audio_mmap_route *status = &dsp->mmap_status->routes[route->index];
+	unsigned int buffersize = route->manage.buffersize;
+	bool xrun = false;
+
+	if(buffersize == 0)
+		return;
+	pos %= buffersize;
+	route->hw_ptr += (pos + buffersize - route->hw_pos) % buffersize;
+	route->hw_pos = pos;
+
+	if(atomic_read(&route->mmap_cnt)){
+		if(route->index == AUDIO_ROUTE_SPK_ID)
+			xrun = (int)(route->appl_ptr - route->hw_ptr) < 0;
+		else
+			xrun = route->hw_ptr - route->appl_ptr > buffersize;
+		if(xrun && !route->in_xrun)
+			route->xruns++;
+		route->in_xrun = xrun;
+	}
+
+	status->hw_ptr = route->hw_ptr;
+	status->xruns = route->xruns;
+}
+
+static void dsp_mmap_reset(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	struct audio_mmap_route *status = &dsp->mmap_status->routes[route->index];
+	unsigned long lock_flags;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->hw_pos = 0;
+	route->snap_tstamp = 0;
+	route->hw_ptr = 0;
+	route->appl_ptr = 0;
+	route->in_xrun = false;
+	status->state = AUDIO_BUSY_STATE;
+	status->rate = route->rate;
+	status->channel = route->channel;
+	status->format = route->format;
+	status->fragment_size = route->manage.fragment_size;
+	status->fragment_cnt = route->manage.fragment_cnt;
+	status->buffersize = route->manage.buffersize;
+	status->hw_ptr = 0;
+	status->appl_ptr = 0;
+	status->xruns = route->xruns;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+}
+
+#define AUDIO_DEFAULT_PERIOD_FRAGS (2)
+
+static inline bool dsp_route_is_capture(enum auido_route_index index)
+{
+	return index != AUDIO_ROUTE_SPK_ID;
+}
+
+/* Shortest request on route's group, 0 if none. Called with dsp->slock held */
+static unsigned int dsp_route_request_ms(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	struct audio_route *other = NULL;
+	unsigned int time_ms = 0;
+	int id = 0, i = 0;
+
+	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++){
+		if(dsp_route_is_capture(id) != dsp_route_is_capture(route->index))
+			continue;
+		other = &(dsp->routes[id]);
+		for(i = 0; i < AUDIO_FRAGMENT_REQ_MAX; i++){
+			if(other->frag_req[i].file == NULL)
+				continue;
+			if(time_ms == 0 || other->frag_req[i].time_ms < time_ms)
+				time_ms = other->frag_req[i].time_ms;
+		}
+	}
+	return time_ms;
+}
+
+/*
+ * Fragment length for a ring about to be built. Capture routes that run
+ * side by side have to agree, or AEC fragments no longer pair with mic ones.
+ */
+static unsigned int dsp_route_fragment_ms(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	struct audio_route *amic_route = &(dsp->routes[AUDIO_ROUTE_AMIC_ID]);
+	struct audio_route *dmic_route = &(dsp->routes[AUDIO_ROUTE_DMIC_ID]);
+	unsigned long lock_flags;
+	unsigned int time_ms = 0;
+
+	switch(route->index){
+		case AUDIO_ROUTE_AEC_ID:
+			return amic_route->frag_ms;
+		case AUDIO_ROUTE_AMIC_ID:
+			if(dmic_route->state == AUDIO_BUSY_STATE)
+				return dmic_route->frag_ms;
+			break;
+		case AUDIO_ROUTE_DMIC_ID:
+			if(amic_route->state == AUDIO_BUSY_STATE)
+				return amic_route->frag_ms;
+			break;
+		default:
+			break;
+	}
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	time_ms = dsp_route_request_ms(dsp, route);
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	if(time_ms == 0)
+		return fragment_time * 10;
+	return min(time_ms, (unsigned int)AUDIO_FRAGMENT_MAX_MS);
+}
+
+/* Fragments per wakeup for route under the current requests. Called with dsp->slock held */
+static unsigned int dsp_route_period_frags(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	unsigned int time_ms = dsp_route_request_ms(dsp, route);
+	unsigned int frags = 0;
+
+	frags = time_ms ? time_ms / route->frag_ms : AUDIO_DEFAULT_PERIOD_FRAGS;
+	frags = min(frags, route->manage.fragment_cnt / 4);
+	return max(frags, 1U);
+}
+
+/* An AEC route running beside its mic is sampled together with it, never on its own */
+static bool dsp_route_paired_aec(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	if(route->index != AUDIO_ROUTE_AEC_ID)
+		return false;
+	return dsp->routes[AUDIO_ROUTE_AMIC_ID].state == AUDIO_BUSY_STATE
+		|| (dsp->dmic_aec && dsp->routes[AUDIO_ROUTE_DMIC_ID].state == AUDIO_BUSY_STATE);
+}
+
+/*
+ * Whether the timer has to sample route: its channel delivers no period
+ * callbacks, or they come less often than the route now asks to be woken.
+ * Called with dsp->slock held.
+ */
+static bool dsp_route_timer_polled(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	if(route->state != AUDIO_BUSY_STATE || dsp_route_paired_aec(dsp, route))
+		return false;
+	return !route->dma_irq || route->period_frags < route->dma_period_frags;
+}
+
+/*
+ * Recompute every running route's wakeup period from the current requests,
+ * and the timer period from the routes it polls. Called with dsp->slock held.
+ */
+static void dsp_update_period(struct audio_dsp_device *dsp)
+{
+	struct audio_route *route = NULL;
+	unsigned int timer_ms = 0;
+	int id = 0;
+
+	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++){
+		route = &(dsp->routes[id]);
+		if(route->state != AUDIO_BUSY_STATE || route->frag_ms == 0)
+			continue;
+		route->period_frags = dsp_route_period_frags(dsp, route);
+		if(dsp_route_timer_polled(dsp, route) && (timer_ms == 0 || route->period_frags * route->frag_ms < timer_ms))
+			timer_ms = route->period_frags * route->frag_ms;
+	}
+	if(timer_ms)
+		dsp->expires = ns_to_ktime((u64)timer_ms * NSEC_PER_MSEC);
+}
+
+static void __dsp_route_sync_dma(struct audio_dsp_device *dsp, struct audio_route *route, s64 now)
+{
+	struct audio_pipe *pipe = route->pipe;
+	dma_addr_t dma_currentaddr = 0;
+
+	dma_currentaddr = pipe->dma_chan->device->get_current_trans_addr(pipe->dma_chan, NULL, NULL,
+			pipe->dma_config.direction);
+	route->manage.new_dma_tracer = (dma_currentaddr - pipe->paddr) / route->manage.fragment_size;
+	dsp_mmap_update(dsp, route, dma_currentaddr - pipe->paddr);
+	/* hw_pos and snap_tstamp only ever change together, under slock */
+	route->snap_tstamp = now;
+}
+
+/*
+ * Called with dsp->slock held. The AEC pointer is sampled back to back
+ * with the mic that uses it, so both come from one snapshot.
+ */
+static void dsp_route_sync_dma(struct audio_dsp_device *dsp, struct audio_route *route)
+{
+	struct audio_route *aec_route = &(dsp->routes[AUDIO_ROUTE_AEC_ID]);
+	bool with_aec = false;
+	s64 now = ktime_to_ns(ktime_get());
+
+	switch(route->index){
+		case AUDIO_ROUTE_AEC_ID:
+			if(dsp_route_paired_aec(dsp, route))
+				return;
+			break;
+		case AUDIO_ROUTE_AMIC_ID:
+			with_aec = true;
+			break;
+		case AUDIO_ROUTE_DMIC_ID:
+			with_aec = dsp->dmic_aec;
+			break;
+		default:
+			break;
+	}
+
+	__dsp_route_sync_dma(dsp, route, now);
+	if(with_aec && aec_route->state == AUDIO_BUSY_STATE)
+		__dsp_route_sync_dma(dsp, aec_route, now);
+}
+
+/*
+ * Cyclic dma period callback, one per dma_period_frags fragments, which is
+ * the wakeup period the route had when it was enabled; should a request
+ * shorten period_frags since, the tracer work still runs at most once per
+ * period_frags and the timer fills in. The first callback takes the route
+ * off the timer, so the timer only keeps running for routes whose channel
+ * does not deliver them.
+ */
+static void dsp_dma_period_callback(void *arg)
+{
+	struct audio_route *route = arg;
+	struct audio_dsp_device *dsp = route->priv;
+	unsigned long lock_flags;
+	bool notify = false;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	if(route->state != AUDIO_BUSY_STATE){
+		spin_unlock_irqrestore(&dsp->slock, lock_flags);
+		return;
+	}
+	route->dma_irq = true;
+	route->irq_wakeups++;
+	dsp_route_sync_dma(dsp, route);
+	route->period_count += route->dma_period_frags;
+	notify = route->period_count >= route->period_frags;
+	if(notify)
+		route->period_count = 0;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	if(notify)
+		schedule_work(&dsp->workqueue);
+}
+
 static enum hrtimer_restart jz_audio_hrtimer_callback(struct hrtimer *hr_timer) {
 	struct audio_dsp_device *dsp = container_of(hr_timer,
 			struct audio_dsp_device, hr_timer);
 	struct audio_route *route = NULL;
-	struct audio_pipe *pipe = NULL;
-	dma_addr_t dma_currentaddr = 0;
-	unsigned int index = 0;
+	unsigned int polled = 0;
 	unsigned int id = 0;
 	unsigned long lock_flags;
 
+	spin_lock_irqsave(&dsp->slock, lock_flags);
 	if (atomic_read(&dsp->timer_stopped))
 		goto out;
-	hrtimer_start(&dsp->hr_timer, dsp->expires, HRTIMER_MODE_REL);
 
-	spin_lock_irqsave(&dsp->slock, lock_flags);
-
-	/* sync all routes dma */
+	/* sync the dma of routes without period callbacks */
 	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++){
 		route = &(dsp->routes[id]);
-		if(route && route->state == AUDIO_BUSY_STATE){
-			pipe = route->pipe;
-			dma_currentaddr = pipe->dma_chan->device->get_current_trans_addr(pipe->dma_chan, NULL, NULL,
-					pipe->dma_config.direction);
-			index = (dma_currentaddr - pipe->paddr) / route->manage.fragment_size;
-			route->manage.new_dma_tracer = index;
+		if(route && dsp_route_timer_polled(dsp, route)){
+			route->timer_wakeups++;
+			dsp_route_sync_dma(dsp, route);
+			polled++;
 		}
 	}
+	if(!polled)
+		goto out;
 
+	dsp->timer_wakeups++;
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
 
 	schedule_work(&dsp->workqueue);
+	hrtimer_forward_now(hr_timer, dsp->expires);
+	return HRTIMER_RESTART;
 out:
+	dsp->timer_running = false;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
 	return HRTIMER_NORESTART;
 }
 
+/*
+ * After a route was enabled or a request changed: pick the periods and arm
+ * the fallback timer, which stops on its own. Called with dsp->slock held.
+ */
+static void __dsp_timer_kick(struct audio_dsp_device *dsp)
+{
+	dsp_update_period(dsp);
+	if(!dsp->timer_running && !atomic_read(&dsp->timer_stopped)){
+		dsp->timer_running = true;
+		hrtimer_start(&dsp->hr_timer, dsp->expires, HRTIMER_MODE_REL);
+	}
+}
+
+static void dsp_timer_kick(struct audio_dsp_device *dsp)
+{
+	unsigned long lock_flags;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	__dsp_timer_kick(dsp);
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+}
+
 static inline long dsp_ioctl_sync_ao_stream(struct audio_dsp_device *dsp)
 {
 	long ret = 0;
@@ -339,7 +660,7 @@ static inline long dsp_ioctl_sync_ao_stream(struct audio_dsp_device *dsp)
 out:
 	mutex_unlock(&route->mlock);
 	if(wait_cnt){
-		msleep((wait_cnt + 1)*10*fragment_time);
+		msleep((wait_cnt + 1)*route->frag_ms);
 	}
 	return ret;
 }
@@ -454,11 +775,14 @@ static inline unsigned int format_to_bytes(unsigned int format)
 
 static long dsp_create_dma_chan(struct audio_route *route)
 {
+	struct audio_dsp_device *dsp = route->priv;
 	struct dsp_data_manage *manage = NULL;
 	struct audio_pipe *pipe = NULL;
 	struct audio_route *parent = NULL;
 	struct dma_async_tx_descriptor *desc;
 	unsigned long flags = DMA_CTRL_ACK;
+	unsigned long lock_flags;
+	unsigned int period_len = 0;
 	int index = 0;
 	long ret = AUDIO_SUCCESS;
 
@@ -485,7 +809,9 @@ static long dsp_create_dma_chan(struct audio_route *route)
 	}else{
 		manage->sample_size = route->channel*format_to_bytes(route->format);
 	}
-	manage->fragment_size = (route->rate / 100) * manage->sample_size * fragment_time;
+	route->frag_ms = dsp_route_fragment_ms(dsp, route);
+	route->period_count = 0;
+	manage->fragment_size = (route->rate / 100) * manage->sample_size * (route->frag_ms / 10);
 	if(route->index == AUDIO_ROUTE_AEC_ID){
 		parent = route->parent;
 		manage->fragment_cnt = parent->manage.fragment_cnt;
@@ -510,13 +836,31 @@ static long dsp_create_dma_chan(struct audio_route *route)
 	manage->buffersize = manage->fragment_cnt * manage->fragment_size;
 	memset(pipe->vaddr, 0, manage->buffersize);
 	dma_sync_single_for_device(NULL, pipe->paddr, manage->buffersize, DMA_TO_DEVICE);
+	dsp_mmap_reset(dsp, route);
 
 	dmaengine_slave_config(pipe->dma_chan, &pipe->dma_config);
 
+	/*
+	 * One interrupt per wakeup period, cut down to divide the ring. AEC is
+	 * only enabled beside AMIC and is sampled from the mic's callbacks, so
+	 * its channel raises none.
+	 */
+	route->dma_irq = false;
+	route->dma_period_frags = 0;
+	period_len = manage->buffersize;
+	if(dma_period_irq && route->index != AUDIO_ROUTE_AEC_ID){
+		spin_lock_irqsave(&dsp->slock, lock_flags);
+		route->dma_period_frags = dsp_route_period_frags(dsp, route);
+		spin_unlock_irqrestore(&dsp->slock, lock_flags);
+		while(manage->fragment_cnt % route->dma_period_frags)
+			route->dma_period_frags--;
+		period_len = route->dma_period_frags * manage->fragment_size;
+		flags |= DMA_PREP_INTERRUPT;
+	}
 	desc = pipe->dma_chan->device->device_prep_dma_cyclic(pipe->dma_chan,
 			pipe->paddr,
 			manage->buffersize,
-			manage->buffersize,
+			period_len,
 			pipe->dma_config.direction,
 			flags);
 
@@ -525,6 +869,10 @@ static long dsp_create_dma_chan(struct audio_route *route)
 		ret = -EINVAL;
 		goto out;
 	}
+	if(route->dma_period_frags){
+		desc->callback = dsp_dma_period_callback;
+		desc->callback_param = route;
+	}
 	dmaengine_submit(desc);
 out:
 	return ret;
@@ -542,6 +890,7 @@ static int dsp_destroy_dma_chan(struct audio_route *route)
 	manage = &route->manage;
 	pipe = route->pipe;
 	dmaengine_terminate_all(pipe->dma_chan);
+	((struct audio_dsp_device *)route->priv)->mmap_status->routes[route->index].state = AUDIO_OPEN_STATE;
 
 	/* destroy fragments manage */
 	if(manage->fragments){
@@ -619,6 +968,7 @@ static long dsp_enable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 	aec_route->refcnt++;
 	init_completion(&(ai_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_timer_kick(dsp);
 	mutex_unlock(&ai_route->mlock);
 	return ret;
 out_cmd:
@@ -753,6 +1103,7 @@ static long dsp_enable_dmic_ai(struct audio_dsp_device *dsp)
 	ai_route->refcnt++;
 	init_completion(&(ai_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_timer_kick(dsp);
 
 	mutex_unlock(&ai_route->mlock);
 	return ret;
@@ -918,6 +1269,7 @@ static long dsp_enable_amic_ao(struct audio_dsp_device *dsp)
 	ao_route->refcnt++;
 	init_completion(&(ao_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_timer_kick(dsp);
 	mutex_unlock(&ao_route->mlock);
 	return ret;
 out_cmd:
@@ -1140,7 +1492,43 @@ exit:
 	return ret;
 }
 
-static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_index index, unsigned long arg)
+/*
+ * Bytes a capture route has ready, or room a playback route has, counted
+ * the way the stream ioctls (or, when mapped, the application) consume them.
+ */
+static unsigned int dsp_route_avail(struct audio_route *route)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	int fill = 0;
+
+	if(route->state != AUDIO_BUSY_STATE || manage->fragment_cnt == 0)
+		return 0;
+
+	if(atomic_read(&route->mmap_cnt)){
+		fill = route->appl_ptr - route->hw_ptr;
+		if(route->index != AUDIO_ROUTE_SPK_ID)
+			fill = -fill;
+		if(fill < 0)
+			fill = 0;
+		if(fill > manage->buffersize)
+			fill = manage->buffersize;
+		return route->index == AUDIO_ROUTE_SPK_ID ? manage->buffersize - fill : fill;
+	}
+
+	return ((manage->dma_tracer + manage->fragment_cnt - manage->io_tracer - 1) % manage->fragment_cnt)
+		* manage->fragment_size;
+}
+
+static bool dsp_route_ready(struct audio_route *route)
+{
+	unsigned int watermark = route->poll_watermark;
+
+	if(watermark == 0)
+		watermark = route->manage.fragment_size;
+	return route->state == AUDIO_BUSY_STATE && dsp_route_avail(route) >= watermark;
+}
+
+static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_index index, unsigned long arg, bool nonblock)
 {
 	struct audio_route *ai_route = NULL;
 	struct audio_route *aec_route = NULL;
@@ -1176,6 +1564,11 @@ static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_in
 		goto out;
 	}
 
+	if(atomic_read(&ai_route->mmap_cnt)){
+		ret = -EBUSY;
+		goto out;
+	}
+
 	ret = copy_from_user(&stream, (__user void*)arg, sizeof(stream));
 	if(ret){
 		audio_warn_print("%d: failed to copy_from_user!\n", __LINE__);
@@ -1199,6 +1592,10 @@ static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_in
 			goto out;
 		}
 	}
+	if(nonblock && dsp_route_avail(ai_route) < cnt * manage->fragment_size){
+		ret = -EAGAIN;
+		goto out;
+	}
 again:
 	if(ai_route->state != AUDIO_BUSY_STATE)
 		goto out;
@@ -1255,7 +1652,155 @@ exit:
 	return ret;
 }
 
-static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg)
+/* Interleave one mic fragment and its reference into an audio_aec_block */
+static void dsp_fill_aec_block(struct audio_route *ai_route, struct audio_route *aec_route,
+		struct dsp_data_fragment *fragment, void *block)
+{
+	struct audio_aec_block *hdr = block;
+	struct dsp_data_fragment *aec_fragment = fragment->priv;
+	unsigned int mic_size = ai_route->manage.sample_size;
+	unsigned int ref_size = aec_route->manage.sample_size;
+	unsigned char *dst = (unsigned char *)(hdr + 1);
+	unsigned char *mic = fragment->vaddr;
+	unsigned char *ref = aec_fragment ? aec_fragment->vaddr : NULL;
+	unsigned int frame = 0;
+
+	hdr->tstamp = fragment->tstamp;
+	hdr->offset = ai_route->aec_sample_offset;
+	hdr->mic_channel = ai_route->channel;
+	hdr->ref_channel = 1;
+	hdr->frames = ai_route->manage.fragment_size / mic_size;
+	hdr->flags = 0;
+
+	if(!fragment->state){
+		hdr->flags = AUDIO_AEC_BLOCK_EMPTY | AUDIO_AEC_BLOCK_NOREF;
+		memset(dst, 0, hdr->frames * (mic_size + ref_size));
+		return;
+	}
+	if(!ref)
+		hdr->flags |= AUDIO_AEC_BLOCK_NOREF;
+
+	for(frame = 0; frame < hdr->frames; frame++){
+		memcpy(dst, mic, mic_size);
+		dst += mic_size;
+		mic += mic_size;
+		if(ref){
+			memcpy(dst, ref, ref_size);
+			ref += ref_size;
+		}else
+			memset(dst, 0, ref_size);
+		dst += ref_size;
+	}
+	dma_sync_single_for_device(NULL, fragment->paddr, ai_route->manage.fragment_size, DMA_FROM_DEVICE);
+	if(aec_fragment)
+		dma_sync_single_for_device(NULL, aec_fragment->paddr, aec_route->manage.fragment_size, DMA_FROM_DEVICE);
+}
+
+static long dsp_get_aec_frames(struct audio_dsp_device *dsp, unsigned long arg, bool nonblock)
+{
+	struct audio_route *ai_route = NULL;
+	struct audio_route *aec_route = NULL;
+	struct audio_aec_stream stream;
+	struct dsp_data_manage *manage = NULL;
+	struct dsp_data_fragment *fragment = NULL;
+	unsigned int dma_tracer = 0;
+	unsigned int io_tracer = 0;
+	unsigned int block_size = 0;
+	unsigned long time = 0;
+	void *block = NULL;
+	int cnt = 0, i = 0;
+	long ret = AUDIO_SUCCESS;
+
+	if(copy_from_user(&stream, (__user void*)arg, sizeof(stream)))
+		return -EFAULT;
+	if(stream.index != AUDIO_ROUTE_AMIC_ID && stream.index != AUDIO_ROUTE_DMIC_ID)
+		return -EINVAL;
+
+	ai_route = &(dsp->routes[stream.index]);
+	aec_route = &(dsp->routes[AUDIO_ROUTE_AEC_ID]);
+
+	mutex_lock(&ai_route->stream_mlock);
+	mutex_lock(&ai_route->mlock);
+	if(ai_route->state != AUDIO_BUSY_STATE || aec_route->state != AUDIO_BUSY_STATE
+			|| !(stream.index == AUDIO_ROUTE_AMIC_ID ? dsp->amic_aec : dsp->dmic_aec)){
+		audio_warn_print("%d: please enable mic and aec firstly!\n", __LINE__);
+		ret = -EPERM;
+		goto out;
+	}
+	if(atomic_read(&ai_route->mmap_cnt)){
+		ret = -EBUSY;
+		goto out;
+	}
+
+	manage = &(ai_route->manage);
+	block_size = sizeof(struct audio_aec_block) + (manage->fragment_size / manage->sample_size)
+		* (manage->sample_size + aec_route->manage.sample_size);
+	stream.block_size = block_size;
+	if(copy_to_user((__user void*)arg, &stream, sizeof(stream))){
+		ret = -EFAULT;
+		goto out;
+	}
+	cnt = stream.size / block_size;
+	if(cnt == 0)
+		goto out;
+	if(IS_ERR_OR_NULL(stream.data)){
+		ret = -EINVAL;
+		goto out;
+	}
+	if(nonblock && dsp_route_avail(ai_route) < cnt * manage->fragment_size){
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	block = pr_kmalloc(block_size);
+	if(block == NULL){
+		ret = -ENOMEM;
+		goto out;
+	}
+again:
+	if(ai_route->state != AUDIO_BUSY_STATE)
+		goto out;
+
+	dma_tracer = manage->dma_tracer;
+	io_tracer = manage->io_tracer;
+	while(i < cnt){
+		if(io_tracer+1 == dma_tracer || (dma_tracer==0 && io_tracer==manage->fragment_cnt-1))
+			break;
+		fragment = &(manage->fragments[io_tracer]);
+		dsp_fill_aec_block(ai_route, aec_route, fragment, block);
+		if(copy_to_user(stream.data + i * block_size, block, block_size)){
+			ret = -EFAULT;
+			break;
+		}
+		fragment->state = false;
+		fragment->priv = NULL;
+		i++;
+		io_tracer = (io_tracer + 1) % manage->fragment_cnt;
+	}
+	manage->io_tracer = io_tracer;
+	if(ret == AUDIO_SUCCESS && i < cnt){
+		ai_route->wait_flag = true;
+		ai_route->wait_cnt = cnt - i - 1;
+		mutex_unlock(&ai_route->mlock);
+		time = wait_for_completion_timeout(&ai_route->done_completion, msecs_to_jiffies(800));
+		if(!time){
+			audio_err_print("get aec frames timeout!\n");
+			ret = -ETIMEDOUT;
+			goto exit;
+		}
+		mutex_lock(&ai_route->mlock);
+		goto again;
+	}
+out:
+	mutex_unlock(&ai_route->mlock);
+exit:
+	if(block)
+		pr_kfree(block);
+	mutex_unlock(&ai_route->stream_mlock);
+	return ret;
+}
+
+static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg, bool nonblock)
 {
 	struct audio_route *ao_route = NULL;
 	int cnt = 0, i = 0;
@@ -1288,6 +1833,11 @@ static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg)
 		goto out;
 	}
 
+	if(atomic_read(&ao_route->mmap_cnt)){
+		ret = -EBUSY;
+		goto out;
+	}
+
 	ret = copy_from_user(&stream, (__user void*)arg, sizeof(stream));
 	if(ret){
 		audio_warn_print("%d: failed to copy_from_user!\n", __LINE__);
@@ -1302,6 +1852,10 @@ static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg)
 	}
 	manage = &(ao_route->manage);
 	cnt = stream.size / manage->fragment_size;
+	if(nonblock && dsp_route_avail(ao_route) < cnt * manage->fragment_size){
+		ret = -EAGAIN;
+		goto out;
+	}
 again:
 	if(ao_route->state != AUDIO_BUSY_STATE)
 		goto out;
@@ -1342,6 +1896,21 @@ exit:
 	return ret;
 }
 
+/* A closed node no longer holds the period down */
+static void dsp_drop_fragment_requests(struct audio_dsp_device *dsp, struct file *file)
+{
+	unsigned long lock_flags;
+	int id = 0, i = 0;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++)
+		for(i = 0; i < AUDIO_FRAGMENT_REQ_MAX; i++)
+			if(dsp->routes[id].frag_req[i].file == file)
+				dsp->routes[id].frag_req[i].file = NULL;
+	dsp_update_period(dsp);
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+}
+
 static int disable_route_stream(struct audio_route *route)
 {
 	int ret = AUDIO_SUCCESS;
@@ -1402,12 +1971,9 @@ static int dsp_open(struct inode *inode, struct file *file)
 		}
 	}
 
-	/* enable hrtimer */
-	if(atomic_read(&dsp->timer_stopped)){
-		atomic_set(&dsp->timer_stopped, 0);
-		hrtimer_start(&dsp->hr_timer, dsp->expires , HRTIMER_MODE_REL);
-		dsp->refcnt++;
-	}
+	/* the hrtimer is armed by the first route enabled */
+	atomic_set(&dsp->timer_stopped, 0);
+	dsp->refcnt++;
 	dsp->state = AUDIO_OPEN_STATE;
 	mutex_unlock(&dsp->mlock);
 	return 0;
@@ -1432,6 +1998,8 @@ static int dsp_release(struct inode *inode, struct file *file)
 	struct audio_route *route = NULL;
 	int index = 0;
 
+	dsp_drop_fragment_requests(dsp, file);
+
 	mutex_lock(&dsp->mlock);
 	if(dsp->refcnt == 0)
 		goto out;
@@ -1468,6 +2036,183 @@ static ssize_t dsp_write(struct file *file, const char __user * buffer, size_t c
 }
 
 
+static long dsp_mmap_sync_ptr(struct audio_dsp_device *dsp, struct file *file, unsigned long arg)
+{
+	struct audio_mmap_sync sync;
+	struct audio_route *route = NULL;
+	unsigned long lock_flags;
+
+	if(copy_from_user(&sync, (__user void*)arg, sizeof(sync)))
+		return -EFAULT;
+	if(sync.index >= AUDIO_ROUTE_MAX_ID)
+		return -EINVAL;
+	/* only an open that may map the ring may move its application pointer, see dsp_mmap() */
+	if(!(file->f_mode & (sync.index == AUDIO_ROUTE_SPK_ID ? FMODE_WRITE : FMODE_READ)))
+		return -EACCES;
+
+	route = &(dsp->routes[sync.index]);
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->appl_ptr = sync.appl_ptr;
+	dsp->mmap_status->routes[sync.index].appl_ptr = sync.appl_ptr;
+	sync.hw_ptr = route->hw_ptr;
+	sync.xruns = route->xruns;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	if(copy_to_user((__user void*)arg, &sync, sizeof(sync)))
+		return -EFAULT;
+	return 0;
+}
+
+static void dsp_vm_open(struct vm_area_struct *vma)
+{
+	struct audio_route *route = vma->vm_private_data;
+
+	atomic_inc(&route->mmap_cnt);
+}
+
+static void dsp_vm_close(struct vm_area_struct *vma)
+{
+	struct audio_route *route = vma->vm_private_data;
+
+	atomic_dec(&route->mmap_cnt);
+}
+
+static const struct vm_operations_struct dsp_vm_ops = {
+	.open = dsp_vm_open,
+	.close = dsp_vm_close,
+};
+
+static int dsp_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct miscdevice *dev = file->private_data;
+	struct audio_dsp_device *dsp = misc_get_audiodsp(dev);
+	struct audio_route *route = NULL;
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int index = 0;
+
+	if(offset == AUDIO_MMAP_STATUS_OFFSET){
+		if(size > PAGE_SIZE || (vma->vm_flags & VM_WRITE))
+			return -EINVAL;
+		vma->vm_flags &= ~VM_MAYWRITE;
+		return remap_pfn_range(vma, vma->vm_start, virt_to_phys(dsp->mmap_status) >> PAGE_SHIFT,
+				size, vma->vm_page_prot);
+	}
+
+	for(index = 0; index < AUDIO_ROUTE_MAX_ID; index++)
+		if(offset == AUDIO_MMAP_RING_OFFSET(index))
+			break;
+	if(index == AUDIO_ROUTE_MAX_ID)
+		return -EINVAL;
+
+	route = &(dsp->routes[index]);
+	if(route->pipe == NULL || route->pipe->vaddr == NULL || size > route->pipe->reservesize)
+		return -EINVAL;
+
+	/* capture rings are read-only, the speaker ring needs a writer */
+	if(index == AUDIO_ROUTE_SPK_ID){
+		if(!(file->f_mode & FMODE_WRITE))
+			return -EACCES;
+	}else{
+		if(!(file->f_mode & FMODE_READ) || (vma->vm_flags & VM_WRITE))
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	if(remap_pfn_range(vma, vma->vm_start, route->pipe->paddr >> PAGE_SHIFT,
+				size, vma->vm_page_prot))
+		return -EAGAIN;
+
+	vma->vm_private_data = route;
+	vma->vm_ops = &dsp_vm_ops;
+	dsp_vm_open(vma);
+	return 0;
+}
+
+static unsigned int dsp_poll(struct file *file, poll_table *wait)
+{
+	struct miscdevice *dev = file->private_data;
+	struct audio_dsp_device *dsp = misc_get_audiodsp(dev);
+	unsigned int mask = 0;
+
+	poll_wait(file, &dsp->poll_wait, wait);
+
+	if(file->f_mode & FMODE_READ){
+		if(dsp_route_ready(&dsp->routes[AUDIO_ROUTE_AMIC_ID])
+				|| dsp_route_ready(&dsp->routes[AUDIO_ROUTE_DMIC_ID]))
+			mask |= POLLIN | POLLRDNORM;
+	}
+	if(file->f_mode & FMODE_WRITE){
+		if(dsp_route_ready(&dsp->routes[AUDIO_ROUTE_SPK_ID]))
+			mask |= POLLOUT | POLLWRNORM;
+	}
+	return mask;
+}
+
+static long dsp_set_watermark(struct audio_dsp_device *dsp, unsigned long arg)
+{
+	struct audio_watermark watermark;
+	struct audio_route *route = NULL;
+
+	if(copy_from_user(&watermark, (__user void*)arg, sizeof(watermark)))
+		return -EFAULT;
+	if(watermark.index >= AUDIO_ROUTE_MAX_ID)
+		return -EINVAL;
+
+	route = &(dsp->routes[watermark.index]);
+	mutex_lock(&route->mlock);
+	route->poll_watermark = watermark.bytes;
+	mutex_unlock(&route->mlock);
+	wake_up_interruptible(&dsp->poll_wait);
+	return 0;
+}
+
+static long dsp_set_fragment(struct audio_dsp_device *dsp, struct file *file, unsigned long arg)
+{
+	struct audio_fragment fragment;
+	struct audio_route *route = NULL;
+	struct dsp_fragment_request *req = NULL;
+	unsigned long lock_flags;
+	long ret = 0;
+	int i = 0;
+
+	if(copy_from_user(&fragment, (__user void*)arg, sizeof(fragment)))
+		return -EFAULT;
+	if(fragment.index >= AUDIO_ROUTE_MAX_ID)
+		return -EINVAL;
+	fragment.time_ms = roundup(fragment.time_ms, 10);
+
+	route = &(dsp->routes[fragment.index]);
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	for(i = 0; i < AUDIO_FRAGMENT_REQ_MAX; i++){
+		if(route->frag_req[i].file == file){
+			req = &route->frag_req[i];
+			break;
+		}
+		if(req == NULL && route->frag_req[i].file == NULL)
+			req = &route->frag_req[i];
+	}
+	if(req == NULL){
+		ret = -EBUSY;
+	}else if(fragment.time_ms){
+		req->file = file;
+		req->time_ms = fragment.time_ms;
+	}else if(req->file == file){
+		req->file = NULL;
+	}
+	/* a shorter period than the channel interrupts at needs the timer */
+	__dsp_timer_kick(dsp);
+	fragment.fragment_ms = route->frag_ms;
+	fragment.period_ms = route->state == AUDIO_BUSY_STATE ? route->period_frags * route->frag_ms : 0;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	if(ret == 0 && copy_to_user((__user void*)arg, &fragment, sizeof(fragment)))
+		ret = -EFAULT;
+	return ret;
+}
+
 static long dsp_route_ioctl(struct audio_dsp_device *dsp, enum auido_route_index index,
 						unsigned int cmd, void *arg)
 {
@@ -1608,13 +2353,25 @@ static long dsp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = dsp_disable_amic_ao(dsp);
 			break;
 		case AMIC_AI_GET_STREAM:
-			ret = dsp_get_mic_stream(dsp, AUDIO_ROUTE_AMIC_ID, arg);
+			ret = dsp_get_mic_stream(dsp, AUDIO_ROUTE_AMIC_ID, arg, file->f_flags & O_NONBLOCK);
 			break;
 		case DMIC_AI_GET_STREAM:
-			ret = dsp_get_mic_stream(dsp, AUDIO_ROUTE_DMIC_ID, arg);
+			ret = dsp_get_mic_stream(dsp, AUDIO_ROUTE_DMIC_ID, arg, file->f_flags & O_NONBLOCK);
 			break;
 		case AMIC_AO_SET_STREAM:
-			ret = dsp_set_spk_stream(dsp, arg);
+			ret = dsp_set_spk_stream(dsp, arg, file->f_flags & O_NONBLOCK);
+			break;
+		case AUDIO_SET_WATERMARK:
+			ret = dsp_set_watermark(dsp, arg);
+			break;
+		case AUDIO_AI_GET_AEC_FRAMES:
+			ret = dsp_get_aec_frames(dsp, arg, file->f_flags & O_NONBLOCK);
+			break;
+		case AUDIO_SET_FRAGMENT:
+			ret = dsp_set_fragment(dsp, file, arg);
+			break;
+		case AUDIO_MMAP_SYNC_PTR:
+			ret = dsp_mmap_sync_ptr(dsp, file, arg);
 			break;
 		case AMIC_AI_HPF_ENABLE:
 			if (get_user(channel, (int*)arg)){
@@ -1717,6 +2474,8 @@ const struct file_operations audio_dsp_fops = {
 	.write = dsp_write,
 	.open = dsp_open,
 	.unlocked_ioctl = dsp_ioctl,
+	.poll = dsp_poll,
+	.mmap = dsp_mmap,
 	.release = dsp_release,
 };
 
@@ -1779,6 +2538,43 @@ int register_audio_debug_ops(char *name, struct file_operations *debug_ops, void
 	return AUDIO_SUCCESS;
 }
 
+static int audio_dsp_show(struct seq_file *m, void *v)
+{
+	struct audio_dsp_device *dsp = m->private;
+	static const char *names[AUDIO_ROUTE_MAX_ID] = {"amic", "dmic", "spk", "aec"};
+	struct audio_route *route = NULL;
+	int index = 0;
+
+	seq_printf(m, "timer wakeups : %u (%s)\n", dsp->timer_wakeups, dsp->timer_running ? "running" : "stopped");
+	seq_printf(m, "timer period : %lld ms\n", ktime_to_ms(dsp->expires));
+	seq_printf(m, "%-6s %-6s %-8s %8s %10s %12s %12s %8s\n", "route", "state", "tracking",
+			"frag_ms", "period_ms", "irq_wakeups", "timer_wakeups", "xruns");
+	for(index = 0; index < AUDIO_ROUTE_MAX_ID; index++){
+		route = &(dsp->routes[index]);
+		if(route->pipe == NULL)
+			continue;
+		seq_printf(m, "%-6s %-6s %-8s %8u %10u %12u %12u %8u\n", names[index],
+				route->state == AUDIO_BUSY_STATE ? "busy" : "idle",
+				dsp_route_paired_aec(dsp, route) ? "mic" : route->dma_irq ? "irq" : "timer",
+				route->frag_ms,
+				route->state == AUDIO_BUSY_STATE ? route->period_frags * route->frag_ms : 0,
+				route->irq_wakeups, route->timer_wakeups, route->xruns);
+	}
+	return 0;
+}
+
+static int audio_dsp_open(struct inode *inode, struct file *file)
+{
+	return single_open_size(file, audio_dsp_show, PDE_DATA(inode), 1024);
+}
+
+static struct file_operations audio_dsp_debug_fops = {
+	.read = seq_read,
+	.open = audio_dsp_open,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 extern struct platform_driver audio_aic_driver;
 extern struct platform_driver audio_dmic_driver;
 
@@ -1795,6 +2591,13 @@ static int audio_dsp_probe(struct platform_device *pdev)
 		goto exit;
 	}
 
+	dspdev->mmap_status = (struct audio_mmap_status *)get_zeroed_page(GFP_KERNEL);
+	if (!dspdev->mmap_status) {
+		ret = -ENOMEM;
+		goto failed_mmap_status;
+	}
+	SetPageReserved(virt_to_page(dspdev->mmap_status));
+
 	/* init self */
 	spin_lock_init(&dspdev->slock);
 	mutex_init(&dspdev->mlock);
@@ -1814,12 +2617,14 @@ static int audio_dsp_probe(struct platform_device *pdev)
 		audio_err_print("Failed to create debug directory of tx-isp!\n");
 		goto failed_to_proc;
 	}
+	proc_create_data("audio_dsp_info", S_IRUGO, dspdev->proc, &audio_dsp_debug_fops, dspdev);
 
 	atomic_set(&dspdev->timer_stopped, 1);
 	hrtimer_init(&dspdev->hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	dspdev->hr_timer.function = jz_audio_hrtimer_callback;
 	dspdev->expires = ns_to_ktime(1000*1000*fragment_time*10*2);	// the time section is default 40ms.
 	INIT_WORK(&dspdev->workqueue, dsp_workqueue_handle);
+	init_waitqueue_head(&dspdev->poll_wait);
 
 	globe_dspdev = dspdev;
 	/* register subdev,AIC & DMIC*/
@@ -1845,6 +2650,9 @@ static int audio_dsp_probe(struct platform_device *pdev)
 failed_to_proc:
 	misc_deregister(&dspdev->miscdev);
 failed_misc_register:
+	ClearPageReserved(virt_to_page(dspdev->mmap_status));
+	free_page((unsigned long)dspdev->mmap_status);
+failed_mmap_status:
 	kfree(dspdev);
 exit:
 	return ret;
@@ -1873,6 +2681,8 @@ static int __exit audio_dsp_remove(struct platform_device *pdev)
 	cancel_work_sync(&dspdev->workqueue);
 	platform_set_drvdata(pdev, NULL);
 
+	ClearPageReserved(virt_to_page(dspdev->mmap_status));
+	free_page((unsigned long)dspdev->mmap_status);
 	kfree(dspdev);
 	globe_dspdev = NULL;
 	return 0;
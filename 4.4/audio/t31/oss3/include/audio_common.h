@@ -55,6 +55,7 @@ struct dsp_data_fragment {
 	void 				*vaddr;
 	dma_addr_t          paddr;
 	void *priv;			/* when enable aec function, it points aec fragment */
+	s64 tstamp;			/* capture time of the first sample, ns of CLOCK_MONOTONIC */
 };
 
 #define DSP_NEXT_FRAGMENT(x) ((x)==NULL ? NULL : container_of((x)->list.next, struct dsp_data_fragment, list))
@@ -75,6 +75,119 @@ struct audio_parameter {
 #define AMIC_SPK_SET_MUTE	    	_SIOR ('P', 77, struct channel_mute)
 #define AMIC_AI_SET_ALC_GAIN	    	_SIOR ('P', 76, struct alc_gain)
 #define AMIC_AI_GET_ALC_GAIN	    	_SIOR ('P', 75, struct alc_gain)
+#define AUDIO_MMAP_SYNC_PTR			_SIOR ('P', 74, struct audio_mmap_sync)
+#define AUDIO_SET_WATERMARK			_SIOR ('P', 73, struct audio_watermark)
+#define AUDIO_AI_GET_AEC_FRAMES		_SIOR ('P', 72, struct audio_aec_stream)
+#define AUDIO_SET_FRAGMENT			_SIOR ('P', 71, struct audio_fragment)
+
+/*
+ * poll() on a node opened O_RDONLY gives POLLIN when AMIC or DMIC has at
+ * least the watermark ready (AEC data comes with AMIC); on a node opened
+ * O_WRONLY it gives POLLOUT when SPK has that much room. The watermark is
+ * in bytes, 0 means one fragment. With O_NONBLOCK the GET_STREAM and
+ * SET_STREAM ioctls fail with -EAGAIN instead of waiting for the rest of
+ * the request.
+ */
+struct audio_watermark {
+	unsigned int index;			/* enum auido_route_index */
+	unsigned int bytes;
+};
+
+/*
+ * Combined capture. The mic route and the AEC reference are sampled from
+ * the same dma pointer snapshot, and every fragment comes out as one block:
+ * a struct audio_aec_block followed by frames interleaved as
+ * {mic channels..., ref channels...}. tstamp is when the first frame of
+ * the block was captured, derived from the dma position at the snapshot,
+ * or 0 if the pointer had not been sampled since the route was enabled.
+ * offset is the fixed ref-to-mic skew in samples, see aec_sample_offset.
+ * size must hold a whole number of blocks; use block_size from the first
+ * call (size 0 only fills it in).
+ */
+#define AUDIO_AEC_BLOCK_EMPTY		(1 << 0)	/* the dma overtook the reader, all zero */
+#define AUDIO_AEC_BLOCK_NOREF		(1 << 1)	/* no reference for this block, ref is zero */
+
+struct audio_aec_block {
+	long long tstamp;
+	int offset;
+	unsigned short mic_channel;
+	unsigned short ref_channel;
+	unsigned int frames;
+	unsigned int flags;
+};
+
+/*
+ * Per-open latency request, in the spirit of SNDCTL_DSP_SETFRAGMENT.
+ * time_ms is rounded up to 10 ms; 0 drops the request, and so does closing
+ * the node. Capture routes (AMIC, DMIC, AEC) share one fragment length.
+ * The shortest request among current opens sets the wakeup period at once;
+ * the fragment length of the ring follows it the next time the route is
+ * enabled, up to AUDIO_FRAGMENT_MAX_MS. With no request the period is
+ * two fragments of the fragment_time module parameter.
+ */
+#define AUDIO_FRAGMENT_MAX_MS		60
+#define AUDIO_FRAGMENT_REQ_MAX		8
+
+struct audio_fragment {
+	unsigned int index;			/* enum auido_route_index */
+	unsigned int time_ms;
+	unsigned int fragment_ms;	/* returned */
+	unsigned int period_ms;		/* returned, 0 while the route is stopped */
+};
+
+struct audio_aec_stream {
+	unsigned int index;			/* AUDIO_ROUTE_AMIC_ID or AUDIO_ROUTE_DMIC_ID */
+	void __user *data;
+	unsigned int size;
+	unsigned int block_size;	/* returned */
+};
+
+/*
+ * Zero-copy mode. mmap() at AUDIO_MMAP_STATUS_OFFSET gives a read-only
+ * page with a struct audio_mmap_status, and at AUDIO_MMAP_RING_OFFSET(index)
+ * the DMA ring of that route: read-only for AMIC, DMIC and AEC on a node
+ * opened O_RDONLY, writable for SPK on a node opened O_WRONLY. Both are
+ * uncached, so no cache maintenance is needed on either side.
+ *
+ * hw_ptr and appl_ptr count bytes since the route was enabled and wrap at
+ * 2^32; the ring offset of a pointer is ptr % buffersize. The application
+ * reports how far it has read or written with AUDIO_MMAP_SYNC_PTR, which is
+ * what overruns (capture) and underruns (playback) are counted against;
+ * like the ring itself, that needs FMODE_READ for capture routes and
+ * FMODE_WRITE for SPK, and fails with -EACCES otherwise. While a route's ring is mapped, its GET_STREAM/SET_STREAM ioctl fails
+ * with -EBUSY and the driver no longer silences played SPK fragments.
+ */
+#define AUDIO_MMAP_STATUS_OFFSET		0
+#define AUDIO_MMAP_RING_OFFSET(index)	(((index) + 1) << 20)
+
+struct audio_mmap_route {
+	unsigned int state;			/* enum audio_state */
+	unsigned int rate;
+	unsigned int channel;
+	unsigned int format;
+	unsigned int fragment_size;
+	unsigned int fragment_cnt;
+	unsigned int buffersize;
+	unsigned int hw_ptr;
+	unsigned int appl_ptr;		/* as last reported by AUDIO_MMAP_SYNC_PTR */
+	unsigned int xruns;
+};
+
+struct audio_mmap_status {
+	struct audio_mmap_route routes[AUDIO_ROUTE_MAX_ID];
+};
+
+struct audio_mmap_sync {
+	unsigned int index;			/* enum auido_route_index */
+	unsigned int appl_ptr;
+	unsigned int hw_ptr;		/* returned */
+	unsigned int xruns;			/* returned */
+};
+
+struct dsp_fragment_request {
+	struct file *file;
+	unsigned int time_ms;
+};
 
 struct audio_route {
 	enum auido_route_index index;
@@ -98,6 +211,28 @@ struct audio_route {
 	unsigned int wait_cnt;
 	bool wait_flag;
 	struct completion done_completion;
+
+	/* zero-copy mode, see AUDIO_MMAP_STATUS_OFFSET */
+	atomic_t mmap_cnt;
+	unsigned int hw_pos;					/* last dma offset in buffer */
+	unsigned int hw_ptr;
+	unsigned int appl_ptr;
+	unsigned int xruns;						/* io_late in copy mode too */
+	bool in_xrun;
+
+	/* pointer tracking */
+	bool dma_irq;							/* period callbacks seen since enable */
+	unsigned int dma_period_frags;			/* fragments per cyclic dma period, 0 without callbacks */
+	unsigned int irq_wakeups;
+	unsigned int timer_wakeups;
+	unsigned int poll_watermark;
+	s64 snap_tstamp;						/* when hw_pos was sampled */
+
+	/* fragment and wakeup period, requests are protected by dsp->slock */
+	unsigned int frag_ms;
+	unsigned int period_frags;
+	unsigned int period_count;
+	struct dsp_fragment_request frag_req[AUDIO_FRAGMENT_REQ_MAX];
 	struct audio_pipe *pipe;
 	void *parent;
 	void *priv;
@@ -117,12 +252,16 @@ struct audio_dsp_device {
 	struct hrtimer hr_timer;
 	ktime_t expires;
 	atomic_t	timer_stopped;
+	bool timer_running;						/* protected by slock */
+	unsigned int timer_wakeups;
 	struct work_struct workqueue;
+	wait_queue_head_t poll_wait;
 
 
 	struct audio_route routes[AUDIO_ROUTE_MAX_ID];
 	bool amic_aec;
 	bool dmic_aec;
+	struct audio_mmap_status *mmap_status;
 	/* debug parameters */
 	struct proc_dir_entry *proc;
 	void *priv;
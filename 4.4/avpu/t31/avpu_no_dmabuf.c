@@ -18,3 +18,9 @@ int avpu_dmabuf_get_address(struct device *dev, u32 fd, u32 *bus_address)
 	pr_err("dmabuf interface not supported");
 	return -EINVAL;
 }
+
+int avpu_dmabuf_check_range(u32 fd, u32 offset, u32 len)
+{
+	pr_err("dmabuf interface not supported");
+	return -EINVAL;
+}
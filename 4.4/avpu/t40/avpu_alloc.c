@@ -1,6 +1,8 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
 
 #include "avpu_alloc.h"
 
@@ -10,12 +12,142 @@ MODULE_AUTHOR("Sebastien Alaiwan");
 MODULE_AUTHOR("Antoine Gruzelle");
 MODULE_DESCRIPTION("JZ Common");
 
+static unsigned int dma_pool_kb = 16384;
+module_param(dma_pool_kb, uint, S_IRUGO);
+MODULE_PARM_DESC(dma_pool_kb, "Freed DMA buffers kept for reuse per device, in KiB");
+
+struct avpu_dma_pool {
+	spinlock_t lock;
+	struct list_head free;		/* most recently freed first */
+	u32 high_water;			/* bytes */
+	u32 cached;			/* bytes */
+	u32 hits;
+	u32 misses;
+	u32 evictions;
+};
+
+static void dma_buffer_release(struct device *dev, struct avpu_dma_buffer *buf)
+{
+	dma_free_coherent(dev, buf->size, buf->cpu_handle, buf->dma_handle);
+	kfree(buf);
+}
+
+static void avpu_dma_pool_release(struct device *dev, void *res)
+{
+	struct avpu_dma_pool *pool = res;
+	struct avpu_dma_buffer *buf, *n;
+
+	list_for_each_entry_safe(buf, n, &pool->free, pool)
+		dma_buffer_release(dev, buf);
+}
+
+static struct avpu_dma_pool *avpu_dma_pool_get(struct device *dev)
+{
+	return devres_find(dev, avpu_dma_pool_release, NULL, NULL);
+}
+
+/* The pool goes away with the device, after the driver has been removed */
+int avpu_dma_pool_init(struct device *dev, struct dentry *debugfs)
+{
+	struct avpu_dma_pool *pool;
+
+	pool = devres_alloc(avpu_dma_pool_release, sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return -ENOMEM;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free);
+	pool->high_water = dma_pool_kb * 1024;
+	devres_add(dev, pool);
+
+	if (!IS_ERR_OR_NULL(debugfs)) {
+		debugfs_create_u32("dma_pool_high_water", S_IRUGO | S_IWUSR,
+				   debugfs, &pool->high_water);
+		debugfs_create_u32("dma_pool_cached", S_IRUGO, debugfs,
+				   &pool->cached);
+		debugfs_create_u32("dma_pool_hits", S_IRUGO, debugfs,
+				   &pool->hits);
+		debugfs_create_u32("dma_pool_misses", S_IRUGO, debugfs,
+				   &pool->misses);
+		debugfs_create_u32("dma_pool_evictions", S_IRUGO, debugfs,
+				   &pool->evictions);
+	}
+
+	return 0;
+}
+
+static struct avpu_dma_buffer *avpu_dma_pool_take(struct device *dev,
+						  size_t size)
+{
+	struct avpu_dma_pool *pool = avpu_dma_pool_get(dev);
+	struct avpu_dma_buffer *buf;
+	unsigned long flags;
+
+	if (!pool)
+		return NULL;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_for_each_entry(buf, &pool->free, pool) {
+		if (buf->size == size) {
+			list_del(&buf->pool);
+			pool->cached -= size;
+			pool->hits++;
+			spin_unlock_irqrestore(&pool->lock, flags);
+			/* fresh coherent memory is zeroed, keep it that way */
+			memset(buf->cpu_handle, 0, size);
+			return buf;
+		}
+	}
+	pool->misses++;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	return NULL;
+}
+
+/* Returns 0 if the buffer was parked, or it is the caller's to release */
+static int avpu_dma_pool_put(struct device *dev, struct avpu_dma_buffer *buf)
+{
+	struct avpu_dma_pool *pool = avpu_dma_pool_get(dev);
+	struct avpu_dma_buffer *old, *n;
+	unsigned long flags;
+	LIST_HEAD(evicted);
+
+	if (!pool)
+		return -ENOENT;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (buf->size > pool->high_water) {
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return -ENOSPC;
+	}
+	/* make room by dropping the least recently freed buffers */
+	while (pool->cached + buf->size > pool->high_water) {
+		old = list_entry(pool->free.prev, struct avpu_dma_buffer, pool);
+		list_move(&old->pool, &evicted);
+		pool->cached -= old->size;
+		pool->evictions++;
+	}
+	list_add(&buf->pool, &pool->free);
+	pool->cached += buf->size;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	list_for_each_entry_safe(old, n, &evicted, pool)
+		dma_buffer_release(dev, old);
+
+	return 0;
+}
+
 struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 {
-	struct avpu_dma_buffer *buf =
-		kmalloc(sizeof(struct avpu_dma_buffer),
-			GFP_KERNEL);
+	struct avpu_dma_buffer *buf;
 
+	/* buffers are pooled by page count */
+	size = PAGE_ALIGN(size);
+	buf = avpu_dma_pool_take(dev, size);
+	if (buf)
+		return buf;
+
+	buf = kmalloc(sizeof(struct avpu_dma_buffer), GFP_KERNEL);
 	if (!buf)
 		return NULL;
 
@@ -34,10 +166,11 @@ struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 
 void avpu_free_dma(struct device *dev, struct avpu_dma_buffer *buf)
 {
-	if (buf)
-		dma_free_coherent(dev, buf->size, buf->cpu_handle,
-				  buf->dma_handle);
-	kfree(buf);
+	if (!buf)
+		return;
+
+	if (avpu_dma_pool_put(dev, buf))
+		dma_buffer_release(dev, buf);
 }
 
 
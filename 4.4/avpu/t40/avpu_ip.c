@@ -7,52 +7,164 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/wait.h>
 
 #include "avpu_ip.h"
 
+/*
+ * Several channels can be open at once, but the hardware and its
+ * interrupts belong to one of them at a time, codec->chan. A channel takes
+ * the hardware with avpu_codec_acquire_hw() for each frame and hands it on
+ * with avpu_codec_release_hw(). A channel that opens an idle codec owns it
+ * right away and keeps it until it releases it or closes, which is what
+ * single stream userspace has always relied on.
+ */
+
+/* Called with sched_lock held */
+static void avpu_codec_set_owner(struct avpu_codec_desc *codec,
+				 struct avpu_codec_chan *chan)
+{
+	unsigned long flags;
+	u32 lost;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	while (avpu_irq_pop(codec, &lost))
+		avpu_err("Previous channel lost irq:%x\n", lost);
+	codec->chan = chan;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	if (!chan)
+		return;
+
+	chan->granted = ktime_get();
+	chan->last_wait_us = ktime_us_delta(chan->granted, chan->queued);
+	if (chan->last_wait_us > chan->max_wait_us)
+		chan->max_wait_us = chan->last_wait_us;
+}
+
+/* Called with sched_lock held by the owner, passes the hardware on */
+static void avpu_codec_handoff(struct avpu_codec_desc *codec)
+{
+	struct avpu_codec_chan *chan = codec->chan;
+	struct avpu_codec_chan *next = NULL;
+	u32 us = ktime_us_delta(ktime_get(), chan->granted);
+
+	chan->jobs++;
+	chan->last_job_us = us;
+	chan->total_job_us += us;
+	if (us > chan->max_job_us)
+		chan->max_job_us = us;
+
+	if (!list_empty(&codec->waiters)) {
+		next = list_first_entry(&codec->waiters,
+					struct avpu_codec_chan, wait);
+		list_del_init(&next->wait);
+		codec->queue_depth--;
+	}
+	avpu_codec_set_owner(codec, next);
+	if (next)
+		wake_up_all(&codec->sched_wait);
+}
+
+int avpu_codec_acquire_hw(struct avpu_codec_chan *chan, int prio)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	struct avpu_codec_chan *pos;
+	int ret;
+
+	mutex_lock(&codec->sched_lock);
+	if (codec->chan == chan) {
+		mutex_unlock(&codec->sched_lock);
+		return 0;
+	}
+
+	chan->prio = prio;
+	chan->queued = ktime_get();
+	if (!codec->chan) {
+		avpu_codec_set_owner(codec, chan);
+		mutex_unlock(&codec->sched_lock);
+		return 0;
+	}
+
+	/* behind everything queued at the same or a higher priority */
+	list_for_each_entry(pos, &codec->waiters, wait)
+		if (pos->prio < prio)
+			break;
+	list_add_tail(&chan->wait, &pos->wait);
+	if (++codec->queue_depth > codec->max_queue_depth)
+		codec->max_queue_depth = codec->queue_depth;
+	mutex_unlock(&codec->sched_lock);
+
+	ret = wait_event_interruptible(codec->sched_wait,
+				       ACCESS_ONCE(codec->chan) == chan ||
+				       chan->unblock);
+
+	mutex_lock(&codec->sched_lock);
+	if (codec->chan == chan) {
+		/* granted while we were interrupted, keep it */
+		ret = 0;
+	} else {
+		list_del_init(&chan->wait);
+		codec->queue_depth--;
+		if (!ret)
+			ret = -EINTR;
+	}
+	mutex_unlock(&codec->sched_lock);
+
+	return ret;
+}
+
+int avpu_codec_release_hw(struct avpu_codec_chan *chan)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	int ret = 0;
+
+	mutex_lock(&codec->sched_lock);
+	if (codec->chan == chan)
+		avpu_codec_handoff(codec);
+	else
+		ret = -EPERM;
+	mutex_unlock(&codec->sched_lock);
+
+	return ret;
+}
+
 int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 			    struct inode *inode)
 {
 	struct avpu_codec_desc *codec;
 	unsigned long flags;
-	struct list_head *pos, *n;
-	struct r_irq *tmp;
-	int ret = 0;
 
 	codec = container_of(inode->i_cdev, struct avpu_codec_desc, cdev);
 
 	spin_lock_irqsave(&codec->i_lock, flags);
-
 	clk_enable(codec->clk);
 	clk_enable(codec->ahb1_gate);
 	clk_enable(codec->clk_gate);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
 
 	chan->codec = codec;
-	/* No mcu, there is a one for one mapping */
-	if (codec->chan != NULL) {
-		ret = -ENODEV;
-		goto unlock;
-	}
+	chan->pid = task_tgid_vnr(current);
+	INIT_LIST_HEAD(&chan->wait);
 
-	list_for_each_safe(pos, n, &codec->irq_masks) {
-		tmp = list_entry(pos, struct r_irq, list);
-		avpu_err("Previous channel lost irq:%x\n", tmp->bitfield);
-		list_del(pos);
-		kmem_cache_free(codec->cache, tmp);
+	mutex_lock(&codec->sched_lock);
+	list_add_tail(&chan->node, &codec->chans);
+	if (!codec->chan) {
+		chan->queued = ktime_get();
+		avpu_codec_set_owner(codec, chan);
 	}
+	mutex_unlock(&codec->sched_lock);
 
-	codec->chan = chan;
-
-unlock:
-	spin_unlock_irqrestore(&codec->i_lock, flags);
-	return ret;
-
+	return 0;
 }
 
 void avpu_codec_unbind_channel(struct avpu_codec_chan *chan)
@@ -61,15 +173,77 @@ void avpu_codec_unbind_channel(struct avpu_codec_chan *chan)
 	unsigned long flags;
 
 	codec = chan->codec;
-	spin_lock_irqsave(&codec->i_lock, flags);
 
+	mutex_lock(&codec->sched_lock);
+	if (codec->chan == chan) {
+		avpu_codec_handoff(codec);
+	} else if (!list_empty(&chan->wait)) {
+		list_del_init(&chan->wait);
+		codec->queue_depth--;
+	}
+	list_del(&chan->node);
+	mutex_unlock(&codec->sched_lock);
+
+	spin_lock_irqsave(&codec->i_lock, flags);
 	clk_disable(codec->clk);
 	clk_disable(codec->clk_gate);
 	clk_disable(codec->ahb1_gate);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+}
 
-	codec->chan = NULL;
+static int avpu_sched_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = m->private;
+	struct avpu_codec_chan *chan;
+	const char *state;
 
-	spin_unlock_irqrestore(&codec->i_lock, flags);
+	mutex_lock(&codec->sched_lock);
+	seq_printf(m, "queue depth %u, max %u\n",
+		   codec->queue_depth, codec->max_queue_depth);
+	seq_puts(m, "pid\tprio\tstate\tjobs\tlast_us\tmax_us\tavg_us\twait_us\tmax_wait_us\n");
+	list_for_each_entry(chan, &codec->chans, node) {
+		if (codec->chan == chan)
+			state = "run";
+		else if (!list_empty(&chan->wait))
+			state = "wait";
+		else
+			state = "idle";
+		seq_printf(m, "%d\t%d\t%s\t%u\t%u\t%u\t%llu\t%u\t%u\n",
+			   chan->pid, chan->prio, state, chan->jobs,
+			   chan->last_job_us, chan->max_job_us,
+			   chan->jobs ? div_u64(chan->total_job_us, chan->jobs) : 0,
+			   chan->last_wait_us, chan->max_wait_us);
+	}
+	mutex_unlock(&codec->sched_lock);
+
+	return 0;
+}
+
+static int avpu_sched_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_sched_show, inode->i_private);
+}
+
+static const struct file_operations avpu_sched_fops = {
+	.owner		= THIS_MODULE,
+	.open		= avpu_sched_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void avpu_codec_sched_init(struct avpu_codec_desc *codec)
+{
+	mutex_init(&codec->sched_lock);
+	INIT_LIST_HEAD(&codec->chans);
+	INIT_LIST_HEAD(&codec->waiters);
+	init_waitqueue_head(&codec->sched_wait);
+	codec->queue_depth = 0;
+	codec->max_queue_depth = 0;
+
+	if (!IS_ERR_OR_NULL(codec->debugfs))
+		debugfs_create_file("sched", S_IRUGO, codec->debugfs, codec,
+				    &avpu_sched_fops);
 }
 
 int avpu_codec_read_register(struct avpu_codec_chan *chan,
@@ -99,13 +273,51 @@ void avpu_codec_write_register(struct avpu_codec_chan *chan,
 
 }
 
+/*
+ * The hardirq handler is the only producer, so it fills the ring without
+ * allocating or locking. Consumers take i_lock among themselves.
+ */
+static void avpu_irq_push(struct avpu_codec_desc *codec, u32 bitfield)
+{
+	unsigned int head = codec->irq_head;
+
+	if (head - ACCESS_ONCE(codec->irq_tail) >= AVPU_IRQ_RING_SIZE) {
+		codec->irq_overflows++;
+		return;
+	}
+	codec->irq_ring[head & (AVPU_IRQ_RING_SIZE - 1)] = bitfield;
+	/* publish the entry before the index that covers it */
+	smp_wmb();
+	ACCESS_ONCE(codec->irq_head) = head + 1;
+}
+
+int avpu_irq_pending(struct avpu_codec_desc *codec)
+{
+	return ACCESS_ONCE(codec->irq_head) != codec->irq_tail;
+}
+
+/* Called with i_lock held */
+int avpu_irq_pop(struct avpu_codec_desc *codec, u32 *bitfield)
+{
+	unsigned int tail = codec->irq_tail;
+
+	if (ACCESS_ONCE(codec->irq_head) == tail)
+		return 0;
+	smp_rmb();
+	*bitfield = codec->irq_ring[tail & (AVPU_IRQ_RING_SIZE - 1)];
+	/* the slot is read before the producer may reuse it */
+	smp_mb();
+	ACCESS_ONCE(codec->irq_tail) = tail + 1;
+
+	return 1;
+}
+
 irqreturn_t avpu_hardirq_handler(int irq, void *data)
 {
 	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)data;
 	u32 unmasked_irq_bitfield, irq_bitfield;
 	u32 mask;
 	unsigned long flags;
-	struct r_irq *i_callback;
 	int callback_nb;
 	int i = 0;
 	int avpu_interrupt_nb = 20;
@@ -122,17 +334,8 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 
 	for (i = 0; i < avpu_interrupt_nb; ++i) {
 		callback_nb = 1U << i;
-		if (irq_bitfield & callback_nb) {
-			i_callback = kmem_cache_alloc(codec->cache, GFP_ATOMIC);
-			if (!i_callback) {
-				avpu_dbg("ENOMEM: Missed interrupt\n");
-				return IRQ_NONE;
-			}
-			i_callback->bitfield = i;
-			spin_lock_irqsave(&codec->i_lock, flags);
-			list_add_tail(&i_callback->list, &codec->irq_masks);
-			spin_unlock_irqrestore(&codec->i_lock, flags);
-		}
+		if (irq_bitfield & callback_nb)
+			avpu_irq_push(codec, i);
 	}
 
 	spin_lock_irqsave(&codec->i_lock, flags);
@@ -7,6 +7,9 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/clk.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
 
 #include "avpu_ioctl.h"
 #include "avpu_alloc.h"
@@ -41,21 +44,32 @@ struct dma_buf_info {
 	struct avpu_codec_desc *codec;
 };
 
-struct r_irq {
-	struct list_head list;
-	u32 bitfield;
-};
+/* Pending interrupt ring, must be a power of two */
+#define AVPU_IRQ_RING_SIZE 256
 
 struct avpu_codec_desc {
 	struct device *device;
 	void __iomem *regs;             /* Base addr for regs */
 	unsigned long regs_size;        /* end addr for regs */
 	struct cdev cdev;
-	/* one for one mapping in the no mcu case */
+	/* channel owning the hardware, changed under both locks below */
 	struct avpu_codec_chan *chan;
-	struct list_head irq_masks;
+	struct mutex sched_lock;
+	struct list_head chans;		/* every open channel */
+	struct list_head waiters;	/* by priority, then arrival */
+	wait_queue_head_t sched_wait;
+	u32 queue_depth;
+	u32 max_queue_depth;
 	spinlock_t i_lock;
-	struct kmem_cache *cache;
+	/* written by the hardirq handler only, consumers hold i_lock */
+	u32 irq_ring[AVPU_IRQ_RING_SIZE];
+	unsigned int irq_head;
+	unsigned int irq_tail;
+	u32 irq_overflows;
+	u32 reg_ioctls;			/* single register read/write ioctls */
+	u32 reg_batches;
+	u32 reg_batch_ops;
+	struct dentry *debugfs;
 	int minor;
 	struct clk          *clk;
 	struct clk          *clk_mux;
@@ -76,14 +90,33 @@ struct avpu_codec_chan {
 	struct list_head mem;
 	int num_bufs;
 	struct avpu_codec_desc *codec;
+
+	/* scheduling, under codec->sched_lock */
+	struct list_head node;
+	struct list_head wait;
+	int prio;
+	pid_t pid;
+	ktime_t queued;
+	ktime_t granted;
+	u32 jobs;
+	u32 last_job_us;
+	u32 max_job_us;
+	u64 total_job_us;
+	u32 last_wait_us;
+	u32 max_wait_us;
 };
 
 int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 			    struct inode *inode);
 void avpu_codec_unbind_channel(struct avpu_codec_chan *chan);
+int avpu_codec_acquire_hw(struct avpu_codec_chan *chan, int prio);
+int avpu_codec_release_hw(struct avpu_codec_chan *chan);
+void avpu_codec_sched_init(struct avpu_codec_desc *codec);
 int avpu_codec_read_register(struct avpu_codec_chan *chan,
 			     struct avpu_reg *reg);
 void avpu_codec_write_register(struct avpu_codec_chan *chan,
 			       struct avpu_reg *reg);
 irqreturn_t avpu_irq_handler(int irq, void *data);
 irqreturn_t avpu_hardirq_handler(int irq, void *data);
+int avpu_irq_pending(struct avpu_codec_desc *codec);
+int avpu_irq_pop(struct avpu_codec_desc *codec, u32 *bitfield);
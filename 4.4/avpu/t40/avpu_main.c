@@ -20,6 +20,7 @@
 #include <linux/of_irq.h>
 #include <linux/of_platform.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
 #include <linux/signal.h>
 #include <linux/slab.h>
@@ -30,7 +31,9 @@
 
 #include "avpu_ioctl.h"
 #include "avpu_alloc_ioctl.h"
+#include "avpu_dmabuf.h"
 #include "avpu_ip.h"
+#include <avpu-reg-batch.h>
 
 #define DEV_NAME "avpu"
 
@@ -96,13 +99,8 @@ struct platform_device jz_avpu_irq_device = {					\
 
 int channel_is_ready(struct avpu_codec_chan *chan)
 {
-	unsigned long flags;
-	int ret = chan->unblock;
-
-	spin_lock_irqsave(&chan->codec->i_lock, flags);
-	ret = ret || !list_empty(&chan->codec->irq_masks);
-	spin_unlock_irqrestore(&chan->codec->i_lock, flags);
-	return ret;
+	return chan->unblock ||
+	       (chan->codec->chan == chan && avpu_irq_pending(chan->codec));
 }
 
 static int avpu_codec_open(struct inode *inode, struct file *filp)
@@ -150,6 +148,8 @@ static int avpu_codec_release(struct inode *inode, struct file *filp)
 	list_for_each_safe(pos, n, &chan->mem){
 		tmp = list_entry(pos, struct avpu_dma_buf_mmap, list);
 		list_del(pos);
+		/* the last mapping is gone, or release would not run */
+		avpu_free_dma(chan->codec->device, tmp->buf);
 		kfree(tmp);
 	}
 
@@ -213,17 +213,19 @@ static int unblock_channel(struct avpu_codec_chan *chan)
 	chan->unblock = 1;
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	wake_up_interruptible(&chan->irq_queue);
+	wake_up_interruptible(&chan->codec->sched_wait);
 	return 0;
 }
 
 static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg)
 {
 	struct avpu_codec_desc *codec = chan->codec;
-	int callback;
-	struct r_irq *i_callback;
+	u32 callback;
 	unsigned long flags;
+	int found;
 	int ret;
 
+retry:
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	ret = wait_event_interruptible(chan->irq_queue,
 				       channel_is_ready(chan));
@@ -237,12 +239,11 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg)
 
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	spin_lock_irqsave(&codec->i_lock, flags);
-	i_callback = list_first_entry(&chan->codec->irq_masks,
-				      struct r_irq, list);
-	callback = i_callback->bitfield;
-	list_del(&i_callback->list);
-	kmem_cache_free(codec->cache, i_callback);
+	found = avpu_irq_pop(codec, &callback);
 	spin_unlock_irqrestore(&codec->i_lock, flags);
+	/* another waiter on this channel got it first */
+	if (!found)
+		goto retry;
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 
 	if (copy_to_user((void *)arg, &callback, sizeof(__u32)))
@@ -251,6 +252,99 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg)
 	return ret;
 }
 
+static int wait_irqs(struct avpu_codec_chan *chan, unsigned long arg)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	struct avpu_irq_batch batch;
+	unsigned long flags;
+	long ret = 0;
+	u32 n = 0;
+
+	if (copy_from_user(&batch, (void *)arg, sizeof(batch.timeout_ms)))
+		return -EFAULT;
+
+	if (batch.timeout_ms < 0)
+		ret = wait_event_interruptible(chan->irq_queue,
+					       channel_is_ready(chan));
+	else if (batch.timeout_ms > 0)
+		ret = wait_event_interruptible_timeout(chan->irq_queue,
+						       channel_is_ready(chan),
+						       msecs_to_jiffies(batch.timeout_ms));
+	if (ret < 0)
+		return ret;
+	if (chan->unblock) {
+		avpu_dbg("Unblocking channel\n");
+		return -EINTR;
+	}
+
+	/* one wakeup hands back everything the hardirq handler queued */
+	spin_lock_irqsave(&codec->i_lock, flags);
+	while (n < AVPU_IRQ_BATCH_MAX && avpu_irq_pop(codec, &batch.irqs[n]))
+		n++;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+	batch.count = n;
+
+	if (copy_to_user((void *)arg, &batch,
+			 offsetof(struct avpu_irq_batch, irqs) + n * sizeof(batch.irqs[0])))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int reg_batch(struct avpu_codec_chan *chan, unsigned long arg)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	struct avpu_reg_batch batch;
+	size_t head = offsetof(struct avpu_reg_batch, ops);
+	size_t len;
+	int ret;
+
+	if (copy_from_user(&batch, (void *)arg, head))
+		return -EFAULT;
+
+	if (batch.count > AVPU_REG_BATCH_MAX)
+		return -EINVAL;
+
+	len = batch.count * sizeof(batch.ops[0]);
+	if (copy_from_user(batch.ops, (void *)arg + head, len))
+		return -EFAULT;
+
+	ret = avpu_codec_reg_batch(chan, batch.ops, batch.count, batch.poll_us,
+				   &batch.done);
+	codec->reg_batches++;
+	codec->reg_batch_ops += batch.done;
+
+	if (copy_to_user((void *)arg, &batch, head + len))
+		return -EFAULT;
+
+	return ret;
+}
+
+static int acquire_hw(struct avpu_codec_chan *chan, unsigned long arg)
+{
+	int prio;
+
+	if (get_user(prio, (int __user *)arg))
+		return -EFAULT;
+
+	return avpu_codec_acquire_hw(chan, prio);
+}
+
+/* Commands that touch the hardware or its interrupts */
+static int cmd_needs_hw(unsigned int cmd)
+{
+	switch (cmd) {
+	case AL_CMD_IP_WAIT_IRQ:
+	case AL_CMD_IP_WAIT_IRQS:
+	case AL_CMD_IP_REG_BATCH:
+	case AL_CMD_IP_READ_REG:
+	case AL_CMD_IP_WRITE_REG:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 static int read_reg(struct avpu_codec_chan *chan, unsigned long arg)
 {
 	struct avpu_reg reg;
@@ -259,6 +353,7 @@ static int read_reg(struct avpu_codec_chan *chan, unsigned long arg)
 
 	if (copy_from_user(&reg, (struct avpu_reg *)arg, sizeof(struct avpu_reg)))
 		return -EFAULT;
+	codec->reg_ioctls++;
 
 	if (reg.id % 4) {
 		avpu_err("Unaligned register access: 0x%.4X\n",
@@ -266,19 +361,11 @@ static int read_reg(struct avpu_codec_chan *chan, unsigned long arg)
 		return -EINVAL;
 	}
 
-#if defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_T40)
-	if (reg.id < 0x8000 || reg.id > chan->codec->regs_size) {
+	if (!avpu_reg_valid(codec, reg.id)) {
 		avpu_err("Out-of-range register read: 0x%.4X\n",
 			reg.id);
 		return -EINVAL;
 	}
-#elif defined(CONFIG_SOC_T41)
-	if (reg.id < 0x0000 || reg.id > chan->codec->regs_size) {
-		avpu_err("Out-of-range register read: 0x%.4X\n",
-			reg.id);
-		return -EINVAL;
-	}
-#endif
 
 	err = avpu_codec_read_register(chan, &reg);
 	if (err)
@@ -299,6 +386,7 @@ static int write_reg(struct avpu_codec_chan *chan, unsigned long arg)
 
 	if (copy_from_user(&reg, (struct avpu_reg *)arg, sizeof(struct avpu_reg)))
 		return -EFAULT;
+	codec->reg_ioctls++;
 		avpu_dbg("Reg write: 0x%.4X: 0x%.8x\n", reg.id, reg.value);
 	if (reg.id == 0x8084 || reg.id == 0x8094)
 		avpu_dbg("Reg write: 0x%.4X: 0x%.8x\n", reg.id, reg.value);
@@ -309,17 +397,10 @@ static int write_reg(struct avpu_codec_chan *chan, unsigned long arg)
 		return -EINVAL;
 	}
 
-#if defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_T40)
-	if (reg.id < 0x8000 || reg.id > chan->codec->regs_size) {
+	if (!avpu_reg_valid(codec, reg.id)) {
 		avpu_dbg("Out-of-range register write: 0x%.4X\n", reg.id);
 		return -EINVAL;
 	}
-#elif defined(CONFIG_SOC_T41)
-	if (reg.id < 0x0000 || reg.id > chan->codec->regs_size) {
-		avpu_dbg("Out-of-range register write: 0x%.4X\n", reg.id);
-		return -EINVAL;
-	}
-#endif
 
 	avpu_codec_write_register(chan, &reg);
 
@@ -342,12 +423,105 @@ static long jz_cmd_flush_cache(long arg)
 	return ret;
 }
 #endif
+
+/*
+ * Write back or invalidate [addr, addr + len) for the device unless it lies
+ * in an uncached mapping, in which case 1 is returned. The range must sit
+ * inside one mapping of the caller, which stays locked while it is synced.
+ */
+static int user_range_sync(unsigned long addr, unsigned long len, int dir)
+{
+	struct vm_area_struct *vma;
+	unsigned long prot;
+	int ret = -EFAULT;
+
+	down_read(&current->mm->mmap_sem);
+	vma = find_vma(current->mm, addr);
+	if (vma && vma->vm_start <= addr && len <= vma->vm_end - addr) {
+		prot = pgprot_val(vma->vm_page_prot) & _CACHE_MASK;
+		ret = prot == _CACHE_UNCACHED ||
+		      prot == _CACHE_UNCACHED_ACCELERATED;
+		if (!ret)
+			dma_cache_sync(NULL, (void *)addr, len, dir);
+	}
+	up_read(&current->mm->mmap_sem);
+
+	return ret;
+}
+
+static int sync_cache(struct avpu_codec_chan *chan, unsigned long arg)
+{
+	struct avpu_cache_batch batch;
+	struct avpu_cache_range *r;
+	struct avpu_dma_buffer *buf;
+	size_t head = offsetof(struct avpu_cache_batch, ranges);
+	unsigned long addr;
+	int coherent;
+	int err;
+	u32 i;
+
+	if (copy_from_user(&batch, (void *)arg, head))
+		return -EFAULT;
+
+	if (batch.count > AVPU_CACHE_BATCH_MAX)
+		return -EINVAL;
+
+	if (copy_from_user(batch.ranges, (void *)arg + head,
+			   batch.count * sizeof(batch.ranges[0])))
+		return -EFAULT;
+
+	batch.flushed = 0;
+	batch.skipped = 0;
+	for (i = 0; i < batch.count; i++) {
+		r = &batch.ranges[i];
+		if (r->dir > DMA_FROM_DEVICE || !r->len)
+			return -EINVAL;
+
+		switch (r->type) {
+		case AVPU_CACHE_BUF_ID:
+			buf = find_buf_by_id(chan, r->handle >> PAGE_SHIFT);
+			if (!buf || r->offset > buf->size ||
+			    r->len > buf->size - r->offset)
+				return -EINVAL;
+			coherent = 1;
+			break;
+		case AVPU_CACHE_DMABUF:
+			err = avpu_dmabuf_check_range(r->handle, r->offset, r->len);
+			if (err)
+				return err;
+			coherent = 1;
+			break;
+		case AVPU_CACHE_VADDR:
+			addr = r->handle + r->offset;
+			coherent = user_range_sync(addr, r->len, r->dir);
+			if (coherent < 0)
+				return coherent;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		if (coherent)
+			batch.skipped += r->len;
+		else
+			batch.flushed += r->len;
+	}
+
+	if (copy_to_user((void *)arg, &batch, head))
+		return -EFAULT;
+
+	return 0;
+}
+
 static long avpu_codec_ioctl(struct file *filp, unsigned int cmd,
 			     unsigned long arg)
 {
 	struct avpu_codec_chan *chan = filp->private_data;
 	struct avpu_codec_desc *codec = chan->codec;
 
+	if (cmd_needs_hw(cmd) && codec->chan != chan)
+		return -EBUSY;
+
 	switch (cmd) {
 	case GET_DMA_MMAP:
 		return avpu_ioctl_get_dma_mmap(codec->device, chan, arg);
@@ -359,18 +533,41 @@ static long avpu_codec_ioctl(struct file *filp, unsigned int cmd,
 		return unblock_channel(chan);
 	case AL_CMD_IP_WAIT_IRQ:
 		return wait_irq(chan, arg);
+	case AL_CMD_IP_WAIT_IRQS:
+		return wait_irqs(chan, arg);
+	case AL_CMD_IP_REG_BATCH:
+		return reg_batch(chan, arg);
+	case AL_CMD_IP_ACQUIRE:
+		return acquire_hw(chan, arg);
+	case AL_CMD_IP_RELEASE:
+		return avpu_codec_release_hw(chan);
 	case AL_CMD_IP_READ_REG:
 		return read_reg(chan, arg);
 	case AL_CMD_IP_WRITE_REG:
 		return write_reg(chan, arg);
 	case JZ_CMD_FLUSH_CACHE:
 		return jz_cmd_flush_cache(arg);
+	case AL_CMD_IP_SYNC_CACHE:
+		return sync_cache(chan, arg);
 	default:
 		avpu_err("Unknown ioctl: 0x%.8X\n", cmd);
 		return -EINVAL;
 	}
 }
 
+static unsigned int avpu_codec_poll(struct file *filp, poll_table *wait)
+{
+	struct avpu_codec_chan *chan = filp->private_data;
+
+	poll_wait(filp, &chan->irq_queue, wait);
+	if (chan->unblock)
+		return POLLHUP;
+	if (channel_is_ready(chan))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
 const struct file_operations avpu_codec_fops = {
 	.owner		= THIS_MODULE,
 	.open		= avpu_codec_open,
@@ -378,6 +575,7 @@ const struct file_operations avpu_codec_fops = {
 	.unlocked_ioctl = avpu_codec_ioctl,
 	.compat_ioctl	= avpu_codec_compat_ioctl,
 	.mmap		= avpu_dma_mmap,
+	.poll		= avpu_codec_poll,
 };
 
 void clean_up_avpu_codec_cdev(struct avpu_codec_desc *dev)
@@ -433,22 +631,38 @@ int avpu_setup_codec_cdev(struct avpu_codec_desc *codec, int minor,
 
 static int init_codec_desc(struct avpu_codec_desc *codec)
 {
-	INIT_LIST_HEAD(&codec->irq_masks);
+	int err;
+
 	spin_lock_init(&codec->i_lock);
 	/* make chan requirement explicit */
 	codec->chan = NULL;
-	codec->cache =  kmem_cache_create("avpu_codec_ram",
-					  sizeof(struct r_irq),
-					  0, SLAB_HWCACHE_ALIGN, NULL);
-	if (!codec->cache)
-		return -ENOMEM;
+	codec->irq_head = 0;
+	codec->irq_tail = 0;
+	codec->irq_overflows = 0;
+
+	codec->debugfs = debugfs_create_dir(dev_name(codec->device), NULL);
+	if (!IS_ERR_OR_NULL(codec->debugfs)) {
+		debugfs_create_u32("irq_overflows", S_IRUGO, codec->debugfs,
+				   &codec->irq_overflows);
+		debugfs_create_u32("reg_ioctls", S_IRUGO, codec->debugfs,
+				   &codec->reg_ioctls);
+		debugfs_create_u32("reg_batches", S_IRUGO, codec->debugfs,
+				   &codec->reg_batches);
+		debugfs_create_u32("reg_batch_ops", S_IRUGO, codec->debugfs,
+				   &codec->reg_batch_ops);
+	}
+	avpu_codec_sched_init(codec);
 
-	return 0;
+	err = avpu_dma_pool_init(codec->device, codec->debugfs);
+	if (err)
+		debugfs_remove_recursive(codec->debugfs);
+
+	return err;
 }
 
 static void deinit_codec_desc(struct avpu_codec_desc *codec)
 {
-	kmem_cache_destroy(codec->cache);
+	debugfs_remove_recursive(codec->debugfs);
 }
 
 int avpu_codec_probe(struct platform_device *pdev)
@@ -575,6 +789,7 @@ int avpu_codec_probe(struct platform_device *pdev)
 		if (err) {
 			avpu_err("Failed to request IRQ #%d -> :%d\n",
 				irq, err);
+			deinit_codec_desc(codec);
 			goto out_failed_request_irq;
 		}
 	}
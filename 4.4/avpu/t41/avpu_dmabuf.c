@@ -439,12 +439,9 @@ static void avpu_dmabuf_release(struct dma_buf *buf)
 		kfree(dinfo->sgt_base);
 	}
 
-
-	dma_free_coherent(dinfo->dev, buffer->size, buffer->cpu_handle,
-			  buffer->dma_handle);
+	avpu_free_dma(dinfo->dev, buffer);
 
 	put_device(dinfo->dev);
-	kzfree(buffer);
 	kfree(dinfo);
 }
 
@@ -628,3 +625,26 @@ fail_attach:
 	return err;
 }
 
+/*
+ * Checks that fd is one of our own dma-bufs and that the range fits it.
+ * Those are always coherent; other exporters do their own cache
+ * maintenance.
+ */
+int avpu_dmabuf_check_range(u32 fd, u32 offset, u32 len)
+{
+	struct dma_buf *dbuf;
+	struct avpu_dmabuf_priv *dinfo;
+	int err = 0;
+
+	dbuf = dma_buf_get(fd);
+	if (IS_ERR(dbuf))
+		return -EINVAL;
+
+	dinfo = dbuf->priv;
+	if (dbuf->ops != &avpu_dmabuf_ops ||
+	    offset > dinfo->buffer->size || len > dinfo->buffer->size - offset)
+		err = -EINVAL;
+
+	dma_buf_put(dbuf);
+	return err;
+}
@@ -0,0 +1,161 @@
+/*
+ * Load and unload a model's tensors through /dev/soc-nna, once with one
+ * IOCTL_SOC_NNA_MALLOC/FREE per tensor and once with a single
+ * IOCTL_SOC_NNA_MALLOC_BATCH and FREE, and report the time each takes.
+ *
+ * ./soc_nna_malloc_bench [tensors] [rounds]	(default 300 tensors, 20 rounds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "soc_nna.h"
+
+struct stat_us {
+	double total;
+	double max;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void stat_add(struct stat_us *st, double us)
+{
+	st->total += us;
+	if (us > st->max)
+		st->max = us;
+}
+
+/* Sizes shaped like a small detection model: many small tensors, a few large ones */
+static void make_sizes(unsigned int *sizes, int count)
+{
+	int i;
+
+	srand(1);
+	for (i = 0; i < count; i++) {
+		if (i % 25 == 0)
+			sizes[i] = 256 * 1024 + (rand() % 256) * 1024;
+		else
+			sizes[i] = 64 * (1 + rand() % 512);
+	}
+}
+
+static int load_single(int fd, unsigned int *sizes, struct soc_nna_buf *bufs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		memset(&bufs[i], 0, sizeof(bufs[i]));
+		bufs[i].size = sizes[i];
+		if (ioctl(fd, IOCTL_SOC_NNA_MALLOC, &bufs[i]) < 0) {
+			perror("IOCTL_SOC_NNA_MALLOC");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int unload_single(int fd, struct soc_nna_buf *bufs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ioctl(fd, IOCTL_SOC_NNA_FREE, &bufs[i]) < 0) {
+			perror("IOCTL_SOC_NNA_FREE");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct stat_us single_load = {0}, single_unload = {0};
+	struct stat_us batch_load = {0}, batch_unload = {0};
+	struct soc_nna_malloc_batch batch;
+	struct soc_nna_buf *bufs;
+	unsigned int *sizes, *offsets;
+	int count = 300, rounds = 20;
+	double t0, t1, t2;
+	int fd, r;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (count <= 0 || count > SOC_NNA_MALLOC_BATCH_MAX || rounds <= 0) {
+		printf("Please input: ./soc_nna_malloc_bench [tensors (1-%d)] [rounds]\n", SOC_NNA_MALLOC_BATCH_MAX);
+		return 1;
+	}
+
+	fd = open(SOC_NNA_DEVICE_NAME, O_RDWR);
+	if (fd < 0) {
+		perror(SOC_NNA_DEVICE_NAME);
+		return 1;
+	}
+
+	sizes = calloc(count, sizeof(*sizes));
+	offsets = calloc(count, sizeof(*offsets));
+	bufs = calloc(count, sizeof(*bufs));
+	if (!sizes || !offsets || !bufs) {
+		printf("out of memory\n");
+		return 1;
+	}
+	make_sizes(sizes, count);
+
+	for (r = 0; r < rounds; r++) {
+		t0 = now_us();
+		if (load_single(fd, sizes, bufs, count))
+			return 1;
+		t1 = now_us();
+		if (unload_single(fd, bufs, count))
+			return 1;
+		t2 = now_us();
+		stat_add(&single_load, t1 - t0);
+		stat_add(&single_unload, t2 - t1);
+
+		memset(&batch, 0, sizeof(batch));
+		batch.count = count;
+		batch.align = 64;
+		batch.sizes = sizes;
+		batch.offsets = offsets;
+		t0 = now_us();
+		if (ioctl(fd, IOCTL_SOC_NNA_MALLOC_BATCH, &batch) < 0) {
+			perror("IOCTL_SOC_NNA_MALLOC_BATCH");
+			return 1;
+		}
+		t1 = now_us();
+		if (ioctl(fd, IOCTL_SOC_NNA_FREE, &batch.buf) < 0) {
+			perror("IOCTL_SOC_NNA_FREE");
+			return 1;
+		}
+		t2 = now_us();
+		stat_add(&batch_load, t1 - t0);
+		stat_add(&batch_unload, t2 - t1);
+	}
+
+	printf("%d tensors, %d rounds (avg / max us)\n", count, rounds);
+	printf("  MALLOC x%d   load %10.1f / %10.1f   unload %10.1f / %10.1f\n", count,
+			single_load.total / rounds, single_load.max, single_unload.total / rounds, single_unload.max);
+	printf("  MALLOC_BATCH  load %10.1f / %10.1f   unload %10.1f / %10.1f\n",
+			batch_load.total / rounds, batch_load.max, batch_unload.total / rounds, batch_unload.max);
+
+	free(bufs);
+	free(offsets);
+	free(sizes);
+	close(fd);
+
+	return 0;
+}
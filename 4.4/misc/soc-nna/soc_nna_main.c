@@ -5,6 +5,15 @@
 #include <linux/syscalls.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/jhash.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/hashtable.h>
 
 
 #include <linux/fs.h>
@@ -30,6 +39,18 @@ static int nna_clk = 200000000;
 module_param(nna_clk, int, S_IRUGO);
 MODULE_PARM_DESC(nna_clk, "nna clock");
 
+static int des_cache_num = 4;
+module_param(des_cache_num, int, S_IRUGO);
+MODULE_PARM_DESC(des_cache_num, "descriptor programs kept for replay, 0 disables");
+
+static int job_poll_us = 50;
+module_param(job_poll_us, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(job_poll_us, "how often a running job's channels are checked, in us");
+
+static int job_timeout_ms = 1000;
+module_param(job_timeout_ms, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(job_timeout_ms, "give up on a job whose channels stay busy this long");
+
 static uint32_t  num_all = 0;
 struct buf{
 	uint32_t version_buf;
@@ -40,21 +61,21 @@ struct buf{
 struct buf buf;
 struct buf buf_comparison;
 
-#define NNADMA_VA_2_PA(vaddr, paddr) \
-do {                                \
-	__asm__ __volatile__ (          \
-		".set push\n"               \
-		".set noreorder\n"          \
-		".set mips32r2\n"           \
-		" ll %0, 0(%1)\n"           \
-		" rdhwr %0,$4\n"            \
-		".set reorder\n"            \
-		".set pop\n"                \
-		:"=r"(paddr)                \
-		:"r"(vaddr)                 \
-		:                           \
-	);                              \
-} while(0)
+/* longest command array worth remembering */
+#define SOC_NNA_DES_CACHE_MAX_CMDS  2048
+
+/* Jobs queued or finished but not read yet, over all clients */
+#define SOC_NNA_JOB_QUEUE_MAX       16
+
+struct soc_nna_job_entry {
+	struct list_head    list;
+	struct file         *file;      /* NULL once the submitter has gone */
+	struct soc_nna_job  job;
+	int                 status;
+	ktime_t             queued;
+	ktime_t             started;
+	ktime_t             finished;
+};
 
 struct soc_nna {
 	char                name[16];
@@ -69,16 +90,87 @@ struct soc_nna {
 #endif
 	struct mutex        mlock;
 	struct list_head    memory_list;
+	DECLARE_HASHTABLE(memory_hash, 8);  /* memory_list entries by paddr */
 	struct kmem_cache   *memory_cache;
 
 	nna_dma_des_info_t  des_info[2];
+	unsigned long long int des_build[SOC_NNA_MAX_DES_CHN_CNT];
+
+	struct list_head    des_programs;   /* most recently used first */
+	int                 des_program_cnt;
+	unsigned int        des_hits;
+	unsigned int        des_misses;
+	unsigned int        des_stale;
+	unsigned int        des_pa[SOC_NNA_DES_CACHE_MAX_CMDS * SOC_NNA_DES_CMD_PAS];
+
+	spinlock_t          job_lock;
+	struct list_head    job_free;
+	struct list_head    job_queue;      /* first entry owns the channels */
+	struct list_head    job_done;
+	wait_queue_head_t   job_wait;
+	struct hrtimer      job_timer;
+	unsigned int        job_seq;
+	unsigned int        jobs_done;
+	unsigned int        job_timeouts;
+	unsigned int        job_max_run_us;
+	struct soc_nna_job_entry jobs[SOC_NNA_JOB_QUEUE_MAX];
+
+	unsigned int        oram_base;      /* physical */
+	unsigned int        oram_size;
+	unsigned int        oram_used;
+	struct list_head    oram_blocks;    /* in offset order */
+	struct proc_dir_entry *proc;
 };
 
 struct soc_nna_memory_cache {
 	struct list_head    list;
+	struct hlist_node   node;
+	struct file         *file;
+	struct mm_struct    *mm;        /* whose addresses descriptor programs may hold */
 	struct soc_nna_buf  buf;
 };
 
+/*
+ * A descriptor program built by soc_nna_setup_des(). The descriptors only
+ * depend on the command array and on the physical addresses its three
+ * user addresses per command translate to, so the program is replayed
+ * only when the commands match and every one of those translations is
+ * still the one it was built from (pa).
+ */
+struct soc_nna_des_program {
+	struct list_head        list;
+	struct file             *file;
+	struct mm_struct        *mm;
+	u32                     hash;
+	unsigned int            rd_cmd_cnt;
+	unsigned int            rd_cmd_st_idx;
+	unsigned int            wr_cmd_cnt;
+	unsigned int            wr_cmd_st_idx;
+	des_gen_result_t        des_rslt;
+	unsigned int            des_cnt;
+	unsigned int            chn_cnt;
+	unsigned long long int  *des;
+	unsigned int            *chn;
+	nna_dma_cmd_t           *cmd;
+	unsigned int            *pa;
+};
+
+static void soc_nna_des_flush(struct soc_nna *pnna, struct mm_struct *mm, struct file *file);
+static void soc_nna_job_release(struct soc_nna *pnna, struct file *file);
+static void soc_nna_job_drain(struct soc_nna *pnna);
+
+/* A piece of ORAM handed out by IOCTL_SOC_NNA_ORAM_ALLOC */
+struct soc_nna_oram_block {
+	struct list_head        list;
+	struct file             *file;
+	pid_t                   tgid;
+	unsigned int            offset;
+	unsigned int            size;
+};
+
+static void soc_nna_oram_release(struct soc_nna *pnna, struct file *file);
+static void soc_nna_memory_release(struct soc_nna *pnna, struct file *file);
+
 int soc_nna_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *mdev = file->private_data;
@@ -141,18 +233,18 @@ int soc_nna_release(struct inode *inode, struct file *file)
 	if ((pnna->refcnt > 0) && (--pnna->refcnt == 0)) {
 		b_last_release = true;
 	}
+	soc_nna_des_flush(pnna, NULL, b_last_release ? NULL : file);
 	mutex_unlock(&pnna->mlock);
+	soc_nna_job_release(pnna, file);
+	soc_nna_oram_release(pnna, file);
+	soc_nna_memory_release(pnna, file);
 
 	if (b_last_release) {
-		struct soc_nna_memory_cache *pelem = NULL;
-		struct list_head *pos = NULL, *n = NULL;
+		soc_nna_job_drain(pnna);
+		soc_nna_memory_release(pnna, NULL);
 		mutex_lock(&pnna->mlock);
-		list_for_each_safe(pos, n, &pnna->memory_list) {
-			pelem = list_entry(pos, struct soc_nna_memory_cache, list);
-			list_del(pos);
-			dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
-			kmem_cache_free(pnna->memory_cache, pelem);
-		}
+		dev_info(pnna->mdev.this_device, "%s(%d): descriptor programs replayed %u, built %u, remapped %u\n", __func__, __LINE__, pnna->des_hits, pnna->des_misses, pnna->des_stale);
+		dev_info(pnna->mdev.this_device, "%s(%d): jobs %u, timeouts %u, longest %u us\n", __func__, __LINE__, pnna->jobs_done, pnna->job_timeouts, pnna->job_max_run_us);
 		mutex_unlock(&pnna->mlock);
 #ifndef CPU_SIMULATOR
 		clk_disable(pnna->clk);
@@ -171,10 +263,75 @@ static loff_t soc_nna_llseek(struct file *file, loff_t offset, int origin)
 	return 0;
 }
 
+/* Called with job_lock held */
+static struct soc_nna_job_entry *soc_nna_job_done_for(struct soc_nna *pnna, struct file *file)
+{
+	struct soc_nna_job_entry *entry = NULL;
+
+	list_for_each_entry(entry, &pnna->job_done, list) {
+		if (entry->file == file)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static bool soc_nna_job_has_done(struct soc_nna *pnna, struct file *file)
+{
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	ret = soc_nna_job_done_for(pnna, file) != NULL;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return ret;
+}
+
+/* Hands back one struct soc_nna_job_done per finished job, oldest first */
 static ssize_t soc_nna_read(struct file *file, char *buf, size_t size, loff_t *offset)
 {
-	//TODO
-	return 0;
+	struct miscdevice *mdev = file->private_data;
+	struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+	struct soc_nna_job_entry *entry = NULL;
+	struct soc_nna_job_done done;
+	unsigned long flags;
+	size_t copied = 0;
+	int ret = 0;
+
+	if (size < sizeof(done))
+		return -EINVAL;
+
+	while (copied + sizeof(done) <= size) {
+		spin_lock_irqsave(&pnna->job_lock, flags);
+		entry = soc_nna_job_done_for(pnna, file);
+		if (entry) {
+			done.seq = entry->job.seq;
+			done.status = entry->status;
+			done.queue_us = ktime_us_delta(entry->started, entry->queued);
+			done.run_us = ktime_us_delta(entry->finished, entry->started);
+			list_move(&entry->list, &pnna->job_free);
+		}
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+		if (!entry) {
+			if (copied)
+				break;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(pnna->job_wait, soc_nna_job_has_done(pnna, file));
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		wake_up(&pnna->job_wait);
+		if (copy_to_user(buf + copied, &done, sizeof(done)))
+			return copied ? copied : -EFAULT;
+		copied += sizeof(done);
+	}
+
+	return copied;
 }
 
 static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, loff_t *offset)
@@ -185,16 +342,103 @@ static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, lo
 
 static unsigned int soc_nna_poll(struct file *file, struct poll_table_struct *poll_table)
 {
-	//TODO
-	return 0;
+	struct miscdevice *mdev = file->private_data;
+	struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+	unsigned int mask = 0;
+	unsigned long flags;
+
+	poll_wait(file, &pnna->job_wait, poll_table);
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (soc_nna_job_done_for(pnna, file))
+		mask |= POLLIN | POLLRDNORM;
+	if (!list_empty(&pnna->job_free))
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return mask;
+}
+
+/* Allocate and reserve a coherent buffer of buf->size bytes, filling in its vaddr and paddr */
+static struct soc_nna_memory_cache *soc_nna_buf_alloc(struct soc_nna *pnna, struct soc_nna_buf *buf)
+{
+	struct soc_nna_memory_cache *pelem = NULL;
+	void *page = NULL, *endpage = NULL;
+
+	pelem = kmem_cache_alloc(pnna->memory_cache, GFP_KERNEL);
+	if (!pelem) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:kmem_cache_alloc failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return NULL;
+	}
+
+	buf->size = PAGE_ALIGN(buf->size);
+	buf->vaddr = dma_alloc_coherent(pnna->mdev.this_device, buf->size, (dma_addr_t *)&buf->paddr, GFP_KERNEL);
+	if (!buf->vaddr) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:dma_alloc_coherent failed\n", __func__, __LINE__, current->tgid, current->pid);
+		kmem_cache_free(pnna->memory_cache, pelem);
+		return NULL;
+	}
+
+	endpage = buf->vaddr + buf->size;
+	for (page = buf->vaddr; page < endpage; page += PAGE_SIZE) {
+		SetPageReserved(virt_to_page(page));
+	}
+
+	memcpy(&pelem->buf, buf, sizeof(*buf));
+
+	return pelem;
+}
+
+/* The pages must not be reserved any more when they go back to the allocator */
+static void soc_nna_buf_release(struct soc_nna *pnna, struct soc_nna_memory_cache *pelem)
+{
+	void *page = NULL, *endpage = pelem->buf.vaddr + pelem->buf.size;
+
+	for (page = pelem->buf.vaddr; page < endpage; page += PAGE_SIZE) {
+		ClearPageReserved(virt_to_page(page));
+	}
+	dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
+	kmem_cache_free(pnna->memory_cache, pelem);
+}
+
+/* Called with mlock held */
+static void soc_nna_buf_track(struct soc_nna *pnna, struct soc_nna_memory_cache *pelem, struct file *file)
+{
+	/* the new buffer may sit where a replayed program expects another one */
+	soc_nna_des_flush(pnna, current->mm, NULL);
+	pelem->file = file;
+	pelem->mm = current->mm;
+	list_add_tail(&pelem->list, &pnna->memory_list);
+	hash_add(pnna->memory_hash, &pelem->node, (unsigned long)pelem->buf.paddr);
+}
+
+/* Free what file allocated, or everything when file is NULL */
+static void soc_nna_memory_release(struct soc_nna *pnna, struct file *file)
+{
+	struct soc_nna_memory_cache *pelem = NULL, *n = NULL;
+	unsigned int count = 0;
+
+	mutex_lock(&pnna->mlock);
+	list_for_each_entry_safe(pelem, n, &pnna->memory_list, list) {
+		if (file && pelem->file != file)
+			continue;
+		list_del(&pelem->list);
+		hash_del(&pelem->node);
+		soc_nna_des_flush(pnna, pelem->mm, NULL);
+		soc_nna_buf_release(pnna, pelem);
+		count++;
+	}
+	mutex_unlock(&pnna->mlock);
+
+	if (count)
+		dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]: freed %u buffers\n", __func__, __LINE__, current->tgid, current->pid, count);
 }
 
-static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
+static long soc_nna_malloc(struct soc_nna *pnna, struct file *file, long usr_arg)
 {
 	long ret = 0;
 	struct soc_nna_buf buf;
 	struct soc_nna_memory_cache *pelem = NULL;
-	void *page = NULL, *endpage = NULL;
 	unsigned int cp0_status = 0;
 
 	__asm__ volatile (" li   $t8, 0xffffffff \n"
@@ -214,28 +458,12 @@ static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
 		goto err_copy_from_user;
 	}
 
-	pelem = kmem_cache_alloc(pnna->memory_cache, GFP_ATOMIC);
+	pelem = soc_nna_buf_alloc(pnna, &buf);
 	if (!pelem) {
-		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:kmem_cache_alloc failed\n", __func__, __LINE__, current->tgid, current->pid);
-		ret = -ENOMEM;
-		goto err_kmem_cache_alloc;
-	}
-
-	buf.size = PAGE_ALIGN(buf.size);
-	buf.vaddr = dma_alloc_coherent(pnna->mdev.this_device, buf.size, (dma_addr_t *)&buf.paddr, GFP_KERNEL);
-	if (!buf.vaddr) {
-		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:dma_alloc_coherent failed\n", __func__, __LINE__, current->tgid, current->pid);
 		ret = -ENOMEM;
-		goto err_dma_alloc_coherent;
-	}
-
-	endpage = buf.vaddr + buf.size;
-	for (page = buf.vaddr; page < endpage; page += PAGE_SIZE) {
-		SetPageReserved(virt_to_page(page));
+		goto err_buf_alloc;
 	}
 
-	memcpy(&pelem->buf, &buf, sizeof(buf));
-
 	if (copy_to_user((void *)usr_arg, &buf, sizeof(buf))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
 		ret = -EFAULT;
@@ -243,18 +471,16 @@ static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
 	}
 
 	mutex_lock(&pnna->mlock);
-	list_add_tail(&pelem->list, &pnna->memory_list);
+	soc_nna_buf_track(pnna, pelem, file);
 	mutex_unlock(&pnna->mlock);
 
-	dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:malloc success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
+	dev_info_ratelimited(pnna->mdev.this_device, "%s(%d) [%d:%d]:malloc success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
 
 	return 0;
 
 err_copy_to_user:
-	dma_free_coherent(pnna->mdev.this_device, buf.size, buf.vaddr, (dma_addr_t)buf.paddr);
-err_dma_alloc_coherent:
-	kmem_cache_free(pnna->memory_cache, pelem);
-err_kmem_cache_alloc:
+	soc_nna_buf_release(pnna, pelem);
+err_buf_alloc:
 err_copy_from_user:
 	return ret;
 }
@@ -264,7 +490,6 @@ static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
 	long ret = -1;
 	struct soc_nna_buf buf;
 	struct soc_nna_memory_cache *pelem = NULL;
-	struct list_head *pos = NULL, *n = NULL;
 
 	if (copy_from_user(&buf, (void *)usr_arg, sizeof(buf))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
@@ -272,19 +497,90 @@ static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
 	}
 
 	mutex_lock(&pnna->mlock);
-	list_for_each_safe(pos, n, &pnna->memory_list) {
-		pelem = list_entry(pos, struct soc_nna_memory_cache, list);
+	hash_for_each_possible(pnna->memory_hash, pelem, node, (unsigned long)buf.paddr) {
 		if ((pelem->buf.vaddr == buf.vaddr) && (pelem->buf.paddr == buf.paddr)) {
-			list_del(pos);
-			dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
-			kmem_cache_free(pnna->memory_cache, pelem);
-			dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:free success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
+			list_del(&pelem->list);
+			hash_del(&pelem->node);
+			buf.size = pelem->buf.size;
+			soc_nna_des_flush(pnna, pelem->mm, NULL);
+			soc_nna_buf_release(pnna, pelem);
 			ret = 0;
 			break;
 		}
 	}
 	mutex_unlock(&pnna->mlock);
 
+	if (!ret)
+		dev_info_ratelimited(pnna->mdev.this_device, "%s(%d) [%d:%d]:free success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
+
+	return ret;
+}
+
+/*
+ * Lay count tensors out back to back in one coherent region, so loading a
+ * model costs one allocation instead of one per tensor. The region is
+ * freed as a whole with IOCTL_SOC_NNA_FREE.
+ */
+static long soc_nna_malloc_batch(struct soc_nna *pnna, struct file *file, long usr_arg)
+{
+	long ret = 0;
+	struct soc_nna_malloc_batch batch;
+	struct soc_nna_memory_cache *pelem = NULL;
+	unsigned int *offsets = NULL;
+	unsigned int align = 0, size = 0, i = 0;
+	u64 total = 0;
+
+	if (copy_from_user(&batch, (void *)usr_arg, sizeof(batch))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	align = max_t(unsigned int, batch.align, 1U << SOC_NNA_ADDR_ALIGN_BIT);
+	if (!batch.count || batch.count > SOC_NNA_MALLOC_BATCH_MAX || !is_power_of_2(align) || align > PAGE_SIZE)
+		return -EINVAL;
+
+	offsets = kmalloc(batch.count * sizeof(*offsets), GFP_KERNEL);
+	if (!offsets)
+		return -ENOMEM;
+
+	/* sizes in, offsets out, in the same array */
+	if (copy_from_user(offsets, batch.sizes, batch.count * sizeof(*offsets))) {
+		ret = -EFAULT;
+		goto out;
+	}
+	for (i = 0; i < batch.count; i++) {
+		size = offsets[i];
+		offsets[i] = total;
+		total = ALIGN(total + size, (u64)align);
+		if (!size || total > INT_MAX) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	batch.buf.size = total;
+	pelem = soc_nna_buf_alloc(pnna, &batch.buf);
+	if (!pelem) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_to_user(batch.offsets, offsets, batch.count * sizeof(*offsets))
+			|| copy_to_user((void *)usr_arg, &batch, sizeof(batch))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		soc_nna_buf_release(pnna, pelem);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	mutex_lock(&pnna->mlock);
+	soc_nna_buf_track(pnna, pelem, file);
+	mutex_unlock(&pnna->mlock);
+
+	dev_info_ratelimited(pnna->mdev.this_device, "%s(%d) [%d:%d]:malloc %u buffers, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, batch.count, batch.buf.vaddr, batch.buf.paddr, batch.buf.size);
+
+out:
+	kfree(offsets);
 	return ret;
 }
 
@@ -311,118 +607,181 @@ long soc_nna_flushcache(struct soc_nna *pnna, long usr_arg)
 	return 0;
 }
 
-static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info)
-{
-	int i = 0, j = 0;
-	int c64kcnt = 0;
-	unsigned int remain_bytes = 0, trans_bytes = 0, last_des = 0, cur_trans_bytes = 0, total_bytes = 0;
-	unsigned int d_pa_st_addr = 0, o_pa_st_addr = 0, o_pa_mlc_addr = 0, o_pa_mlc_end_addr = 0;
-	nna_dma_cmd_t *pcmd = NULL;
-	unsigned int widx = 0, des_num = 0, chain_st_idx = st_idx;
-
-	memset(des_info, 0, sizeof(nna_dma_des_info_t));
-
-	for (i = st_idx; i < cmd_cnt; i++) {
-		pcmd = d_va_cmd + i;
-		c64kcnt = ((pcmd->data_bytes - 1) >> 16) + 1;
-		remain_bytes = pcmd->data_bytes;
-		NNADMA_VA_2_PA(pcmd->d_va_st_addr, d_pa_st_addr);
-		NNADMA_VA_2_PA(pcmd->o_va_st_addr, o_pa_st_addr);
-		NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, o_pa_mlc_addr);
-		o_pa_mlc_end_addr = o_pa_mlc_addr + pcmd->o_mlc_bytes;
-
-		for (j = 0; j < c64kcnt; j++) {
-			last_des = (j == (c64kcnt - 1)) ? 1 : 0;
-			trans_bytes = last_des ? remain_bytes : 65536;
-
-			if ((o_pa_st_addr + trans_bytes) <= o_pa_mlc_end_addr) {
-				des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-				d_pa_st_addr += trans_bytes;
-				o_pa_st_addr += trans_bytes;
-				des_num++;
-			} else {
-				cur_trans_bytes = o_pa_mlc_end_addr - o_pa_st_addr;
-				des_info->des_data[widx++] = ((DES_CFG_LINK << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)cur_trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-
-				des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)(trans_bytes - cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_mlc_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)(d_pa_st_addr + cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-				d_pa_st_addr += trans_bytes;
-				o_pa_st_addr = o_pa_mlc_addr + (trans_bytes - cur_trans_bytes);
-				des_num += 2;
-			}
-			remain_bytes -= trans_bytes;
-		}
+/*
+ * Write back or invalidate [addr, addr + len) for the device unless it lies
+ * in an uncached mapping, in which case 1 is returned. The range must sit
+ * inside one mapping of the caller, which stays locked while it is synced.
+ */
+static int soc_nna_range_sync(unsigned long addr, unsigned long len, int dir)
+{
+	struct vm_area_struct *vma;
+	unsigned long prot;
+	int ret = -EFAULT;
+
+	down_read(&current->mm->mmap_sem);
+	vma = find_vma(current->mm, addr);
+	if (vma && vma->vm_start <= addr && len <= vma->vm_end - addr) {
+		prot = pgprot_val(vma->vm_page_prot) & _CACHE_MASK;
+		ret = (prot == _CACHE_UNCACHED) || (prot == _CACHE_UNCACHED_ACCELERATED);
+		if (!ret)
+			dma_cache_sync(NULL, (void *)addr, len, dir);
+	}
+	up_read(&current->mm->mmap_sem);
 
-		total_bytes += pcmd->data_bytes;
-		if (!pcmd->des_link) {
-			des_info->des_num[des_info->chain_num] = des_num;
-			des_info->total_bytes[des_info->chain_num] = total_bytes;
-			des_info->chain_st_idx[des_info->chain_num] = chain_st_idx;
-			des_info->chain_num++;
-			des_num = 0;
-			total_bytes = 0;
-			chain_st_idx = i + 1;
-		}
+	return ret;
+}
+
+long soc_nna_flushcache_batch(struct soc_nna *pnna, long usr_arg)
+{
+	struct soc_nna_cache_batch batch;
+	struct flush_cache_info *info = NULL;
+	size_t head = offsetof(struct soc_nna_cache_batch, info);
+	unsigned int i = 0;
+	int ret = 0;
+
+	if (copy_from_user(&batch, (void *)usr_arg, head)) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+	if (batch.count > SOC_NNA_CACHE_BATCH_MAX)
+		return -EINVAL;
+	if (copy_from_user(batch.info, (void *)usr_arg + head, batch.count * sizeof(batch.info[0]))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	batch.flushed = 0;
+	batch.skipped = 0;
+	for (i = 0; i < batch.count; i++) {
+		info = &batch.info[i];
+		if ((info->addr == 0) || (info->len == 0) || (info->dir > DMA_FROM_DEVICE))
+			return -EINVAL;
+
+		ret = soc_nna_range_sync(info->addr, info->len, info->dir);
+		if (ret < 0)
+			return ret;
+		if (ret)
+			batch.skipped += info->len;
+		else
+			batch.flushed += info->len;
+	}
+	num_all += batch.flushed;
+
+	if (copy_to_user((void *)usr_arg, &batch, head)) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
 	}
+
+	return 0;
 }
 
-static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
+static u32 soc_nna_des_hash(nna_dma_cmd_set_t *cmd_set, nna_dma_cmd_t *d_va_cmd, unsigned int cmd_cnt)
 {
-	nna_dma_des_info_t *des_info = pnna->des_info;
-	int des_remain = 2048; //(16 * 1024) / sizeof(unsigned long long int);
-	int chnidx = 0, desidx = 0, destotal_chain = 0, rdidx = 0, wridx = 0;
-	int maxchnnum = des_info[0].chain_num > des_info[1].chain_num ? des_info[0].chain_num : des_info[1].chain_num;
-	unsigned long long int *vdma = (unsigned long long int *)pnna->dmamem;
-	memset(des_rslt, 0, sizeof(des_gen_result_t));
+	return jhash2((u32 *)d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t) / sizeof(u32),
+			jhash_3words(cmd_set->rd_cmd_cnt, cmd_set->rd_cmd_st_idx, cmd_set->wr_cmd_st_idx, cmd_cnt));
+}
 
-	for (chnidx = 0; chnidx < maxchnnum; chnidx++) {
-		destotal_chain = des_info[0].des_num[chnidx] + des_info[1].des_num[chnidx] + 2;
-		if (destotal_chain > des_remain) {
-			des_rslt->rcmd_st_idx = des_info[0].chain_st_idx[chnidx];
-			des_rslt->wcmd_st_idx = des_info[1].chain_st_idx[chnidx];
-			des_rslt->dma_chn_num = chnidx;
-			des_rslt->finish = 0;
-			return;
-		}
+static struct soc_nna_des_program *soc_nna_des_find(struct soc_nna *pnna, struct file *file, nna_dma_cmd_set_t *cmd_set,
+		nna_dma_cmd_t *d_va_cmd, unsigned int cmd_cnt, u32 hash)
+{
+	struct soc_nna_des_program *prog = NULL;
+
+	list_for_each_entry(prog, &pnna->des_programs, list) {
+		if (prog->hash != hash || prog->file != file || prog->mm != current->mm
+				|| prog->rd_cmd_cnt != cmd_set->rd_cmd_cnt || prog->rd_cmd_st_idx != cmd_set->rd_cmd_st_idx
+				|| prog->wr_cmd_cnt != cmd_set->wr_cmd_cnt || prog->wr_cmd_st_idx != cmd_set->wr_cmd_st_idx)
+			continue;
+		if (memcmp(prog->cmd, d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t)))
+			continue;
+		return prog;
+	}
+
+	return NULL;
+}
 
-		/* rd chain */
-		*d_va_chn++ = desidx;
-		*(vdma + desidx++) = ((DES_CFG_CNT << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-			| ((des_info[0].total_bytes[chnidx] << DES_TOTAL_BYTES) & DES_TOTAL_BYTES_MASK);
-		memcpy(vdma + desidx, &(des_info[0].des_data[rdidx]), 8 * des_info[0].des_num[chnidx]);
-		desidx += des_info[0].des_num[chnidx];
-		rdidx += des_info[0].des_num[chnidx];
+static void soc_nna_des_drop(struct soc_nna *pnna, struct soc_nna_des_program *prog)
+{
+	list_del(&prog->list);
+	pnna->des_program_cnt--;
+	kfree(prog);
+}
 
-		/* wr chain */
-		*d_va_chn++ = desidx;
-		*(vdma + desidx++) = ((DES_CFG_CNT << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-			| ((des_info[1].total_bytes[chnidx] << DES_TOTAL_BYTES) & DES_TOTAL_BYTES_MASK);
-		memcpy(vdma + desidx, &(des_info[1].des_data[wridx]), 8 * des_info[1].des_num[chnidx]);
-		desidx += des_info[1].des_num[chnidx];
-		wridx += des_info[1].des_num[chnidx];
+/*
+ * Forget the programs built for mm, or through file, or all of them when
+ * both are NULL. Called with mlock held
+ */
+static void soc_nna_des_flush(struct soc_nna *pnna, struct mm_struct *mm, struct file *file)
+{
+	struct soc_nna_des_program *prog = NULL, *n = NULL;
 
-		des_remain -= destotal_chain;
+	list_for_each_entry_safe(prog, n, &pnna->des_programs, list) {
+		if ((!mm && !file) || (mm && prog->mm == mm) || (file && prog->file == file))
+			soc_nna_des_drop(pnna, prog);
 	}
+}
 
-	des_rslt->dma_chn_num = maxchnnum;
-	des_rslt->finish = 1;
+/* Keep a copy of the program just built; failing to is not an error */
+static void soc_nna_des_remember(struct soc_nna *pnna, struct file *file, nna_dma_cmd_set_t *cmd_set, nna_dma_cmd_t *d_va_cmd,
+		unsigned int cmd_cnt, u32 hash, unsigned int *d_va_chn, int des_cnt)
+{
+	struct soc_nna_des_program *prog = NULL;
+	unsigned int chn_cnt = 2 * cmd_set->des_rslt.dma_chn_num;
+
+	if (pnna->des_program_cnt >= des_cache_num)
+		soc_nna_des_drop(pnna, list_entry(pnna->des_programs.prev, struct soc_nna_des_program, list));
+
+	prog = kmalloc(ALIGN(sizeof(*prog), 8) + des_cnt * sizeof(unsigned long long int)
+			+ cmd_cnt * sizeof(nna_dma_cmd_t) + chn_cnt * sizeof(unsigned int)
+			+ cmd_cnt * SOC_NNA_DES_CMD_PAS * sizeof(unsigned int), GFP_KERNEL | __GFP_NOWARN);
+	if (!prog)
+		return;
+
+	prog->des = (unsigned long long int *)((char *)prog + ALIGN(sizeof(*prog), 8));
+	prog->cmd = (nna_dma_cmd_t *)(prog->des + des_cnt);
+	prog->chn = (unsigned int *)(prog->cmd + cmd_cnt);
+	prog->pa = prog->chn + chn_cnt;
+
+	prog->file = file;
+	prog->mm = current->mm;
+	prog->hash = hash;
+	prog->rd_cmd_cnt = cmd_set->rd_cmd_cnt;
+	prog->rd_cmd_st_idx = cmd_set->rd_cmd_st_idx;
+	prog->wr_cmd_cnt = cmd_set->wr_cmd_cnt;
+	prog->wr_cmd_st_idx = cmd_set->wr_cmd_st_idx;
+	prog->des_rslt = cmd_set->des_rslt;
+	prog->des_cnt = des_cnt;
+	prog->chn_cnt = chn_cnt;
+	memcpy(prog->des, pnna->des_build, des_cnt * sizeof(unsigned long long int));
+	memcpy(prog->cmd, d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t));
+	memcpy(prog->chn, d_va_chn, chn_cnt * sizeof(unsigned int));
+	memcpy(prog->pa, pnna->des_pa, cmd_cnt * SOC_NNA_DES_CMD_PAS * sizeof(unsigned int));
+
+	list_add(&prog->list, &pnna->des_programs);
+	pnna->des_program_cnt++;
+}
+
+/* Translate what the commands of cmd_set point at into des_pa. Called with mlock held */
+static void soc_nna_des_translate(struct soc_nna *pnna, nna_dma_cmd_set_t *cmd_set, nna_dma_cmd_t *d_va_cmd)
+{
+	unsigned int *pa = pnna->des_pa;
+
+	memset(pa, 0, (cmd_set->rd_cmd_cnt + cmd_set->wr_cmd_cnt) * SOC_NNA_DES_CMD_PAS * sizeof(unsigned int));
+	soc_nna_translate_des(cmd_set->rd_cmd_st_idx, cmd_set->rd_cmd_cnt, d_va_cmd, pa);
+	soc_nna_translate_des(cmd_set->wr_cmd_st_idx, cmd_set->wr_cmd_cnt, d_va_cmd + cmd_set->rd_cmd_cnt,
+			pa + cmd_set->rd_cmd_cnt * SOC_NNA_DES_CMD_PAS);
 }
 
-long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
+long soc_nna_setup_des(struct soc_nna *pnna, struct file *file, long usr_arg)
 {
 	long ret = 0;
 	nna_dma_cmd_set_t cmd_set;
 	nna_dma_cmd_t *d_va_cmd = NULL, *d_pa_cmd = NULL;
 	unsigned int d_pa_chn = 0;
 	unsigned int *d_va_chn = NULL;
+	struct soc_nna_des_program *prog = NULL;
+	unsigned int cmd_cnt = 0;
+	int des_cnt = 0;
+	u32 hash = 0;
 
 	if (copy_from_user(&cmd_set, (void *)usr_arg, sizeof(nna_dma_cmd_set_t))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
@@ -438,10 +797,36 @@ long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
 	NNADMA_VA_2_PA((unsigned long)cmd_set.d_va_chn, d_pa_chn);      //convert user space vaddr to paddr
 	d_va_chn = phys_to_virt((unsigned long)d_pa_chn);               //map paddr to kernel space vaddr to be used by kernel
 
-	soc_nna_analysis_des(pnna, cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
-	soc_nna_analysis_des(pnna, cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
+	/* an inference replays the same commands every run, so reuse what was built last time */
+	cmd_cnt = cmd_set.rd_cmd_cnt + cmd_set.wr_cmd_cnt;
+	if (des_cache_num > 0 && cmd_cnt <= SOC_NNA_DES_CACHE_MAX_CMDS) {
+		hash = soc_nna_des_hash(&cmd_set, d_va_cmd, cmd_cnt);
+		prog = soc_nna_des_find(pnna, file, &cmd_set, d_va_cmd, cmd_cnt, hash);
+		soc_nna_des_translate(pnna, &cmd_set, d_va_cmd);
+		/* a buffer the commands point at was remapped since the program was built */
+		if (prog && memcmp(prog->pa, pnna->des_pa, cmd_cnt * SOC_NNA_DES_CMD_PAS * sizeof(unsigned int))) {
+			soc_nna_des_drop(pnna, prog);
+			prog = NULL;
+			pnna->des_stale++;
+		}
+	}
 
-	soc_nna_update_des(pnna, d_va_chn, &cmd_set.des_rslt);
+	if (prog) {
+		memcpy((void *)pnna->dmamem, prog->des, prog->des_cnt * sizeof(unsigned long long int));
+		memcpy(d_va_chn, prog->chn, prog->chn_cnt * sizeof(unsigned int));
+		cmd_set.des_rslt = prog->des_rslt;
+		list_move(&prog->list, &pnna->des_programs);
+		pnna->des_hits++;
+	} else {
+		soc_nna_analysis_des(cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
+		soc_nna_analysis_des(cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
+
+		des_cnt = soc_nna_update_des(pnna->des_info, pnna->des_build, d_va_chn, &cmd_set.des_rslt);
+		memcpy((void *)pnna->dmamem, pnna->des_build, des_cnt * sizeof(unsigned long long int));
+		if (des_cache_num > 0 && cmd_cnt <= SOC_NNA_DES_CACHE_MAX_CMDS)
+			soc_nna_des_remember(pnna, file, &cmd_set, d_va_cmd, cmd_cnt, hash, d_va_chn, des_cnt);
+		pnna->des_misses++;
+	}
 	mutex_unlock(&pnna->mlock);
 
 	if (copy_to_user((void *)usr_arg, &cmd_set, sizeof(nna_dma_cmd_set_t))) {
@@ -457,16 +842,307 @@ err_copy_from_user:
 	return ret;
 }
 
+long soc_nna_des_cache_flush(struct soc_nna *pnna, struct file *file, long usr_arg)
+{
+	mutex_lock(&pnna->mlock);
+	soc_nna_des_flush(pnna, NULL, file);
+	mutex_unlock(&pnna->mlock);
+
+	return 0;
+}
+
+static ktime_t soc_nna_job_period(void)
+{
+	return ns_to_ktime((u64)max(job_poll_us, 10) * NSEC_PER_USEC);
+}
+
+/* A channel drops its start bit once its chain has reached the END descriptor */
+static bool soc_nna_chn_busy(struct soc_nna *pnna, unsigned int flags)
+{
+	if ((flags & SOC_NNA_JOB_RD) && (soc_nna_readl(pnna, NNA_DMA_RCFG) & (1 << RCFG_START)))
+		return true;
+	if ((flags & SOC_NNA_JOB_WR) && (soc_nna_readl(pnna, NNA_DMA_WCFG) & (1 << WCFG_START)))
+		return true;
+
+	return false;
+}
+
+static bool soc_nna_job_busy(struct soc_nna *pnna, struct soc_nna_job_entry *entry)
+{
+	return soc_nna_chn_busy(pnna, entry->job.flags);
+}
+
+/* Called with job_lock held */
+static void soc_nna_job_start(struct soc_nna *pnna, struct soc_nna_job_entry *entry)
+{
+	entry->started = ktime_get();
+	if (entry->job.flags & SOC_NNA_JOB_RD)
+		soc_nna_writel(pnna, NNA_DMA_RCFG, ((entry->job.rd_des_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
+	if (entry->job.flags & SOC_NNA_JOB_WR)
+		soc_nna_writel(pnna, NNA_DMA_WCFG, ((entry->job.wr_des_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
+}
+
+/* Called with job_lock held */
+static void soc_nna_job_finish(struct soc_nna *pnna, struct soc_nna_job_entry *entry, ktime_t now)
+{
+	unsigned int run_us = 0;
+
+	entry->finished = now;
+	run_us = ktime_us_delta(now, entry->started);
+	if (run_us > pnna->job_max_run_us)
+		pnna->job_max_run_us = run_us;
+	pnna->jobs_done++;
+
+	if (entry->file)
+		list_move_tail(&entry->list, &pnna->job_done);
+	else
+		list_move(&entry->list, &pnna->job_free);
+}
+
+/* Clear the start bits of entry's channels. Called with job_lock held */
+static void soc_nna_job_stop(struct soc_nna *pnna, struct soc_nna_job_entry *entry)
+{
+	if (entry->job.flags & SOC_NNA_JOB_RD)
+		soc_nna_writel(pnna, NNA_DMA_RCFG, 0);
+	if (entry->job.flags & SOC_NNA_JOB_WR)
+		soc_nna_writel(pnna, NNA_DMA_WCFG, 0);
+}
+
+/*
+ * Take the running job off the channels and retire it with status. Returns
+ * false when a channel would not let go, in which case starting anything
+ * else on it is pointless. Called with job_lock held
+ */
+static bool soc_nna_job_abort(struct soc_nna *pnna, struct soc_nna_job_entry *entry, int status, ktime_t now)
+{
+	bool stopped = false;
+
+	soc_nna_job_stop(pnna, entry);
+	stopped = !soc_nna_job_busy(pnna, entry);
+	entry->status = status;
+	soc_nna_job_finish(pnna, entry, now);
+	wake_up(&pnna->job_wait);
+
+	return stopped;
+}
+
+/* Retire every queued job with status without starting it. Called with job_lock held */
+static void soc_nna_job_fail_queue(struct soc_nna *pnna, int status, ktime_t now)
+{
+	struct soc_nna_job_entry *entry = NULL;
+
+	while (!list_empty(&pnna->job_queue)) {
+		entry = list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list);
+		entry->started = now;
+		entry->status = status;
+		soc_nna_job_finish(pnna, entry, now);
+	}
+	wake_up(&pnna->job_wait);
+}
+
+/*
+ * The platform declares no NNA DMA interrupt, so the running job is polled
+ * from an hrtimer that only runs while the queue is not empty. The next
+ * queued job is started from here, without a round trip through userspace.
+ * A job that overstays job_timeout_ms is stopped before the next one is
+ * written to the channels; if the channels will not stop, the rest of the
+ * queue fails with -EIO.
+ */
+static enum hrtimer_restart soc_nna_job_timer(struct hrtimer *timer)
+{
+	struct soc_nna *pnna = container_of(timer, struct soc_nna, job_timer);
+	struct soc_nna_job_entry *entry = NULL;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	now = ktime_get();
+	while (!list_empty(&pnna->job_queue)) {
+		entry = list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list);
+		if (soc_nna_job_busy(pnna, entry)) {
+			if (ktime_us_delta(now, entry->started) < (s64)job_timeout_ms * USEC_PER_MSEC) {
+				ret = HRTIMER_RESTART;
+				break;
+			}
+			pnna->job_timeouts++;
+			dev_warn_ratelimited(pnna->mdev.this_device, "%s(%d): job %u timed out\n", __func__, __LINE__, entry->job.seq);
+			if (!soc_nna_job_abort(pnna, entry, -ETIMEDOUT, now)) {
+				soc_nna_job_fail_queue(pnna, -EIO, now);
+				break;
+			}
+		} else {
+			soc_nna_job_finish(pnna, entry, now);
+			wake_up(&pnna->job_wait);
+		}
+
+		if (!list_empty(&pnna->job_queue))
+			soc_nna_job_start(pnna, list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list));
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	if (ret == HRTIMER_RESTART)
+		hrtimer_forward_now(timer, soc_nna_job_period());
+
+	return ret;
+}
+
+long soc_nna_job_submit(struct soc_nna *pnna, struct file *file, long usr_arg)
+{
+	struct soc_nna_job_entry *entry = NULL;
+	struct soc_nna_job job;
+	unsigned long flags;
+	bool kick = false;
+
+	if (copy_from_user(&job, (void *)usr_arg, sizeof(job))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	if (!(job.flags & (SOC_NNA_JOB_RD | SOC_NNA_JOB_WR)) || (job.flags & ~(SOC_NNA_JOB_RD | SOC_NNA_JOB_WR)))
+		return -EINVAL;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (list_empty(&pnna->job_free)) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		return -EAGAIN;
+	}
+	/* with nothing queued, a busy channel is running a RDCH_START/WRCH_START chain */
+	if (list_empty(&pnna->job_queue) && soc_nna_chn_busy(pnna, job.flags)) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		return -EBUSY;
+	}
+	entry = list_first_entry(&pnna->job_free, struct soc_nna_job_entry, list);
+	job.seq = ++pnna->job_seq;
+	entry->job = job;
+	entry->file = file;
+	entry->status = 0;
+	entry->queued = ktime_get();
+	list_move_tail(&entry->list, &pnna->job_queue);
+	if (list_is_singular(&pnna->job_queue)) {
+		soc_nna_job_start(pnna, entry);
+		kick = true;
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	if (kick)
+		hrtimer_start(&pnna->job_timer, soc_nna_job_period(), HRTIMER_MODE_REL);
+
+	if (copy_to_user((void *)usr_arg, &job, sizeof(job))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static bool soc_nna_job_running_for(struct soc_nna *pnna, struct file *file)
+{
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	ret = !list_empty(&pnna->job_queue)
+		&& list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list)->file == file;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return ret;
+}
+
+/*
+ * Forget what file queued. A job of file's already on the channels is
+ * given job_timeout_ms to finish and stopped otherwise, so the buffers it
+ * reads and writes can be freed once this returns.
+ */
+static void soc_nna_job_release(struct soc_nna *pnna, struct file *file)
+{
+	struct soc_nna_job_entry *entry = NULL, *n = NULL, *running = NULL;
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pnna->job_queue))
+		running = list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list);
+	list_for_each_entry_safe(entry, n, &pnna->job_queue, list) {
+		if (entry != running && entry->file == file)
+			list_move(&entry->list, &pnna->job_free);
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	wait_event_timeout(pnna->job_wait, !soc_nna_job_running_for(pnna, file), msecs_to_jiffies(job_timeout_ms));
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pnna->job_queue)) {
+		entry = list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list);
+		if (entry->file == file) {
+			entry->file = NULL;
+			now = ktime_get();
+			if (!soc_nna_job_abort(pnna, entry, -ECANCELED, now))
+				soc_nna_job_fail_queue(pnna, -EIO, now);
+			else if (!list_empty(&pnna->job_queue))
+				soc_nna_job_start(pnna, list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list));
+		}
+	}
+	list_for_each_entry_safe(entry, n, &pnna->job_done, list) {
+		if (entry->file == file)
+			list_move(&entry->list, &pnna->job_free);
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+}
+
+static bool soc_nna_job_idle(struct soc_nna *pnna)
+{
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	ret = list_empty(&pnna->job_queue);
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return ret;
+}
+
+/*
+ * Last close: give whatever is still on the channels job_timeout_ms to
+ * finish, stop it otherwise, and make sure the poll timer is gone before
+ * the buffers are freed and the clocks turned off.
+ */
+static void soc_nna_job_drain(struct soc_nna *pnna)
+{
+	unsigned long flags;
+	ktime_t now;
+
+	wait_event_timeout(pnna->job_wait, soc_nna_job_idle(pnna), msecs_to_jiffies(job_timeout_ms));
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pnna->job_queue)) {
+		now = ktime_get();
+		soc_nna_job_abort(pnna, list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list), -ECANCELED, now);
+		soc_nna_job_fail_queue(pnna, -ECANCELED, now);
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	hrtimer_cancel(&pnna->job_timer);
+}
+
 long soc_nna_rdchn_start(struct soc_nna *pnna, long usr_arg)
 {
 	dma_addr_t dma_addr = 0;
+	unsigned long flags;
 
 	if (copy_from_user(&dma_addr, (void *)usr_arg, sizeof(dma_addr_t))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
 		return -EFAULT;
 	}
 
+	/* under job_lock, so a JOB_SUBMIT cannot start on the channel in between */
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pnna->job_queue)) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		return -EBUSY;
+	}
 	soc_nna_writel(pnna, NNA_DMA_RCFG, ((dma_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
 
 	return 0;
 }
@@ -474,13 +1150,21 @@ long soc_nna_rdchn_start(struct soc_nna *pnna, long usr_arg)
 long soc_nna_wrchn_start(struct soc_nna *pnna, long usr_arg)
 {
 	dma_addr_t dma_addr = 0;
+	unsigned long flags;
 
 	if (copy_from_user(&dma_addr, (void *)usr_arg, sizeof(dma_addr_t))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
 		return -EFAULT;
 	}
 
+	/* under job_lock, so a JOB_SUBMIT cannot start on the channel in between */
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pnna->job_queue)) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		return -EBUSY;
+	}
 	soc_nna_writel(pnna, NNA_DMA_WCFG, ((dma_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
 
 	return 0;
 }
@@ -508,6 +1192,217 @@ int soc_nna_version(struct soc_nna *pnna, long usr_arg)
 	return ret;
 }
 
+/* Where the ORAM left over by the L2 cache starts and how big it is, as soc_nna_mmap() works it out */
+static void soc_nna_oram_region(unsigned int *base, unsigned int *size)
+{
+#if defined(CONFIG_SOC_T40) || defined(CONFIG_SOC_A1)
+	unsigned int l2cache_size = 0;
+
+	switch ((*((volatile unsigned int *)(0xb2200060)) & 0x1c00) >> 10) {
+		case 1:
+			l2cache_size = 128;
+			break;
+		case 2:
+			l2cache_size = 256;
+			break;
+		case 3:
+			l2cache_size = 512;
+			break;
+		case 4:
+			l2cache_size = 1024;
+			break;
+		default:
+			break;
+	}
+#endif
+
+#ifdef CONFIG_SOC_A1
+	*base = 0x12600000 + l2cache_size * 1024;
+#else
+	*base = 0x12620000;
+#endif
+
+#if defined(CONFIG_SOC_T41)
+	*size = 384 * 1024;
+#elif defined(CONFIG_SOC_T40) || defined(CONFIG_SOC_A1)
+	*size = l2cache_size ? (1024 - l2cache_size) * 1024 : NNA_ORAM_BASE_SIZE;
+#else
+	*size = NNA_ORAM_BASE_SIZE;
+#endif
+}
+
+/* First fit over the gaps between the blocks already handed out */
+long soc_nna_oram_alloc(struct soc_nna *pnna, struct file *file, long usr_arg)
+{
+	struct soc_nna_oram_block *blk = NULL, *pos = NULL;
+	struct list_head *prev = NULL;
+	struct soc_nna_oram_buf buf;
+	unsigned int align = 0, size = 0, start = 0;
+
+	if (copy_from_user(&buf, (void *)usr_arg, sizeof(buf))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	align = max_t(unsigned int, buf.align, 1U << SOC_NNA_ADDR_ALIGN_BIT);
+	if (!buf.size || buf.size > pnna->oram_size || !is_power_of_2(align))
+		return -EINVAL;
+	size = ALIGN(buf.size, 1U << SOC_NNA_ADDR_ALIGN_BIT);
+
+	blk = kmalloc(sizeof(*blk), GFP_KERNEL);
+	if (!blk)
+		return -ENOMEM;
+
+	mutex_lock(&pnna->mlock);
+	prev = &pnna->oram_blocks;
+	list_for_each_entry(pos, &pnna->oram_blocks, list) {
+		if (ALIGN(start, align) + size <= pos->offset)
+			break;
+		start = pos->offset + pos->size;
+		prev = &pos->list;
+	}
+	start = ALIGN(start, align);
+	if (start + size > pnna->oram_size) {
+		mutex_unlock(&pnna->mlock);
+		kfree(blk);
+		return -ENOMEM;
+	}
+
+	blk->file = file;
+	blk->tgid = current->tgid;
+	blk->offset = start;
+	blk->size = size;
+	list_add(&blk->list, prev);
+	pnna->oram_used += size;
+	mutex_unlock(&pnna->mlock);
+
+	buf.size = size;
+	buf.offset = start;
+	buf.paddr = pnna->oram_base + start;
+	if (copy_to_user((void *)usr_arg, &buf, sizeof(buf))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		mutex_lock(&pnna->mlock);
+		list_del(&blk->list);
+		pnna->oram_used -= size;
+		mutex_unlock(&pnna->mlock);
+		kfree(blk);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+long soc_nna_oram_free(struct soc_nna *pnna, struct file *file, long usr_arg)
+{
+	struct soc_nna_oram_block *blk = NULL;
+	struct soc_nna_oram_buf buf;
+	long ret = -EINVAL;
+
+	if (copy_from_user(&buf, (void *)usr_arg, sizeof(buf))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	mutex_lock(&pnna->mlock);
+	list_for_each_entry(blk, &pnna->oram_blocks, list) {
+		if (blk->offset == buf.offset && blk->file == file) {
+			list_del(&blk->list);
+			pnna->oram_used -= blk->size;
+			kfree(blk);
+			ret = 0;
+			break;
+		}
+	}
+	mutex_unlock(&pnna->mlock);
+
+	return ret;
+}
+
+static void soc_nna_oram_release(struct soc_nna *pnna, struct file *file)
+{
+	struct soc_nna_oram_block *blk = NULL, *n = NULL;
+
+	mutex_lock(&pnna->mlock);
+	list_for_each_entry_safe(blk, n, &pnna->oram_blocks, list) {
+		if (blk->file == file) {
+			list_del(&blk->list);
+			pnna->oram_used -= blk->size;
+			kfree(blk);
+		}
+	}
+	mutex_unlock(&pnna->mlock);
+}
+
+static int soc_nna_oram_show(struct seq_file *m, void *v)
+{
+	struct soc_nna *pnna = m->private;
+	struct soc_nna_oram_block *blk = NULL, *other = NULL;
+	unsigned int start = 0, gap = 0, gaps = 0, largest = 0;
+	unsigned int bytes = 0, blocks = 0;
+	bool seen = false;
+
+	mutex_lock(&pnna->mlock);
+	seq_printf(m, "base 0x%08x size %u used %u free %u\n", pnna->oram_base, pnna->oram_size,
+			pnna->oram_used, pnna->oram_size - pnna->oram_used);
+
+	list_for_each_entry(blk, &pnna->oram_blocks, list) {
+		gap = blk->offset - start;
+		if (gap) {
+			gaps++;
+			largest = max(largest, gap);
+		}
+		start = blk->offset + blk->size;
+	}
+	gap = pnna->oram_size - start;
+	if (gap) {
+		gaps++;
+		largest = max(largest, gap);
+	}
+	seq_printf(m, "free extents %u largest %u\n", gaps, largest);
+
+	seq_printf(m, "%-8s %10s %8s\n", "pid", "bytes", "blocks");
+	list_for_each_entry(blk, &pnna->oram_blocks, list) {
+		seen = false;
+		list_for_each_entry(other, &pnna->oram_blocks, list) {
+			if (other == blk)
+				break;
+			if (other->tgid == blk->tgid) {
+				seen = true;
+				break;
+			}
+		}
+		if (seen)
+			continue;
+
+		bytes = 0;
+		blocks = 0;
+		other = blk;
+		list_for_each_entry_from(other, &pnna->oram_blocks, list) {
+			if (other->tgid == blk->tgid) {
+				bytes += other->size;
+				blocks++;
+			}
+		}
+		seq_printf(m, "%-8d %10u %8u\n", blk->tgid, bytes, blocks);
+	}
+	mutex_unlock(&pnna->mlock);
+
+	return 0;
+}
+
+static int soc_nna_oram_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, soc_nna_oram_show, PDE_DATA(inode));
+}
+
+static const struct file_operations soc_nna_oram_proc_fops = {
+	.owner          = THIS_MODULE,
+	.open           = soc_nna_oram_proc_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
 static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	long ret = -1;
@@ -516,7 +1411,10 @@ static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned
 
 	switch (cmd) {
 		case IOCTL_SOC_NNA_MALLOC:
-			ret = soc_nna_malloc(pnna, arg);
+			ret = soc_nna_malloc(pnna, file, arg);
+			break;
+		case IOCTL_SOC_NNA_MALLOC_BATCH:
+			ret = soc_nna_malloc_batch(pnna, file, arg);
 			break;
 		case IOCTL_SOC_NNA_FREE:
 			ret = soc_nna_free(pnna, arg);
@@ -524,8 +1422,14 @@ static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned
 		case IOCTL_SOC_NNA_FLUSHCACHE:
 			ret = soc_nna_flushcache(pnna, arg);
 			break;
+		case IOCTL_SOC_NNA_FLUSHCACHE_BATCH:
+			ret = soc_nna_flushcache_batch(pnna, arg);
+			break;
 		case IOCTL_SOC_NNA_SETUP_DES:
-			ret = soc_nna_setup_des(pnna, arg);
+			ret = soc_nna_setup_des(pnna, file, arg);
+			break;
+		case IOCTL_SOC_NNA_DES_CACHE_FLUSH:
+			ret = soc_nna_des_cache_flush(pnna, file, arg);
 			break;
 		case IOCTL_SOC_NNA_RDCH_START:
 			ret = soc_nna_rdchn_start(pnna, arg);
@@ -533,6 +1437,15 @@ static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned
 		case IOCTL_SOC_NNA_WRCH_START:
 			ret = soc_nna_wrchn_start(pnna, arg);
 			break;
+		case IOCTL_SOC_NNA_JOB_SUBMIT:
+			ret = soc_nna_job_submit(pnna, file, arg);
+			break;
+		case IOCTL_SOC_NNA_ORAM_ALLOC:
+			ret = soc_nna_oram_alloc(pnna, file, arg);
+			break;
+		case IOCTL_SOC_NNA_ORAM_FREE:
+			ret = soc_nna_oram_free(pnna, file, arg);
+			break;
 		case IOCTL_SOC_NNA_VERSION:
 			ret = soc_nna_version(pnna, arg);
 			break;
@@ -781,6 +1694,7 @@ static int soc_nna_probe(struct platform_device *pdev)
 	struct soc_nna *pnna = NULL;
 	struct resource *res = NULL;
 	unsigned int oram_clk = 0;
+	int i = 0;
 
 	pnna = (struct soc_nna *)kzalloc(sizeof(struct soc_nna), GFP_KERNEL);
 	if (!pnna) {
@@ -804,6 +1718,20 @@ static int soc_nna_probe(struct platform_device *pdev)
 	mutex_init(&pnna->mlock);
 
 	INIT_LIST_HEAD(&pnna->memory_list);
+	hash_init(pnna->memory_hash);
+	INIT_LIST_HEAD(&pnna->des_programs);
+
+	spin_lock_init(&pnna->job_lock);
+	INIT_LIST_HEAD(&pnna->job_free);
+	INIT_LIST_HEAD(&pnna->job_queue);
+	INIT_LIST_HEAD(&pnna->job_done);
+	INIT_LIST_HEAD(&pnna->oram_blocks);
+	for (i = 0; i < SOC_NNA_JOB_QUEUE_MAX; i++)
+		list_add_tail(&pnna->jobs[i].list, &pnna->job_free);
+	init_waitqueue_head(&pnna->job_wait);
+	hrtimer_init(&pnna->job_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pnna->job_timer.function = soc_nna_job_timer;
+
 	pnna->memory_cache = kmem_cache_create(pnna->name, sizeof(struct soc_nna_memory_cache), 0, SLAB_HWCACHE_ALIGN, NULL);
 	if (!pnna->memory_cache) {
 		printk("%s:kmem_cache_create failed\n", __func__);
@@ -866,6 +1794,14 @@ static int soc_nna_probe(struct platform_device *pdev)
 
 	oram_clk = *(volatile unsigned int*)0xb2200060;
 	*(volatile unsigned int *)0xb2200060 = oram_clk | (1 << 5);
+
+	soc_nna_oram_region(&pnna->oram_base, &pnna->oram_size);
+	pnna->proc = proc_mkdir("soc-nna", NULL);
+	if (pnna->proc)
+		proc_create_data("oram", S_IRUGO, pnna->proc, &soc_nna_oram_proc_fops, pnna);
+	else
+		dev_warn(&pdev->dev, "create /proc/soc-nna failed\n");
+
 	printk("@@@@ soc nna probe sucess (Board: %s, Version: %s) @@@\n", SOC_NNA_BORD, SOC_NNA_VERSION);
 
 	return 0;
@@ -896,6 +1832,11 @@ static int __exit soc_nna_remove(struct platform_device *pdev)
 	struct soc_nna *pnna = platform_get_drvdata(pdev);
 	if (pnna) {
 		misc_deregister(&pnna->mdev);
+		if (pnna->proc) {
+			remove_proc_entry("oram", pnna->proc);
+			remove_proc_entry("soc-nna", NULL);
+		}
+		hrtimer_cancel(&pnna->job_timer);
 #ifndef CPU_SIMULATOR
 		clk_put(pnna->clk_gate);
 		clk_put(pnna->clk);
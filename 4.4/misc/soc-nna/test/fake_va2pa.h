@@ -0,0 +1,21 @@
+#ifndef __FAKE_VA2PA_H__
+#define __FAKE_VA2PA_H__
+
+/*
+ * Host stand-in for the MIPS address translation: user addresses are
+ * mapped per 16 MiB region, and a test can move a region to model a
+ * buffer being unmapped and mapped again somewhere else.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned int fake_va2pa(unsigned int vaddr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define NNADMA_VA_2_PA(vaddr, paddr) ((paddr) = fake_va2pa((unsigned int)(vaddr)))
+
+#endif
@@ -0,0 +1,2 @@
+/* Host build: the descriptor builder only needs memset() and memcpy() */
+#include <string.h>
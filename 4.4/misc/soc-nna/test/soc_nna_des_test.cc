@@ -0,0 +1,207 @@
+/*
+ * Host test for the soc-nna descriptor program builder.
+ *
+ * SETUP_DES replays a remembered program when the commands match and the
+ * addresses they point at still translate to the physical addresses the
+ * program was built from. This checks that such a replay is bit-identical
+ * to building the program again, that remapping any buffer the commands
+ * use changes the translation the driver compares, and times a build
+ * against a replay.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fake_va2pa.h"
+extern "C" {
+#include "soc_nna_des.h"
+}
+
+#define REGION_SHIFT    24
+#define REGION_NUM      256
+#define DDR_REGION      0x01            /* regions 0x01..0x04 hold DDR buffers */
+#define DDR_REGIONS     4
+#define ORAM_REGION     0x20
+
+static unsigned int region_base[REGION_NUM];
+
+extern "C" unsigned int fake_va2pa(unsigned int vaddr)
+{
+	return region_base[vaddr >> REGION_SHIFT] + (vaddr & ((1 << REGION_SHIFT) - 1));
+}
+
+static void reset_mapping(void)
+{
+	int i;
+
+	for (i = 0; i < REGION_NUM; i++)
+		region_base[i] = 0x02000000 + i * 0x00100000;
+	region_base[ORAM_REGION] = NNA_ORAM_BASE_ADDR;
+}
+
+struct cmd_set {
+	std::vector<nna_dma_cmd_t> cmd;
+	unsigned int rd_cmd_cnt;
+	unsigned int wr_cmd_cnt;
+};
+
+static void gen_cmds(std::mt19937 &rng, std::vector<nna_dma_cmd_t> &out, unsigned int cnt, unsigned int max_bytes)
+{
+	unsigned int i;
+
+	for (i = 0; i < cnt; i++) {
+		nna_dma_cmd_t c;
+		unsigned int region = DDR_REGION + rng() % DDR_REGIONS;
+
+		c.data_bytes = 64 * (1 + rng() % (max_bytes / 64));
+		c.d_va_st_addr = (region << REGION_SHIFT) + 64 * (rng() % 0x10000);
+		c.o_mlc_bytes = 65536 * (1 + rng() % 3);
+		c.o_va_mlc_addr = (ORAM_REGION << REGION_SHIFT) + 64 * (rng() % 0x1000);
+		c.o_va_st_addr = c.o_va_mlc_addr + 64 * (rng() % (c.o_mlc_bytes / 64));
+		c.des_link = (i + 1 < cnt) && (rng() % 4 != 0);
+		out.push_back(c);
+	}
+}
+
+static cmd_set gen_set(unsigned int seed, unsigned int rd_cnt, unsigned int wr_cnt, unsigned int max_bytes)
+{
+	std::mt19937 rng(seed);
+	cmd_set set;
+
+	set.rd_cmd_cnt = rd_cnt;
+	set.wr_cmd_cnt = wr_cnt;
+	gen_cmds(rng, set.cmd, rd_cnt, max_bytes);
+	gen_cmds(rng, set.cmd, wr_cnt, max_bytes);
+
+	return set;
+}
+
+struct program {
+	std::vector<unsigned long long int> des;
+	std::vector<unsigned int> chn;
+	des_gen_result_t rslt;
+};
+
+static nna_dma_des_info_t des_info[2];
+static unsigned long long int des_build[SOC_NNA_MAX_DES_CHN_CNT];
+static unsigned int d_va_chn[SOC_NNA_MAX_CHN_CNT];
+
+/* What soc_nna_setup_des() does on a miss */
+static program build(cmd_set &set)
+{
+	program p;
+	int des_cnt;
+
+	soc_nna_analysis_des(0, set.rd_cmd_cnt, set.cmd.data(), &des_info[0]);
+	soc_nna_analysis_des(0, set.wr_cmd_cnt, set.cmd.data() + set.rd_cmd_cnt, &des_info[1]);
+	des_cnt = soc_nna_update_des(des_info, des_build, d_va_chn, &p.rslt);
+
+	p.des.assign(des_build, des_build + des_cnt);
+	p.chn.assign(d_va_chn, d_va_chn + 2 * p.rslt.dma_chn_num);
+
+	return p;
+}
+
+/* What soc_nna_des_translate() records and compares before a replay */
+static std::vector<unsigned int> translate(cmd_set &set)
+{
+	std::vector<unsigned int> pa(set.cmd.size() * SOC_NNA_DES_CMD_PAS, 0);
+
+	soc_nna_translate_des(0, set.rd_cmd_cnt, set.cmd.data(), pa.data());
+	soc_nna_translate_des(0, set.wr_cmd_cnt, set.cmd.data() + set.rd_cmd_cnt,
+			pa.data() + set.rd_cmd_cnt * SOC_NNA_DES_CMD_PAS);
+
+	return pa;
+}
+
+static bool same_program(const program &a, const program &b)
+{
+	return a.des == b.des && a.chn == b.chn && !memcmp(&a.rslt, &b.rslt, sizeof(a.rslt));
+}
+
+TEST(SocNnaDes, ReplayMatchesRebuild)
+{
+	unsigned int seed;
+
+	for (seed = 0; seed < 200; seed++) {
+		cmd_set set = gen_set(seed, 1 + seed % 64, 1 + seed % 48, 3 * 65536);
+
+		reset_mapping();
+		program saved = build(set);
+		std::vector<unsigned int> saved_pa = translate(set);
+
+		/* same commands, nothing remapped: the driver replays saved */
+		ASSERT_EQ(translate(set), saved_pa) << "seed " << seed;
+		ASSERT_TRUE(same_program(build(set), saved)) << "seed " << seed;
+	}
+}
+
+TEST(SocNnaDes, RemapIsDetected)
+{
+	unsigned int seed, k;
+
+	for (seed = 0; seed < 200; seed++) {
+		cmd_set set = gen_set(seed, 1 + seed % 64, 1 + seed % 48, 3 * 65536);
+
+		reset_mapping();
+		program saved = build(set);
+		std::vector<unsigned int> saved_pa = translate(set);
+
+		/* the DDR buffer behind one command moves */
+		k = seed % set.cmd.size();
+		region_base[set.cmd[k].d_va_st_addr >> REGION_SHIFT] += 0x00800000;
+		ASSERT_NE(translate(set), saved_pa) << "seed " << seed;
+		ASSERT_FALSE(same_program(build(set), saved)) << "seed " << seed;
+
+		/* the ORAM view moves */
+		reset_mapping();
+		region_base[ORAM_REGION] += 0x10000;
+		ASSERT_NE(translate(set), saved_pa) << "seed " << seed;
+		ASSERT_FALSE(same_program(build(set), saved)) << "seed " << seed;
+
+		/* a buffer the commands do not use moves: still a replay */
+		reset_mapping();
+		region_base[0x40] += 0x00800000;
+		ASSERT_EQ(translate(set), saved_pa) << "seed " << seed;
+		ASSERT_TRUE(same_program(build(set), saved)) << "seed " << seed;
+	}
+}
+
+TEST(SocNnaDes, Benchmark)
+{
+	const int rounds = 2000;
+	cmd_set set = gen_set(1, 400, 400, 65536);
+	std::vector<unsigned long long int> dmamem(SOC_NNA_MAX_DES_CHN_CNT);
+	std::chrono::steady_clock::time_point t0, t1, t2;
+	unsigned int mismatches = 0;
+	int i;
+
+	reset_mapping();
+	program saved = build(set);
+	std::vector<unsigned int> saved_pa = translate(set);
+
+	t0 = std::chrono::steady_clock::now();
+	for (i = 0; i < rounds; i++) {
+		program p = build(set);
+		memcpy(dmamem.data(), p.des.data(), p.des.size() * sizeof(p.des[0]));
+	}
+	t1 = std::chrono::steady_clock::now();
+	for (i = 0; i < rounds; i++) {
+		std::vector<unsigned int> pa = translate(set);
+		mismatches += memcmp(pa.data(), saved_pa.data(), pa.size() * sizeof(pa[0])) != 0;
+		memcpy(dmamem.data(), saved.des.data(), saved.des.size() * sizeof(saved.des[0]));
+		memcpy(d_va_chn, saved.chn.data(), saved.chn.size() * sizeof(saved.chn[0]));
+	}
+	t2 = std::chrono::steady_clock::now();
+
+	EXPECT_EQ(mismatches, 0u);
+	printf("%zu commands, %zu descriptors: build %.2f us, checked replay %.2f us\n",
+			set.cmd.size(), saved.des.size(),
+			std::chrono::duration<double, std::micro>(t1 - t0).count() / rounds,
+			std::chrono::duration<double, std::micro>(t2 - t1).count() / rounds);
+}
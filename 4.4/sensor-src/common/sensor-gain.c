@@ -0,0 +1,71 @@
+#include <linux/kernel.h>
+#include <sensor-gain.h>
+
+static unsigned int lut_field(const struct sensor_gain_lut *lut, int i, unsigned short offset, unsigned char size) {
+	const unsigned char *p = (const unsigned char *) lut->table + i * lut->stride + offset;
+
+	switch (size) {
+		case 1:
+			return *p;
+		case 2:
+			return *(const uint16_t *) p;
+		default:
+			return *(const uint32_t *) p;
+	}
+}
+
+static unsigned int lut_gain(const struct sensor_gain_lut *lut, int i) {
+	return lut_field(lut, i, lut->gain_offset, sizeof(uint32_t));
+}
+
+/* First row in [0, n) whose gain is above (or with 'equal', at least) gain */
+static int lut_search(const struct sensor_gain_lut *lut, int n, unsigned int gain, int equal) {
+	int lo = 0;
+	int hi = n;
+	int mid;
+	unsigned int g;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		g = lut_gain(lut, mid);
+		if (g < gain || (!equal && g == gain))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Binary search replacement for the per-driver sensor_alloc_again() scan.
+ * It picks the same row: the largest gain not above isp_gain, limited to
+ * rows up to max_gain, and the max_gain row once isp_gain reaches it. When
+ * the scan would have fallen through, isp_gain comes back and *value is
+ * left alone, as before.
+ */
+unsigned int sensor_gain_alloc(const struct sensor_gain_lut *lut, unsigned int max_gain,
+			       unsigned int isp_gain, unsigned int *value) {
+	int n = lut_search(lut, lut->count, max_gain, 0);
+	int i;
+
+	if (!n)
+		return isp_gain;
+
+	if (isp_gain == 0) {
+		i = 0;
+	} else if (isp_gain >= max_gain) {
+		i = lut_search(lut, n, max_gain, 1);
+		if (i == n)
+			return isp_gain;
+	} else {
+		i = lut_search(lut, n, isp_gain, 0);
+		if (i == n)
+			return isp_gain;
+		if (i)
+			i--;
+	}
+
+	*value = lut_field(lut, i, lut->value_offset, lut->value_size);
+	return lut_gain(lut, i);
+}
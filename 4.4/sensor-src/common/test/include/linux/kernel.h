@@ -0,0 +1,11 @@
+/* Host build: what sensor-gain.c and sensor-regs.c use from the kernel */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+#define pr_info(fmt, ...)  printf(fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...) do { } while (0)
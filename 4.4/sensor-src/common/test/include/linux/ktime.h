@@ -0,0 +1,8 @@
+/* Host build: sensor_expo_commit() only times its transfer */
+#include <stdint.h>
+
+typedef int64_t ktime_t;
+
+static inline ktime_t ktime_get(void) { return 0; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline int64_t ktime_to_us(ktime_t t) { return t / 1000; }
@@ -0,0 +1,3 @@
+/* Host build: the uapi header plus memmove() and memset() */
+#include_next <linux/string.h>
+#include <string.h>
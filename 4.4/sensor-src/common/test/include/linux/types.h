@@ -0,0 +1,5 @@
+/* Host build: the uapi types plus the ones the kernel adds */
+#include_next <linux/types.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
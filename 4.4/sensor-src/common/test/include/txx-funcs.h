@@ -0,0 +1,18 @@
+/* Host build: the test provides the bus and the sleep */
+#ifndef TEST_TXX_FUNCS_H
+#define TEST_TXX_FUNCS_H
+
+#include <linux/i2c.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int private_i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num);
+void private_msleep(unsigned int msecs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
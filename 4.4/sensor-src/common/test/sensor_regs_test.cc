@@ -0,0 +1,358 @@
+/*
+ * Host test for the merged register table writer.
+ *
+ * sensor_write_table() folds runs of consecutive registers into one
+ * auto-increment message and several messages into one i2c_transfer().
+ * A fake sensor on a fake bus applies every message the way the chip
+ * does, and each table is also written one register per transfer, the
+ * way sensor_write_array() used to. Both must leave the same register
+ * image, in the same order, with every delay at the same point.
+ */
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <linux/kernel.h>
+#include <sensor-regs.h>
+#include <txx-funcs.h>
+}
+
+#include "gc2053_regs.h"
+#include "sc2336_regs.h"
+
+#define CLIENT_ADDR     0x37
+#define DELAY_EVENT     0xffffffffu
+
+struct fake_sensor {
+	int addr_bytes;
+	int page_reg;
+	unsigned char page;
+
+	/* (page << 8 | reg) on paged sensors, as the regs cache keys them */
+	std::map<unsigned int, unsigned char> image;
+	/* every write and every sleep, in bus order */
+	std::vector<std::pair<unsigned int, unsigned int> > events;
+	unsigned int xfers;
+	unsigned int msgs;
+	unsigned int bytes;
+	unsigned int bad_msgs;
+
+	fake_sensor(int addr_bytes, int page_reg)
+		: addr_bytes(addr_bytes), page_reg(page_reg), page(0),
+		  xfers(0), msgs(0), bytes(0), bad_msgs(0) {}
+
+	void write(unsigned int reg, unsigned char val)
+	{
+		unsigned int key = reg;
+
+		if (page_reg != SENSOR_REGS_NO_PAGE && addr_bytes == 1 && reg != (unsigned int)page_reg)
+			key |= page << 8;
+		if (page_reg != SENSOR_REGS_NO_PAGE && reg == (unsigned int)page_reg)
+			page = val;
+		image[key] = val;
+		events.push_back(std::make_pair(key, (unsigned int)val));
+	}
+};
+
+static fake_sensor *sensor;
+static struct i2c_adapter adapter;
+static struct i2c_client client = { CLIENT_ADDR, &adapter };
+
+extern "C" int private_i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	unsigned int reg, i;
+	int n;
+
+	sensor->xfers++;
+	for (n = 0; n < num; n++) {
+		struct i2c_msg *msg = &msgs[n];
+
+		sensor->msgs++;
+		sensor->bytes += 1 + msg->len;	/* slave address, register address, data */
+		if (adap != &adapter || msg->addr != CLIENT_ADDR || msg->flags ||
+		    msg->len <= sensor->addr_bytes) {
+			sensor->bad_msgs++;
+			continue;
+		}
+
+		reg = msg->buf[0];
+		if (sensor->addr_bytes == 2)
+			reg = reg << 8 | msg->buf[1];
+		for (i = sensor->addr_bytes; i < msg->len; i++, reg++) {
+			/* the address wraps, or a page switch lands inside a burst */
+			if ((sensor->addr_bytes == 1 && reg > 0xff) ||
+			    (reg == (unsigned int)sensor->page_reg && msg->len > sensor->addr_bytes + 1))
+				sensor->bad_msgs++;
+			sensor->write(reg, msg->buf[i]);
+		}
+	}
+
+	return num;
+}
+
+extern "C" void private_msleep(unsigned int msecs)
+{
+	sensor->events.push_back(std::make_pair(DELAY_EVENT, msecs));
+}
+
+/* What sensor_write_array() did before: one sensor_write() per entry */
+template <typename Entry>
+static void write_one_by_one(const struct sensor_regs_config *cfg, const Entry *vals)
+{
+	unsigned char buf[3];
+	struct i2c_msg msg;
+
+	for (; vals->reg_num != cfg->reg_end; vals++) {
+		if (vals->reg_num == cfg->reg_delay) {
+			private_msleep(vals->value);
+			continue;
+		}
+		msg.addr = CLIENT_ADDR;
+		msg.flags = 0;
+		msg.buf = buf;
+		msg.len = 0;
+		if (cfg->addr_bytes == 2)
+			buf[msg.len++] = vals->reg_num >> 8;
+		buf[msg.len++] = vals->reg_num & 0xff;
+		buf[msg.len++] = vals->value;
+		private_i2c_transfer(&adapter, &msg, 1);
+	}
+}
+
+struct result {
+	fake_sensor old_way;
+	fake_sensor new_way;
+	struct sensor_regs_stats stats;
+
+	explicit result(const struct sensor_regs_config *cfg)
+		: old_way(cfg->addr_bytes, cfg->page_reg),
+		  new_way(cfg->addr_bytes, cfg->page_reg), stats() {}
+};
+
+template <typename Entry>
+static result compare(const struct sensor_regs_config *cfg, const Entry *vals)
+{
+	result r(cfg);
+
+	sensor = &r.old_way;
+	write_one_by_one(cfg, vals);
+
+	sensor = &r.new_way;
+	EXPECT_EQ(sensor_write_table(&client, cfg, vals, &r.stats), 0);
+
+	EXPECT_EQ(r.new_way.bad_msgs, 0u);
+	EXPECT_TRUE(r.new_way.image == r.old_way.image);
+	EXPECT_TRUE(r.new_way.events == r.old_way.events);
+	EXPECT_EQ(r.stats.regs, r.old_way.msgs);
+	EXPECT_EQ(r.stats.msgs, r.new_way.msgs);
+	EXPECT_EQ(r.stats.xfers, r.new_way.xfers);
+
+	return r;
+}
+
+static void report(const char *name, const result &r)
+{
+	printf("%-40s %4u regs: %4u -> %3u transfers, %4u -> %4u bus bytes\n", name,
+	       r.stats.regs, r.old_way.xfers, r.new_way.xfers, r.old_way.bytes, r.new_way.bytes);
+}
+
+TEST(SensorRegs, Gc2053InitTables)
+{
+	const struct sensor_regs_config cfg = {
+		.addr_bytes = 1,
+		.reg_end = gc2053_REG_END,
+		.reg_delay = gc2053_REG_DELAY,
+		.page_reg = 0xfe,
+		.burst_max = 0,
+		.layout = SENSOR_REGS_LAYOUT(struct gc2053_regval_list),
+		.cache = NULL,
+	};
+	char name[64];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(gc2053_init_tables); i++) {
+		result r = compare(&cfg, gc2053_init_tables[i]);
+
+		EXPECT_LT(r.new_way.xfers, r.old_way.xfers);
+		snprintf(name, sizeof(name), "gc2053 table %u", i);
+		report(name, r);
+	}
+}
+
+TEST(SensorRegs, Sc2336InitTables)
+{
+	const struct sensor_regs_config cfg = {
+		.addr_bytes = 2,
+		.reg_end = sc2336_REG_END,
+		.reg_delay = sc2336_REG_DELAY,
+		.page_reg = SENSOR_REGS_NO_PAGE,
+		.burst_max = 0,
+		.layout = SENSOR_REGS_LAYOUT(struct sc2336_regval_list),
+		.cache = NULL,
+	};
+	char name[64];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sc2336_init_tables); i++) {
+		result r = compare(&cfg, sc2336_init_tables[i]);
+
+		EXPECT_LT(r.new_way.xfers, r.old_way.xfers);
+		snprintf(name, sizeof(name), "sc2336 table %u", i);
+		report(name, r);
+	}
+}
+
+struct regval16 {
+	uint16_t reg_num;
+	unsigned char value;
+};
+
+#define REG_END         0xffff
+#define REG_DELAY       0xfffe
+
+static struct sensor_regs_config synthetic_cfg(int addr_bytes, int page_reg, unsigned short burst_max)
+{
+	struct sensor_regs_config cfg = {
+		.addr_bytes = (unsigned char)addr_bytes,
+		.reg_end = REG_END,
+		.reg_delay = REG_DELAY,
+		.page_reg = page_reg,
+		.burst_max = burst_max,
+		.layout = SENSOR_REGS_LAYOUT(struct regval16),
+		.cache = NULL,
+	};
+
+	return cfg;
+}
+
+TEST(SensorRegs, DelayFlushesQueuedWrites)
+{
+	const struct regval16 table[] = {
+		{0x3000, 0x01}, {0x3001, 0x02}, {0x3002, 0x03},
+		{REG_DELAY, 5},
+		{0x3003, 0x04}, {0x3004, 0x05},
+		{REG_DELAY, 10},
+		{REG_DELAY, 1},
+		{0x3005, 0x06},
+		{REG_END, 0},
+	};
+	struct sensor_regs_config cfg = synthetic_cfg(2, SENSOR_REGS_NO_PAGE, 0);
+	result r = compare(&cfg, table);
+
+	/* a consecutive run never reaches across a sleep */
+	EXPECT_EQ(r.new_way.msgs, 3u);
+	EXPECT_EQ(r.new_way.xfers, 3u);
+	ASSERT_EQ(r.new_way.events.size(), 9u);
+	EXPECT_EQ(r.new_way.events[3], std::make_pair(DELAY_EVENT, 5u));
+	EXPECT_EQ(r.new_way.events[6], std::make_pair(DELAY_EVENT, 10u));
+	EXPECT_EQ(r.new_way.events[7], std::make_pair(DELAY_EVENT, 1u));
+}
+
+TEST(SensorRegs, PageRegisterIsNeverMerged)
+{
+	const struct regval16 table[] = {
+		{0xfc, 0x11}, {0xfd, 0x22},
+		{0xfe, 0x01},
+		{0x10, 0x33}, {0x11, 0x44},
+		{0xfe, 0x02},
+		{0x10, 0x55}, {0x11, 0x66},
+		{REG_END, 0},
+	};
+	struct sensor_regs_config cfg = synthetic_cfg(1, 0xfe, 0);
+	std::map<unsigned int, unsigned char> expect = {
+		{0x0fc, 0x11}, {0x0fd, 0x22}, {0x0fe, 0x02},
+		{0x110, 0x33}, {0x111, 0x44},
+		{0x210, 0x55}, {0x211, 0x66},
+	};
+	result r = compare(&cfg, table);
+
+	/* 0xfc-0xfd, page, 0x10-0x11, page, 0x10-0x11 */
+	EXPECT_EQ(r.new_way.msgs, 5u);
+	EXPECT_EQ(r.new_way.xfers, 1u);
+	EXPECT_TRUE(r.new_way.image == expect);
+}
+
+TEST(SensorRegs, LongRunsAreSplit)
+{
+	std::vector<struct regval16> table;
+	struct sensor_regs_config cfg;
+	unsigned int i;
+
+	for (i = 0; i < 100; i++)
+		table.push_back({(uint16_t)(0x3e00 + i), (unsigned char)i});
+	table.push_back({REG_END, 0});
+
+	/* 32 + 32 + 32 + 4 bytes in one transfer */
+	cfg = synthetic_cfg(2, SENSOR_REGS_NO_PAGE, 0);
+	result full = compare(&cfg, table.data());
+	EXPECT_EQ(full.new_way.msgs, 4u);
+	EXPECT_EQ(full.new_way.xfers, 1u);
+
+	/* no merging, SENSOR_REGS_BATCH_MSGS messages per transfer */
+	cfg = synthetic_cfg(2, SENSOR_REGS_NO_PAGE, 1);
+	result single = compare(&cfg, table.data());
+	EXPECT_EQ(single.new_way.msgs, 100u);
+	EXPECT_EQ(single.new_way.xfers, (100u + SENSOR_REGS_BATCH_MSGS - 1) / SENSOR_REGS_BATCH_MSGS);
+}
+
+/* Mostly ascending runs, with jumps, repeats, page switches and sleeps */
+static std::vector<struct regval16> random_table(std::mt19937 &rng, int addr_bytes, int page_reg)
+{
+	std::vector<struct regval16> table;
+	unsigned int limit = addr_bytes == 1 ? 0xf0 : 0x4000;
+	unsigned int reg = rng() % limit;
+	unsigned int n = 1 + rng() % 400;
+	unsigned int i, r;
+
+	for (i = 0; i < n; i++) {
+		r = rng() % 100;
+		if (r < 3) {
+			table.push_back({REG_DELAY, (unsigned char)(rng() % 20)});
+			continue;
+		}
+		if (r < 8 && page_reg != SENSOR_REGS_NO_PAGE) {
+			table.push_back({(uint16_t)page_reg, (unsigned char)(rng() % 4)});
+			continue;
+		}
+		if (r < 18)
+			reg = rng() % limit;
+		else if (r < 21 && reg)
+			reg--;
+		else if (r < 90)
+			reg++;
+		if (reg >= limit)
+			reg = 0;
+		table.push_back({(uint16_t)reg, (unsigned char)rng()});
+	}
+	table.push_back({REG_END, 0});
+
+	return table;
+}
+
+TEST(SensorRegs, RandomTables)
+{
+	const unsigned short bursts[] = { 0, 1, 2, 7, SENSOR_REGS_BURST_MAX };
+	unsigned int old_xfers = 0, new_xfers = 0;
+	std::mt19937 rng(2053);
+	unsigned int seed;
+
+	for (seed = 0; seed < 600; seed++) {
+		int addr_bytes = seed % 2 ? 2 : 1;
+		int page_reg = addr_bytes == 1 && seed % 4 == 0 ? 0xfe : SENSOR_REGS_NO_PAGE;
+		struct sensor_regs_config cfg = synthetic_cfg(addr_bytes, page_reg,
+							      bursts[seed % ARRAY_SIZE(bursts)]);
+		std::vector<struct regval16> table = random_table(rng, addr_bytes, page_reg);
+
+		SCOPED_TRACE(seed);
+		result r = compare(&cfg, table.data());
+		old_xfers += r.old_way.xfers;
+		new_xfers += r.new_way.xfers;
+	}
+	printf("600 random tables: %u -> %u transfers\n", old_xfers, new_xfers);
+}
@@ -0,0 +1,35 @@
+#ifndef SENSOR_GAIN_H
+#define SENSOR_GAIN_H
+
+#include <linux/types.h>
+#include <linux/stddef.h>
+#include <linux/kernel.h>
+
+/*
+ * Description of a driver's again_lut[]. The gain column is the log2
+ * fixed point value the ISP works with and must be ascending. The value
+ * column is what sensor_alloc_again() hands back to the ISP, a register
+ * value or a row index depending on the driver.
+ */
+struct sensor_gain_lut {
+	const void *table;
+	int count;
+	unsigned short stride;
+	unsigned short gain_offset;
+	unsigned short value_offset;
+	unsigned char value_size;
+};
+
+#define SENSOR_GAIN_LUT(lut, value_field) {				\
+	.table = lut,							\
+	.count = ARRAY_SIZE(lut),					\
+	.stride = sizeof((lut)[0]),					\
+	.gain_offset = offsetof(typeof((lut)[0]), gain),		\
+	.value_offset = offsetof(typeof((lut)[0]), value_field),	\
+	.value_size = sizeof((lut)[0].value_field),			\
+}
+
+unsigned int sensor_gain_alloc(const struct sensor_gain_lut *lut, unsigned int max_gain,
+			       unsigned int isp_gain, unsigned int *value);
+
+#endif // SENSOR_GAIN_H
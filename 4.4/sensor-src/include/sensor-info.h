@@ -1,6 +1,8 @@
 #ifndef SENSOR_INFO_H
 #define SENSOR_INFO_H
 
+struct sensor_expo_packet;
+
 struct sensor_info {
 	const char *name;
 	unsigned int chip_id;
@@ -10,6 +12,7 @@ struct sensor_info {
 	unsigned int chip_i2c_addr;
 	int width;
 	int height;
+	struct sensor_expo_packet *expo;	/* optional, adds ae_i2c */
 };
 
 void sensor_common_init(struct sensor_info *info);
@@ -16,6 +16,8 @@
 #include <tx-isp-common.h>
 #include <sensor-common.h>
 #include <sensor-info.h>
+#include <sensor-regs.h>
+#include <sensor-gain.h>
 #include <txx-funcs.h>
 
 // ugly hack, but oh well
@@ -133,24 +135,10 @@ struct again_lut sensor_again_lut[] = {
 
 struct tx_isp_sensor_attribute sensor_attr;
 
+static const struct sensor_gain_lut sensor_gain_lut = SENSOR_GAIN_LUT(sensor_again_lut, index);
+
 unsigned int sensor_alloc_again(unsigned int isp_gain, unsigned char shift, unsigned int *sensor_again) {
-	struct again_lut *lut = sensor_again_lut;
-	while (lut->gain <= sensor_attr.max_again) {
-		if (isp_gain == 0) {
-			*sensor_again = lut[0].index;
-			return lut[0].gain;
-		} else if (isp_gain < lut->gain) {
-			*sensor_again = (lut - 1)->index;
-			return (lut - 1)->gain;
-		} else {
-			if ((lut->gain == sensor_attr.max_again) && (isp_gain >= lut->gain)) {
-				*sensor_again = lut->index;
-				return lut->gain;
-			}
-		}
-		lut++;
-	}
-	return isp_gain;
+	return sensor_gain_alloc(&sensor_gain_lut, sensor_attr.max_again, isp_gain, sensor_again);
 }
 
 unsigned int sensor_alloc_dgain(unsigned int isp_gain, unsigned char shift, unsigned int *sensor_dgain) {
@@ -1233,7 +1221,54 @@ static struct regval_list sensor_stream_off_mipi[] = {
 	{SENSOR_REG_END, 0x00},
 };
 
-int sensor_read(struct tx_isp_subdev *sd, unsigned char reg, unsigned char *value) {
+static const struct sensor_regs_range sensor_regs_volatile[] = {
+	{0xf0, 0xf1},	/* chip id, always read from the sensor */
+};
+
+static struct sensor_regs_cache sensor_regs_cache = {
+	.volatile_ranges = sensor_regs_volatile,
+	.n_volatile = ARRAY_SIZE(sensor_regs_volatile),
+};
+
+static const struct sensor_regs_config sensor_regs_cfg = {
+	.addr_bytes = 1,
+	.reg_end = SENSOR_REG_END,
+	.reg_delay = SENSOR_REG_DELAY,
+	.page_reg = 0xfe,
+	.layout = SENSOR_REGS_LAYOUT(struct regval_list),
+	.cache = &sensor_regs_cache,
+};
+
+/*
+ * AE registers in the vendor write order: there is no group hold, so the
+ * low byte of integration time and gain goes out before the high byte.
+ */
+enum {
+	SENSOR_EXPO_VTS_H,
+	SENSOR_EXPO_VTS_L,
+	SENSOR_EXPO_IT_L,
+	SENSOR_EXPO_IT_H,
+	SENSOR_EXPO_GAIN_B4,
+	SENSOR_EXPO_GAIN_B3,
+	SENSOR_EXPO_DPC,
+	SENSOR_EXPO_BLC,
+};
+
+static const uint16_t sensor_expo_regs[] = {0x41, 0x42, 0x04, 0x03, 0xb4, 0xb3, 0xb8, 0xb9};
+
+static const struct sensor_reg sensor_expo_page[] = {
+	{0xfe, 0x00},
+};
+
+static struct sensor_expo_packet sensor_expo = {
+	.cfg = &sensor_regs_cfg,
+	.regs = sensor_expo_regs,
+	.nregs = ARRAY_SIZE(sensor_expo_regs),
+	.hold_on = sensor_expo_page,
+	.n_hold_on = ARRAY_SIZE(sensor_expo_page),
+};
+
+static int sensor_read_bus(struct tx_isp_subdev *sd, unsigned char reg, unsigned char *value) {
 	struct i2c_client *client = tx_isp_get_subdevdata(sd);
 	struct i2c_msg msg[2] = {
 		[0] = {
@@ -1251,12 +1286,21 @@ int sensor_read(struct tx_isp_subdev *sd, unsigned char reg, unsigned char *valu
 	};
 	int ret;
 	ret = i2c_transfer(client->adapter, msg, 2);
-	if (ret > 0)
+	if (ret > 0) {
 		ret = 0;
+		sensor_regs_cache_write(&sensor_regs_cfg, reg, *value);
+	}
 
 	return ret;
 }
 
+int sensor_read(struct tx_isp_subdev *sd, unsigned char reg, unsigned char *value) {
+	if (!sensor_regs_cache_read(&sensor_regs_cfg, reg, value))
+		return 0;
+
+	return sensor_read_bus(sd, reg, value);
+}
+
 int sensor_write(struct tx_isp_subdev *sd, unsigned char reg, unsigned char value) {
 	struct i2c_client *client = tx_isp_get_subdevdata(sd);
 	unsigned char buf[2] = {reg, value};
@@ -1267,9 +1311,14 @@ int sensor_write(struct tx_isp_subdev *sd, unsigned char reg, unsigned char valu
 		.buf = buf,
 	};
 	int ret;
+	sensor_expo_invalidate(&sensor_expo);
 	ret = i2c_transfer(client->adapter, &msg, 1);
-	if (ret > 0)
+	if (ret > 0) {
 		ret = 0;
+		sensor_regs_cache_write(&sensor_regs_cfg, reg, value);
+	} else {
+		sensor_regs_cache_drop(&sensor_regs_cfg, reg);
+	}
 
 	return ret;
 }
@@ -1293,19 +1342,8 @@ static int sensor_read_array(struct tx_isp_subdev *sd, struct regval_list *vals)
 
 
 static int sensor_write_array(struct tx_isp_subdev *sd, struct regval_list *vals) {
-	int ret;
-	while (vals->reg_num != SENSOR_REG_END) {
-		if (vals->reg_num == SENSOR_REG_DELAY) {
-			msleep(vals->value);
-		} else {
-			ret = sensor_write(sd, vals->reg_num, vals->value);
-			if (ret < 0) {
-				return ret;
-			}
-		}
-		vals++;
-	}
-	return 0;
+	sensor_expo_invalidate(&sensor_expo);
+	return sensor_write_table(tx_isp_get_subdevdata(sd), &sensor_regs_cfg, vals, NULL);
 }
 
 static int sensor_reset(struct tx_isp_subdev *sd, int val) {
@@ -1341,28 +1379,28 @@ static int sensor_set_expo(struct tx_isp_subdev *sd, int value) {
 	int again = (value & 0xffff0000) >> 16;
 	struct again_lut *val_lut = sensor_again_lut;
 
-	/* sensor reg page */
-	ret = sensor_write(sd, 0xfe, 0x00);
-
 	/* vts */
 	if (vtsn0 != vts0) {
 		vts0 = vtsn0;
-		ret += sensor_write(sd, 0x41, vtsn0);
+		sensor_expo_set(&sensor_expo, SENSOR_EXPO_VTS_H, vtsn0);
 	}
 	if (vtsn1 != vts1) {
 		vts1 = vtsn1;
-		ret += sensor_write(sd, 0x42, vtsn1);
+		sensor_expo_set(&sensor_expo, SENSOR_EXPO_VTS_L, vtsn1);
 	}
 
 	/* integration time */
-	ret += sensor_write(sd, 0x04, it & 0xff);
-	ret += sensor_write(sd, 0x03, (it & 0x3f00) >> 8);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_IT_L, it & 0xff);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_IT_H, (it & 0x3f00) >> 8);
 
 	/* analog gain */
-	ret += sensor_write(sd, 0xb4, val_lut[again].regb4);
-	ret += sensor_write(sd, 0xb3, val_lut[again].regb3);
-	ret += sensor_write(sd, 0xb8, val_lut[again].dpc);
-	ret += sensor_write(sd, 0xb9, val_lut[again].blc);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_GAIN_B4, val_lut[again].regb4);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_GAIN_B3, val_lut[again].regb3);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_DPC, val_lut[again].dpc);
+	sensor_expo_set(&sensor_expo, SENSOR_EXPO_BLC, val_lut[again].blc);
+
+	/* page select, then everything that changed, in one transfer */
+	ret = sensor_expo_commit(tx_isp_get_subdevdata(sd), &sensor_expo);
 	if (ret < 0) {
 		ISP_ERROR("sensor_write error  %d\n", __LINE__);
 		return ret;
@@ -1426,6 +1464,7 @@ static int sensor_init(struct tx_isp_subdev *sd, int enable) {
 	sensor->video.mbus.field = V4L2_FIELD_NONE;
 	sensor->video.mbus.colorspace = wsize->colorspace;
 	sensor->video.fps = wsize->fps;
+	sensor_regs_cache_reset(&sensor_regs_cfg);
 	ret = sensor_write_array(sd, wsize->regs);
 	if (ret)
 		return ret;
@@ -1581,6 +1620,7 @@ static int sensor_g_chip_ident(struct tx_isp_subdev *sd, struct tx_isp_chip_iden
 			ISP_ERROR("gpio request fail %d\n", pwdn_gpio);
 		}
 	}
+	sensor_regs_cache_reset(&sensor_regs_cfg);
 	ret = sensor_detect(sd, &ident);
 	if (ret) {
 		ISP_ERROR("chip found @ 0x%x (%s) is not an %s chip.\n",
@@ -1676,7 +1716,15 @@ static int sensor_g_register(struct tx_isp_subdev *sd, struct tx_isp_dbg_registe
 	if (!capable(CAP_SYS_ADMIN)) {
 		return -EPERM;
 	}
-	ret = sensor_read(sd, reg->reg & 0xffff, &val);
+	if (reg->reg & SENSOR_REGS_DBG_DUMP) {
+		reg->val = sensor_regs_cache_dump(&sensor_regs_cfg);
+		reg->size = 2;
+		return 0;
+	}
+	if (reg->reg & SENSOR_REGS_DBG_NOCACHE)
+		ret = sensor_read_bus(sd, reg->reg & 0xffff, &val);
+	else
+		ret = sensor_read(sd, reg->reg & 0xffff, &val);
 	reg->val = val;
 	reg->size = 2;
 
@@ -1695,6 +1743,9 @@ static int sensor_s_register(struct tx_isp_subdev *sd, const struct tx_isp_dbg_r
 	}
 
 	sensor_write(sd, reg->reg & 0xffff, reg->val & 0xff);
+	/* leave it to the next read to fetch what the sensor really holds */
+	if (reg->reg & SENSOR_REGS_DBG_NOCACHE)
+		sensor_regs_cache_drop(&sensor_regs_cfg, reg->reg & 0xffff);
 
 	return 0;
 }
@@ -1928,6 +1979,7 @@ static struct i2c_driver sensor_driver = {
 };
 
 static __init int init_sensor(void) {
+	sensor_info.expo = &sensor_expo;
 	sensor_common_init(&sensor_info);
 	return i2c_add_driver(&sensor_driver);
 }
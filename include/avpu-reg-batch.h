@@ -0,0 +1,74 @@
+#ifndef __AVPU_REG_BATCH_H__
+#define __AVPU_REG_BATCH_H__
+
+/*
+ * Register access checks and the AL_CMD_IP_REG_BATCH executor, shared by
+ * every avpu module in both kernel trees. Include it after the module's
+ * own avpu_ip.h, which supplies the codec structures, AVPU_BASE_OFFSET and
+ * the avpu_err() macro.
+ */
+
+#include <linux/delay.h>
+#include <linux/io.h>
+
+/* Aligned and inside the encoder's register window */
+static inline int avpu_reg_valid(struct avpu_codec_desc *codec, unsigned int id)
+{
+	if (id % 4)
+		return 0;
+	return id >= AVPU_BASE_OFFSET && id < codec->regs_size;
+}
+
+/*
+ * Run a batch of register ops in order. Nothing is written unless every
+ * op in the batch is valid, so a bad entry cannot leave the encoder half
+ * programmed.
+ */
+static inline int avpu_codec_reg_batch(struct avpu_codec_chan *chan,
+				       struct avpu_reg_op *ops,
+				       unsigned int count, unsigned int poll_us,
+				       unsigned int *done)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	void __iomem *regs = codec->regs;
+	struct avpu_reg_op *op;
+	unsigned int i, t;
+
+	*done = 0;
+	if (!regs) {
+		avpu_err("Registers not mapped\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (ops[i].op > AVPU_REG_OP_WRITE_POLL ||
+		    !avpu_reg_valid(codec, ops[i].id)) {
+			avpu_err("Bad register op %u: %u 0x%.4X\n",
+				 i, ops[i].op, ops[i].id);
+			return -EINVAL;
+		}
+	}
+	if (poll_us > AVPU_REG_POLL_MAX_US)
+		poll_us = AVPU_REG_POLL_MAX_US;
+
+	for (i = 0; i < count; i++) {
+		op = &ops[i];
+		if (op->op == AVPU_REG_OP_READ) {
+			op->value = ioread32(regs + op->id);
+		} else {
+			iowrite32(op->value, regs + op->id);
+			if (op->op == AVPU_REG_OP_WRITE_POLL) {
+				for (t = 0; (op->value = ioread32(regs + op->id)) & op->mask; t++) {
+					if (t >= poll_us)
+						return -ETIMEDOUT;
+					udelay(1);
+				}
+			}
+		}
+		*done = i + 1;
+	}
+
+	return 0;
+}
+
+#endif /* __AVPU_REG_BATCH_H__ */
@@ -12,6 +12,8 @@
 #include <linux/ioctl.h>
 #include <linux/miscdevice.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/bitmap.h>
 #include <jz_proc.h>
 
 #include <linux/proc_fs.h>
@@ -41,6 +43,15 @@ static int pwdn_gpio = -1;
 module_param(pwdn_gpio, int, S_IRUGO);
 MODULE_PARM_DESC(pwdn_gpio, "Power down GPIO NUM");
 
+static int fast_probe = 0;
+module_param(fast_probe, int, 0644);
+MODULE_PARM_DESC(fast_probe, "Power cycle once per (address, clock) group and skip addresses that do not ACK");
+
+/* Result of an earlier probe, "index:bus:addr" as printed in /proc/jz/sinfo/info */
+static char g_cached[32];
+module_param_string(cached, g_cached, sizeof(g_cached), 0644);
+MODULE_PARM_DESC(cached, "Cached detection result to verify before a full probe, index:bus:addr");
+
 #ifdef CONFIG_SOC_T40
 static int cim1_gpio = GPIO_PC(30);
 module_param(cim1_gpio, int, S_IRUGO);
@@ -56,6 +67,7 @@ MODULE_PARM_DESC(cim_gpio, "Cim GPIO NUM");
 #define SENSOR_INFO_IOC_MAGIC  'S'
 #define IOCTL_SINFO_GET			_IO(SENSOR_INFO_IOC_MAGIC, 100)
 #define IOCTL_SINFO_FLASH		_IO(SENSOR_INFO_IOC_MAGIC, 101)
+#define IOCTL_SINFO_GET_STATUS		_IOR(SENSOR_INFO_IOC_MAGIC, 102, struct sinfo_status)
 
 #define SENSOR_TYPE_INVALID	-1
 
@@ -64,6 +76,20 @@ MODULE_PARM_DESC(cim_gpio, "Cim GPIO NUM");
 
 #define MAX_DETECTED_SENSORS 4
 
+enum {
+	PROBE_NONE,
+	PROBE_CACHE,	/* cached result verified, no scan */
+	PROBE_FULL,
+	PROBE_FAST,
+};
+
+struct sinfo_status {
+	int32_t sensor_id;
+	int32_t source;		/* PROBE_* */
+	uint32_t verify_us;	/* cache check, 0 if there was no cached result */
+	uint32_t probe_us;	/* table scan, 0 on a cache hit */
+};
+
 struct i2c_trans {
 	uint32_t addr;
 	uint32_t r_w;
@@ -260,6 +286,9 @@ static int8_t g_sensor_id = -1;
 static int8_t g_sensor_ids[MAX_DETECTED_SENSORS];
 static int8_t g_num_detected_sensors = 0;
 static struct mutex g_mutex;
+static int g_probe_src = PROBE_NONE;
+static unsigned int g_verify_us;
+static unsigned int g_probe_us;
 
 int sensor_read(SENSOR_INFO_P sinfo, struct i2c_adapter *adap, uint32_t addr, uint32_t *value)
 {
@@ -320,15 +349,328 @@ int sensor_read(SENSOR_INFO_P sinfo, struct i2c_adapter *adap, uint32_t addr, ui
 	return ret;
 }
 
-static int32_t process_one_adapter(struct device *dev, void *data)
+/* sp1409 needs a much longer reset, never share a power cycle with it */
+static int sensor_slow_reset(SENSOR_INFO_P sinfo)
+{
+	return strcmp(sinfo->name, "sp1409") == 0;
+}
+
+static struct clk *detect_power_on(SENSOR_INFO_P sinfo)
 {
 	int32_t ret;
-	int32_t i = 0;
-	int32_t j = 0;
 	struct clk *sclk;
 	struct clk *mclk;
-	struct i2c_adapter *adap;
+
+#ifdef CONFIG_SOC_T40
+	sinfo->mclk_name = "div_cim1";
+#endif
+
+#ifdef CONFIG_SOC_T41
+#ifdef CONFIG_KERNEL_4_4_94
+	sclk_name = "mux_cim";
+	sinfo->mclk_name = "div_cim";
+	sclk = clk_get(NULL, sclk_name);
+	if (IS_ERR(sclk)) {
+		printk("sinfo: [Error] Failed to get sensor input clock 'mux_cim'\n");
+		return sclk;
+	}
+	clk_set_rate(sclk, (unsigned long)clk_get(NULL, "vpll"));
+#endif
+#endif
+
+	mclk = clk_get(NULL, sinfo->mclk_name);
+	if (IS_ERR(mclk)) {
+		printk("sinfo: [Error] Failed to get sensor input clock 'div_cim'\n");
+		return mclk;
+	}
+
+	clk_set_rate(mclk, sinfo->clk);
+
+#if defined (CONFIG_SOC_T40) || (CONFIG_SOC_T41)
+	clk_prepare_enable(mclk);
+#else
+	clk_enable(mclk);
+#endif
+
+	if(reset_gpio != -1){
+		ret = gpio_request(reset_gpio,"reset");
+		if(!ret){
+			gpio_direction_output(reset_gpio, 1);
+			msleep(20);
+			gpio_direction_output(reset_gpio, 0);
+			if(sensor_slow_reset(sinfo))
+				msleep(600);
+			else{
+				msleep(20);
+				gpio_direction_output(reset_gpio, 1);
+				msleep(20);
+			}
+		}else{
+			printk("sinfo: [Error] GPIO request failed for reset GPIO number: %d\n", reset_gpio);
+		}
+	}
+	if(pwdn_gpio != -1){
+		ret = gpio_request(pwdn_gpio,"pwdn");
+		if(!ret){
+			gpio_direction_output(pwdn_gpio, 1);
+			msleep(150);
+			gpio_direction_output(pwdn_gpio, 0);
+			if(sensor_slow_reset(sinfo))
+				msleep(600);
+			else
+				msleep(10);
+		}else{
+			printk("sinfo: [Error] GPIO request failed for power down GPIO number: %d\n", pwdn_gpio);
+		}
+	}
+
+	return mclk;
+}
+
+static void detect_power_off(struct clk *mclk)
+{
+	if (-1 != reset_gpio)
+		gpio_free(reset_gpio);
+	if (-1 != pwdn_gpio)
+		gpio_free(pwdn_gpio);
+	clk_disable(mclk);
+	clk_put(mclk);
+}
+
+/* ID register values already read during this power cycle */
+#define ID_CACHE_SIZE 8
+
+struct id_cache {
+	int cnt;
+	struct {
+		uint32_t addr;
+		uint8_t addr_len;
+		uint8_t value_len;
+		uint32_t value;
+	} e[ID_CACHE_SIZE];
+};
+
+static int sensor_read_cached(SENSOR_INFO_P sinfo, struct i2c_adapter *adap, uint32_t addr,
+			      uint32_t *value, struct id_cache *cache)
+{
+	int ret;
+	int k;
+
+	if (cache) {
+		for (k = 0; k < cache->cnt; k++) {
+			if (cache->e[k].addr == addr && cache->e[k].addr_len == sinfo->id_addr_len &&
+			    cache->e[k].value_len == sinfo->id_value_len) {
+				*value = cache->e[k].value;
+				return 0;
+			}
+		}
+	}
+
+	ret = sensor_read(sinfo, adap, addr, value);
+	if (!ret && cache && cache->cnt < ID_CACHE_SIZE) {
+		cache->e[cache->cnt].addr = addr;
+		cache->e[cache->cnt].addr_len = sinfo->id_addr_len;
+		cache->e[cache->cnt].value_len = sinfo->id_value_len;
+		cache->e[cache->cnt].value = *value;
+		cache->cnt++;
+	}
+
+	return ret;
+}
+
+static int sensor_match(SENSOR_INFO_P sinfo, struct i2c_adapter *adap, struct id_cache *cache)
+{
+	int32_t ret;
+	int32_t j;
+	uint8_t idcnt = sinfo->id_cnt;
+
+	for (j = 0; j < idcnt; j++) {
+		uint32_t value = 0;
+		ret = sensor_read_cached(sinfo, adap, sinfo->id_addr[j], &value, cache);
+		if (0 != ret) {
+			printk("sinfo: [Error] Failed to read sensor at address 0x%x, value read: 0x%x\n", sinfo->id_addr[j], value);
+			break;
+		}
+		if(strcmp(sinfo->name, "ov2735b") == 0 && j == 2){
+			if (value == sinfo->id_value[j])
+				j++;
+		}
+		else
+			if (value != sinfo->id_value[j])
+				break;
+	}
+
+	return j == idcnt;
+}
+
+static void sensor_detected(int32_t i, struct i2c_adapter *adap)
+{
+	g_sinfo[i].adap = adap;
+
+	// Add to detected sensors array if there's room
+	if (g_num_detected_sensors < MAX_DETECTED_SENSORS) {
+		g_sensor_ids[g_num_detected_sensors] = i;
+		g_num_detected_sensors++;
+
+		if (g_sinfo[i].adap) {
+			printk("sinfo: Successful sensor detection: %s, I2C Bus: %d, I2C Address: 0x%X\n",
+				g_sinfo[i].name, g_sinfo[i].adap->nr, g_sinfo[i].i2c_addr);
+		} else {
+			printk("sinfo: Successful sensor detection: %s, I2C Bus: unknown, I2C Address: 0x%X\n",
+				g_sinfo[i].name, g_sinfo[i].i2c_addr);
+		}
+	}
+}
+
+static int32_t probe_full(struct i2c_adapter *adap)
+{
+	int32_t i;
+	struct clk *mclk;
 	uint8_t scnt = sizeof(g_sinfo)/sizeof(g_sinfo[0]);
+
+	for (i = 0; i < scnt; i++) {
+		mclk = detect_power_on(&g_sinfo[i]);
+		if (IS_ERR(mclk))
+			return PTR_ERR(mclk);
+
+		if (sensor_match(&g_sinfo[i], adap, NULL))
+			sensor_detected(i, adap);
+
+		detect_power_off(mclk);
+		// Continue checking all other sensors (don't exit)
+	}
+
+	return 0;
+}
+
+/* Entries that detect_power_on() brings up the same way */
+static int same_power(SENSOR_INFO_P a, SENSOR_INFO_P b)
+{
+	return a->clk == b->clk && sensor_slow_reset(a) == sensor_slow_reset(b);
+}
+
+/* Entries that can be checked after the same power cycle */
+static int same_group(SENSOR_INFO_P a, SENSOR_INFO_P b)
+{
+	return a->i2c_addr == b->i2c_addr && same_power(a, b);
+}
+
+/*
+ * Fast probe: power the sensor once and see which addresses ACK a read of
+ * their first candidate's ID register, then power cycle once per
+ * (address, clock) group and read only the ID registers of that group,
+ * sharing reads between candidates that use the same registers. The
+ * pre-scan runs with the first entry's MCLK and reset timing, so it only
+ * rules out candidates powered the same way; the others, and every group
+ * when no address answers at all, get their own power cycle as in the
+ * full probe. Matches are reported in table order, the same as the full
+ * probe.
+ */
+static int32_t probe_fast(struct i2c_adapter *adap)
+{
+	int32_t i, k;
+	struct clk *mclk;
+	struct id_cache cache;
+	uint8_t scnt = sizeof(g_sinfo)/sizeof(g_sinfo[0]);
+	DECLARE_BITMAP(acked, 128);
+	DECLARE_BITMAP(done, ARRAY_SIZE(g_sinfo));
+	DECLARE_BITMAP(found, ARRAY_SIZE(g_sinfo));
+	int any_ack = 0;
+	uint32_t value;
+
+	bitmap_zero(acked, 128);
+	bitmap_zero(done, scnt);
+	bitmap_zero(found, scnt);
+
+	mclk = detect_power_on(&g_sinfo[0]);
+	if (IS_ERR(mclk))
+		return PTR_ERR(mclk);
+	for (i = 0; i < scnt; i++) {
+		uint8_t addr = g_sinfo[i].i2c_addr & 0x7f;
+		for (k = 0; k < i; k++)
+			if ((g_sinfo[k].i2c_addr & 0x7f) == addr)
+				break;
+		if (k < i)
+			continue;
+		if (!sensor_read(&g_sinfo[i], adap, g_sinfo[i].id_addr[0], &value)) {
+			set_bit(addr, acked);
+			any_ack = 1;
+		}
+	}
+	detect_power_off(mclk);
+
+	for (i = 0; i < scnt; i++) {
+		if (test_bit(i, done))
+			continue;
+		if (any_ack && same_power(&g_sinfo[0], &g_sinfo[i]) &&
+		    !test_bit(g_sinfo[i].i2c_addr & 0x7f, acked))
+			continue;
+
+		mclk = detect_power_on(&g_sinfo[i]);
+		if (IS_ERR(mclk))
+			return PTR_ERR(mclk);
+
+		cache.cnt = 0;
+		for (k = i; k < scnt; k++) {
+			if (test_bit(k, done) || !same_group(&g_sinfo[i], &g_sinfo[k]))
+				continue;
+			set_bit(k, done);
+			if (sensor_match(&g_sinfo[k], adap, &cache))
+				set_bit(k, found);
+		}
+
+		detect_power_off(mclk);
+	}
+
+	for_each_set_bit(i, found, scnt)
+		sensor_detected(i, adap);
+
+	return 0;
+}
+
+/*
+ * Check the cached result with one power cycle and that entry's ID
+ * registers. Returns 1 and records the sensor if it still answers.
+ */
+static int cache_verify(struct i2c_adapter *adap)
+{
+	int idx, bus, addr;
+	uint8_t scnt = sizeof(g_sinfo)/sizeof(g_sinfo[0]);
+	struct clk *mclk;
+	ktime_t start;
+	int hit;
+
+	if (!g_cached[0])
+		return 0;
+	if (3 != sscanf(g_cached, "%i:%i:%i", &idx, &bus, &addr) ||
+	    idx < 0 || idx >= scnt || g_sinfo[idx].i2c_addr != addr) {
+		printk("sinfo: [Error] Invalid cached result: %s\n", g_cached);
+		return 0;
+	}
+	if (bus != adap->nr)
+		return 0;
+
+	start = ktime_get();
+	mclk = detect_power_on(&g_sinfo[idx]);
+	if (IS_ERR(mclk))
+		return 0;
+	hit = sensor_match(&g_sinfo[idx], adap, NULL);
+	detect_power_off(mclk);
+	g_verify_us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	printk("sinfo: Cached sensor %s %s in %u us\n", g_sinfo[idx].name,
+		hit ? "verified" : "did not match", g_verify_us);
+	if (hit)
+		sensor_detected(idx, adap);
+
+	return hit;
+}
+
+static int32_t process_one_adapter(struct device *dev, void *data)
+{
+	int32_t ret;
+	struct i2c_adapter *adap;
+	ktime_t start;
 	mutex_lock(&g_mutex);
 	if (dev->type != &i2c_adapter_type) {
 		mutex_unlock(&g_mutex);
@@ -364,117 +706,24 @@ static int32_t process_one_adapter(struct device *dev, void *data)
 
 #endif
 
-	for (i = 0; i < scnt; i++) {
-		uint8_t idcnt = g_sinfo[i].id_cnt;
-
-#ifdef CONFIG_SOC_T40
-		g_sinfo[i].mclk_name = "div_cim1";
-#endif
-
-#ifdef CONFIG_SOC_T41
-#ifdef CONFIG_KERNEL_4_4_94
-		sclk_name = "mux_cim";
-		g_sinfo[i].mclk_name = "div_cim";
-		sclk = clk_get(NULL, sclk_name);
-		if (IS_ERR(sclk)) {
-			printk("sinfo: [Error] Failed to get sensor input clock 'mux_cim'\n");
-			mutex_unlock(&g_mutex);
-			return PTR_ERR(sclk);
-		}
-		clk_set_rate(sclk, (unsigned long)clk_get(NULL, "vpll"));
-#endif
-#endif
-
-		mclk = clk_get(NULL, g_sinfo[i].mclk_name);
-		if (IS_ERR(mclk)) {
-			printk("sinfo: [Error] Failed to get sensor input clock 'div_cim'\n");
-			mutex_unlock(&g_mutex);
-			return PTR_ERR(mclk);
-		}
-
-		clk_set_rate(mclk, g_sinfo[i].clk);
-
-#if defined (CONFIG_SOC_T40) || (CONFIG_SOC_T41)
-		clk_prepare_enable(mclk);
-#else
-		clk_enable(mclk);
-#endif
-
-		if(reset_gpio != -1){
-			ret = gpio_request(reset_gpio,"reset");
-			if(!ret){
-				gpio_direction_output(reset_gpio, 1);
-				msleep(20);
-				gpio_direction_output(reset_gpio, 0);
-				if(strcmp(g_sinfo[i].name, "sp1409") == 0)
-					msleep(600);
-				else{
-					msleep(20);
-					gpio_direction_output(reset_gpio, 1);
-					msleep(20);
-				}
-			}else{
-				printk("sinfo: [Error] GPIO request failed for reset GPIO number: %d\n", reset_gpio);
-			}
-		}
-		if(pwdn_gpio != -1){
-			ret = gpio_request(pwdn_gpio,"pwdn");
-			if(!ret){
-				gpio_direction_output(pwdn_gpio, 1);
-				msleep(150);
-				gpio_direction_output(pwdn_gpio, 0);
-				if(strcmp(g_sinfo[i].name, "sp1409") == 0)
-					msleep(600);
-				else
-					msleep(10);
-			}else{
-				printk("sinfo: [Error] GPIO request failed for power down GPIO number: %d\n", pwdn_gpio);
-			}
-		}
-
-		for (j = 0; j < idcnt; j++) {
-			uint32_t value = 0;
-			ret = sensor_read(&g_sinfo[i], adap, g_sinfo[i].id_addr[j], &value);
-			if (0 != ret) {
-				printk("sinfo: [Error] Failed to read sensor at address 0x%x, value read: 0x%x\n", g_sinfo[i].id_addr[j], value);
-				break;
-			}
-			if(strcmp(g_sinfo[i].name, "ov2735b") == 0 && j == 2){
-				if (value == g_sinfo[i].id_value[j])
-					j++;
-			}
-			else
-				if (value != g_sinfo[i].id_value[j])
-					break;
-		}
-
-		if (-1 != reset_gpio)
-			gpio_free(reset_gpio);
-		if (-1 != pwdn_gpio)
-			gpio_free(pwdn_gpio);
-		clk_disable(mclk);
-		clk_put(mclk);
-
-		if (j == idcnt) {
-			// Match!
-			g_sinfo[i].adap = adap;
-
-			// Add to detected sensors array if there's room
-			if (g_num_detected_sensors < MAX_DETECTED_SENSORS) {
-				g_sensor_ids[g_num_detected_sensors] = i;
-				g_num_detected_sensors++;
-
-				if (g_sinfo[i].adap) {
-					printk("sinfo: Successful sensor detection: %s, I2C Bus: %d, I2C Address: 0x%X\n",
-						g_sinfo[i].name, g_sinfo[i].adap->nr, g_sinfo[i].i2c_addr);
-				} else {
-					printk("sinfo: Successful sensor detection: %s, I2C Bus: unknown, I2C Address: 0x%X\n",
-						g_sinfo[i].name, g_sinfo[i].i2c_addr);
-				}
-			}
-
-			// Continue checking all other sensors (don't exit)
-		}
+	g_verify_us = 0;
+	g_probe_us = 0;
+	ret = 0;
+	if (cache_verify(adap)) {
+		g_probe_src = PROBE_CACHE;
+	} else {
+		start = ktime_get();
+		g_probe_src = fast_probe ? PROBE_FAST : PROBE_FULL;
+		if (fast_probe)
+			ret = probe_fast(adap);
+		else
+			ret = probe_full(adap);
+		g_probe_us = ktime_to_us(ktime_sub(ktime_get(), start));
+		printk("sinfo: %s probe took %u ms\n", fast_probe ? "Fast" : "Full", g_probe_us / 1000);
+	}
+	if (ret) {
+		mutex_unlock(&g_mutex);
+		return ret;
 	}
 
 	// Set g_sensor_id to the first detected sensor (for backward compatibility)
@@ -658,6 +907,7 @@ static long sinfo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
 	int32_t data;
+	struct sinfo_status status;
 
 	mutex_lock(&g_mutex);
 	switch (cmd) {
@@ -675,6 +925,14 @@ static long sinfo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case IOCTL_SINFO_FLASH:
 		i2c_for_each_dev(NULL, process_one_adapter);
 		break;
+	case IOCTL_SINFO_GET_STATUS:
+		status.sensor_id = g_sensor_id;
+		status.source = g_probe_src;
+		status.verify_us = g_verify_us;
+		status.probe_us = g_probe_us;
+		if (copy_to_user((void *)arg, &status, sizeof(status)))
+			ret = -EFAULT;
+		break;
 	default:
 		printk("sinfo: [Error] Invalid IOCTL command received: 0x%08x\n", cmd);
 		ret = -EINVAL;
@@ -752,6 +1010,22 @@ static int sinfo_proc_show(struct seq_file *m, void *v)
 		}
 
 		seq_printf(m, "Primary sensor: %s\n", g_sinfo[g_sensor_id].name);
+		/* feed back through cached= or "cache:" to skip the scan next boot */
+		if (g_sinfo[g_sensor_id].adap)
+			seq_printf(m, "Cache: %d:%d:0x%x\n", g_sensor_id,
+					g_sinfo[g_sensor_id].adap->nr, g_sinfo[g_sensor_id].i2c_addr);
+	}
+	switch (g_probe_src) {
+	case PROBE_CACHE:
+		seq_printf(m, "Probe: cache, verify %u us\n", g_verify_us);
+		break;
+	case PROBE_FULL:
+	case PROBE_FAST:
+		seq_printf(m, "Probe: %s, %u us", g_probe_src == PROBE_FAST ? "fast" : "full", g_probe_us);
+		if (g_verify_us)
+			seq_printf(m, " (cache miss, verify %u us)", g_verify_us);
+		seq_printf(m, "\n");
+		break;
 	}
 	return 0;
 }
@@ -778,9 +1052,25 @@ ssize_t sinfo_proc_write(struct file *filp, const char *buf, size_t len, loff_t
 	/* probe sensor */
 	if (!strncmp(cmd, "1", strlen("1"))) {
 		i2c_for_each_dev(NULL, process_one_adapter);
+	/* probe sensor, grouped by address and clock */
+	} else if (!strncmp(cmd, "fastprobe", strlen("fastprobe"))) {
+		int old = fast_probe;
+		fast_probe = 1;
+		i2c_for_each_dev(NULL, process_one_adapter);
+		fast_probe = old;
 	/* probe sensor */
 	} else if (!strncmp(cmd, "probe", strlen("probe"))) {
 		i2c_for_each_dev(NULL, process_one_adapter);
+	/* set the cached result checked by the next probe, "cache:" clears it
+	 *
+	 * echo cache:12:0:0x37 > /proc/jz/sinfo/info
+	 * */
+	} else if (!strncmp(cmd, "cache:", strlen("cache:"))) {
+		/* strim() drops leading blanks by returning past them */
+		cmd[sizeof(cmd) - 1] = '\0';
+		mutex_lock(&g_mutex);
+		strlcpy(g_cached, strim(cmd + strlen("cache:")), sizeof(g_cached));
+		mutex_unlock(&g_mutex);
 	/* sensor open/release i2c read/write
 	 * open: set sensor clk,reset
 	 * release: free clk,reset gpio